@@ -5,916 +5,8843 @@
  **
  ** Creation date: Jul/03/2017.
  ** Revision date: Aug/09/2017. Avoids calculating unnecessary flags.
+ ** Revision date: Oct/17/2026. Worklist-driven code discovery, basic blocks.
+ ** Revision date: Oct/17/2026. Table-driven decoder with all official opcodes.
+ ** Revision date: Oct/17/2026. Bank switching F8, F6, F4 and 3F.
+ ** Revision date: Oct/17/2026. Reentrant library, batch conversion.
+ ** Revision date: Oct/17/2026. Intermediate representation, constant propagation.
+ ** Revision date: Oct/17/2026. CP1610 assembly backend.
+ ** Revision date: Oct/17/2026. C backend.
+ ** Revision date: Oct/17/2026. Interpreter to find code reached dynamically.
+ ** Revision date: Oct/17/2026. Verification of the IntyBASIC program.
+ ** Revision date: Oct/17/2026. Cycles of each block and hotspot report.
+ ** Revision date: Oct/17/2026. Natural loops written as FOR/NEXT and DO/LOOP.
+ ** Revision date: Oct/17/2026. Call graph, inlined subroutines and tail calls.
+ ** Revision date: Oct/17/2026. Summaries of the subroutines at each JSR.
+ ** Revision date: Oct/17/2026. Decimal mode followed per instruction, BCD ADC/SBC.
+ ** Revision date: Oct/17/2026. Register map for the TIA and the RIOT.
+ ** Revision date: Oct/17/2026. Display kernels collapsed into a WAIT.
+ ** Revision date: Oct/17/2026. RIOT timer waits become the frame wait.
+ ** Revision date: Oct/17/2026. Data in rows, copies of tables merged.
+ ** Revision date: Oct/17/2026. Zero page addresses promoted to variables.
+ ** Revision date: Oct/17/2026. 16-bit ADC/SBC chains and INC/BNE/INC.
+ ** Revision date: Oct/17/2026. Shift runs, multiply and divide subroutines.
+ ** Revision date: Oct/17/2026. Targets of (zp),Y pointers.
+ ** Revision date: Oct/17/2026. Jump tables written as ON GOTO.
  */
 
+#define _POSIX_C_SOURCE 200809L     /* strdup, strcasecmp and clock_gettime */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "c6502.h"
+
+#define R(addr) bank->rom[(addr) & 0x0fff]
+#define C(addr) bank->checked[(addr) & 0x0fff]
+#define ADDR(addr) (((addr) & 0x0fff) | bank->origin)
+#define OUTPUT (&bank->ctx->output)
+
+typedef unsigned char byte;
+
+/*
+ ** bit 1-0 = step of process where it passed (it means code)
+ ** bit 2 = 1 = label
+ ** bit 3 = starts a basic block
+ ** bit 4 = queued for discovery
+ ** bit 5 = executed by the interpreter
+ ** bit 6 = reached by the interpreter through a dynamic jump
+ ** bit 7 = RTS or RTI the interpreter saw used as a jump
+ */
+#define LABEL  0x04
+#define BLOCK  0x08    /* Starts a basic block */
+#define QUEUED 0x10    /* Pending in worklist */
+#define TRACED 0x20    /* Executed by the interpreter */
+#define DYNAMIC 0x40   /* Target of a jump found by the interpreter */
+#define JUMPED 0x80    /* RTS or RTI used as a jump */
+
+/*
+ ** Basic blocks, first they are the linear runs found by discovery,
+ ** later split at block boundaries and sorted by address.
+ */
+struct block {
+    int start;      /* Address of first instruction */
+    int end;        /* Address after last instruction */
+    int last;       /* Address of last instruction */
+    int live_in;    /* Flags and registers live at entry */
+    int live_out;   /* Flags and registers live at exit */
+    int cycles;     /* 6502 cycles */
+    int cost;       /* Estimated CP1610 cycles of the output */
+    int reads;      /* Subroutine entry: read before written, or -1 */
+    int writes;     /* Subroutine entry: always written before RTS */
+    int outputs;    /* Subroutine entry: VA, VX, VY and FC known at RTS */
+    byte output[4]; /* Their values */
+    int owner;      /* RTS: entry of its subroutine, -1 none, -2 many */
+    int decimal;    /* Decimal modes possible at entry, D_BINARY and D_DECIMAL */
+    int native;     /* Subroutine entry: its operation in natives + 1, or 0 */
+};
+
+/*
+ ** Jump into another bank found by discovery
+ */
+struct seed {
+    int bank;       /* Destination bank */
+    int address;    /* Destination address */
+};
+
+/*
+ ** Loop found over the dominators, written as a structured loop
+ */
+#define L_DO    0       /* DO ... LOOP WHILE */
+#define L_FOR   1       /* FOR ... NEXT */
+#define L_KERNEL 2      /* Display kernel, only its exit values and WAIT */
+#define L_POLL  3       /* Wait for the RIOT timer, the same */
+
+struct loop {
+    int header;     /* First block */
+    int latch;      /* Last block, it jumps back to the header */
+    int type;       /* L_DO, L_FOR, L_KERNEL or L_POLL */
+    int counter;    /* Register counted by L_FOR, VX or VY */
+    int first;      /* Its value entering the loop */
+    int limit;      /* Its value in the last iteration */
+    int init;       /* Instruction loading it before the loop */
+    int step;       /* Instruction changing it */
+    int setter;     /* Instruction setting the flags at the exit, or -1 */
+    int hoisted;    /* Flags computed once at the exit */
+    int set;        /* Those of them set */
+    int lines;      /* Scanlines drawn by L_KERNEL */
+};
+
+/*
+ ** How a JSR is written
+ */
+#define C_GOSUB     0       /* GOSUB */
+#define C_INLINE    1       /* The subroutine at the call site */
+#define C_TAIL      2       /* GOTO, the JSR is followed by RTS */
+#define C_NATIVE    3       /* Multiply or divide written in IntyBASIC */
+
+/*
+ ** Places and values seen by the interpreter running a subroutine alone
+ */
+#define PROBE_A     128     /* After the 128 bytes of RAM */
+#define PROBE_X     129
+#define PROBE_Y     130
+#define PROBE_SLOTS 131
+#define PROBE_LOW   0x100   /* Output: #t, the product or the remainder */
+#define PROBE_HIGH  0x101   /* Output: #t / 256, high byte or quotient */
+#define PROBE_COPY  0x102   /* Output: the first operand, or the second one after it */
+
+/*
+ ** A subroutine recognized as a multiply or a divide of two bytes
+ */
+struct native {
+    int operation;  /* '*' or '/' */
+    int inputs[2];  /* Places of the operands */
+    int total;
+    int places[8];  /* Places written */
+    int values[8];  /* Their values, constant, PROBE_LOW, PROBE_HIGH or PROBE_COPY + operand */
+    int unknown;    /* Registers left with other values, VA, VX and VY */
+};
+
+/*
+ ** Targets of a zero page pointer used by (zp),Y
+ */
+#define P_UNKNOWN   0       /* Anywhere, read through mem() */
+#define P_RAM       1       /* High byte always zero */
+#define P_PAGES     2       /* ROM pages, the low byte is computed */
+#define P_TABLES    3       /* ROM tables, both bytes are constants */
+
+#define POINTER_TARGETS 4
+
+struct pointer {
+    int kind;
+    int total;
+    int targets[POINTER_TARGETS];  /* Page or table addresses */
+};
+
+/*
+ ** A store through an index or the stack the interpreter ran, the RAM
+ ** it cleared
+ */
+#define MAX_CLEARS  32
+
+struct clear {
+    int number;         /* Bank */
+    int address;        /* Store */
+    int mixed;          /* Also wrote something else than zero */
+    byte bytes[128];    /* RAM bytes written with zero */
+};
+
+/*
+ ** A jump table read by JMP (ptr) or by an RTS dispatch
+ */
+#define JUMP_ENTRIES    32
+
+struct table {
+    int low;        /* Address of the low bytes */
+    int high;       /* Address of the high bytes */
+    int index;      /* RX or RY */
+    int shift;      /* The index is the entry shifted left this much */
+    int total;      /* Entries, 0 if the index isn't bounded */
+    int offset;     /* 1 for RTS, the address pushed is one before */
+};
+
+/*
+ ** Decimal modes possible at an instruction
+ */
+#define D_BINARY    1       /* D flag clear */
+#define D_DECIMAL   2       /* D flag set, ADC and SBC work in BCD */
+
+/*
+ ** Part of a chain of instructions written as one operation
+ */
+#define W_NONE      0       /* Instruction written alone */
+#define W_ADD       1       /* Starts a 16-bit ADC or SBC chain */
+#define W_INC       2       /* Starts INC / BNE / INC */
+#define W_INSIDE    3       /* Written by the start of its chain */
+#define W_CARRY     4       /* BNE of INC / BNE / INC, a GOTO */
+#define W_SHIFT     5       /* Starts a run of ASL or LSR */
+#define W_SCALE     6       /* Starts ASL, STA t, ASL, CLC, ADC t */
+
+/*
+ ** A hotspot access that selects the bank already running
+ */
+#define SAME_BANK   (-2)    /* In switched, the access does nothing */
+
+/*
+ ** A 4K view of the ROM with its own analysis. Banks don't share
+ ** anything while being analyzed, jumps into other banks are kept
+ ** in the seeds list until the round finishes.
+ */
+struct bank {
+    struct context *ctx;        /* Translation this bank belongs to */
+    int number;                 /* Bank number */
+    int origin;                 /* Base address for labels */
+    byte rom[4096];
+    unsigned short checked[4096];
+    int pending[4096];          /* Worklist, each address enters once */
+    int total_pending;
+    struct block *blocks;       /* Runs of discovery, then the blocks found */
+    int total_blocks;
+    int size_blocks;
+    int block_at[4096];         /* Index of block starting at address, or -1 */
+    int fallthrough;            /* Cleared by instructions that don't continue */
+    int previous;               /* Previous instruction in linear walk, or -1 */
+    short switched[4096];       /* Bank selected by instruction, SAME_BANK or -1 */
+    struct seed *seeds;
+    int total_seeds;
+    int size_seeds;
+    short live[4096];           /* Flags and registers live after each instruction */
+    unsigned runs[4096];        /* Times executed by the interpreter */
+    int fused[4096];            /* Instruction setting the flag tested by a branch, or -1 */
+    byte calls[4096];           /* How each JSR is written, C_GOSUB, C_INLINE, C_TAIL or C_NATIVE */
+    byte decimal[4096];         /* Decimal modes possible at each instruction */
+    byte wide[4096];            /* Part of a chain, W_NONE if not */
+    int alias[4096];            /* Same data written before, bank * 4096 + address, or -1 */
+    struct loop *loops;         /* Structured loops while emitting */
+    int total_loops;
+};
+
+/*
+ ** Bank switching schemes
+ */
+#define NONE   0       /* Plain 2K or 4K */
+#define F8     1       /* 8K, hotspots $1FF8-$1FF9 */
+#define F6     2       /* 16K, hotspots $1FF6-$1FF9 */
+#define F4     3       /* 32K, hotspots $1FF4-$1FFB */
+#define T3F    4       /* Tigervision, 2K banks selected writing to $3F */
+
+#define MAX_ROM    (512 * 1024)
+
+/*
+ ** Text buffer growing as needed
+ */
+struct buffer {
+    char *data;
+    size_t length;
+    size_t size;
+    int failed;                 /* Set if it couldn't grow */
+};
+
+/*
+ ** Intermediate representation of a block, one operation for each
+ ** 6502 instruction lowered into IntyBASIC statements with the
+ ** operands already expanded, so they can be optimized together.
+ */
+#define I_CODE      0   /* Statements from the template */
+#define I_BRANCH    1   /* Branch fused with the instruction setting its flag */
+#define I_SWITCH    2   /* Bank switch */
+#define I_UNHANDLED 3   /* Unhandled opcode */
+
+struct insn {
+    int address;    /* 6502 instruction */
+    int type;       /* I_CODE, I_BRANCH, I_SWITCH or I_UNHANDLED */
+    int first;      /* First statement */
+    int total;      /* Number of statements */
+    int warn;       /* Lines marked as suspicious */
+    int blank;      /* Ends with a GOTO, blank line after it */
+};
+
+struct stmt {
+    int text;       /* Offset of text in pool */
+    int target;     /* Variable assigned, zero for memory and others */
+    int keep;       /* Still emitted */
+};
+
+/*
+ ** A register of the TIA or the RIOT and what becomes of its accesses.
+ ** The templates are statements split with ; where @ is the value
+ ** written (a, x or y, R0, R1 or R2 for CP1610), NULL keeps the
+ ** access as memory and an empty one removes it.
+ */
+#define H_WRITE 0
+#define H_READ  1
+
+#define REGISTERS 0x60  /* TIA 0-$3F, RIOT $40-$5F */
+
+struct hardware {
+    int access;         /* H_WRITE or H_READ */
+    int address;
+    const char *name;
+    const char *basic;  /* IntyBASIC */
+    const char *native; /* CP1610 */
+};
+
+/*
+ ** Everything about the translation of one ROM, so many can be
+ ** translated at the same time.
+ */
+struct context {
+    int target;                 /* C6502_BASIC, C6502_CP1610, C6502_C or C6502_VERIFY */
+    int scheme;
+    int mirrored;               /* 2K ROM, repeated in both halves */
+    int hotspot;                /* First hotspot for F8, F6 and F4 */
+    struct bank *banks;
+    int total_banks;
+    int step;
+    struct buffer output;       /* Generated program */
+    struct buffer log;          /* Messages */
+    struct insn *insns;         /* Block being emitted */
+    int total_insns;
+    struct stmt *stmts;
+    int total_stmts;
+    int size_stmts;
+    struct buffer pool;         /* Text of statements */
+    char operand[256];          /* Last operand built */
+    char labels[4][16];         /* Last labels built */
+    int next_label;
+    int frames;                 /* Frames run by the interpreter */
+    struct hardware registers[2][REGISTERS];    /* Register map for writes and reads */
+    int wait_bank;              /* RIOT timer wait written as WAIT */
+    int wait_address;           /* -1 if none */
+    char *map;                  /* Copy of the register map given */
+    byte indexed[128];          /* RAM read by index, pointer or stack */
+    byte scalar[128];           /* RAM written as a variable */
+    byte scattered[128];        /* RAM written nonzero by index, pointer or stack */
+    byte pages[128][32];        /* Pages the interpreter saw through each pointer */
+    struct pointer pointers[128];   /* Targets of each pointer, by its low byte */
+    struct clear clears[MAX_CLEARS];    /* Stores through an index or the stack */
+    int total_clears;
+    struct native *natives;     /* Subroutines recognized */
+    int total_natives;
+};
+
+#define RA     1
+#define RX     2
+#define RY     3
+#define RS     4
+
+/*
+ ** Make room in a buffer for more text and its terminator
+ */
+int reserve(struct buffer *buffer, size_t length)
+{
+    char *data;
+    size_t size;
+    
+    if (buffer->length + length < buffer->size)
+        return 0;
+    size = buffer->size ? buffer->size : 4096;
+    while (buffer->length + length >= size)
+        size *= 2;
+    data = realloc(buffer->data, size);
+    if (data == NULL) {
+        buffer->failed = 1;
+        return -1;
+    }
+    buffer->data = data;
+    buffer->size = size;
+    return 0;
+}
+
+/*
+ ** Add a character to a buffer
+ */
+void put(struct buffer *buffer, int c)
+{
+    if (reserve(buffer, 1))
+        return;
+    buffer->data[buffer->length++] = c;
+    buffer->data[buffer->length] = '\0';
+}
+
+/*
+ ** Add formatted text to a buffer
+ */
+void print(struct buffer *buffer, const char *format, ...)
+{
+    va_list ap;
+    int length;
+    
+    va_start(ap, format);
+    length = vsnprintf(NULL, 0, format, ap);
+    va_end(ap);
+    if (length < 0 || reserve(buffer, length))
+        return;
+    va_start(ap, format);
+    vsnprintf(buffer->data + buffer->length, length + 1, format, ap);
+    va_end(ap);
+    buffer->length += length;
+}
+
+/*
+ ** Processor flags
+ */
+#define FN     0x01
+#define FZ     0x02
+#define FC     0x04
+#define FV     0x08
+#define FD     0x10
+#define FNZ    (FN | FZ)
+#define FALL   (FN | FZ | FC | FV)
+
+/*
+ ** Variables of the generated program, the flags are the same bits
+ */
+#define VA     0x0100  /* a */
+#define VX     0x0200  /* x */
+#define VY     0x0400  /* y */
+#define VT     0x1000  /* #t */
+#define VALL   (VA | VX | VY)
+#define LIVE_ALL   (FALL | VALL)
+
+#define VAR(l) (((l) & (LA | LX | LY | LT)) << 8)   /* From locations */
+
+static const int outputs_of[4] = {VA, VX, VY, FC};  /* Known at RTS, in struct block order */
+
+/*
+ ** Addressing modes
+ */
+#define IMP    0       /* Implied */
+#define ACC    1       /* Accumulator */
+#define IMM    2       /* #imm */
+#define ZPG    3       /* zpg */
+#define ZPX    4       /* zpg,X */
+#define ZPY    5       /* zpg,Y */
+#define ABS    6       /* abs */
+#define ABX    7       /* abs,X */
+#define ABY    8       /* abs,Y */
+#define IND    9       /* (abs) */
+#define IZX    10      /* (zpg,X) */
+#define IZY    11      /* (zpg),Y */
+#define REL    12      /* Relative */
+
+int lengths[] = {1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 2, 2, 2};
+
+/*
+ ** Kinds of operation, for control flow
+ */
+#define UNK    0       /* Unhandled opcode */
+#define OP     1       /* Continues with next instruction */
+#define BRANCH 2       /* Conditional branch */
+#define JUMP   3       /* JMP abs */
+#define JUMPI  4       /* JMP (ind) */
+#define CALL   5       /* JSR abs, BRK */
+#define RETURN 6       /* RTS, RTI */
+
+/*
+ ** Locations read or written by a template
+ */
+#define LA     0x01    /* a */
+#define LX     0x02    /* x */
+#define LY     0x04    /* y */
+#define LS     0x08    /* s */
+#define LT     0x10    /* #t */
+#define LM     0x20    /* Memory */
+
+int mode_locations[] = {0, LA, 0, LM, LM | LX, LM | LY, LM, LM | LX, LM | LY, LM, LM | LX, LM | LY, 0};
+
+#define MAX_STMT   12   /* Maximum statements in a template */
+
+/*
+ ** Emission templates are IntyBASIC statements separated by semicolons.
+ ** @ is replaced by the operand, and statements assigning n, z, c or v
+ ** are only emitted when the flag can be used later.
+ */
+#define NZ(r)  ";n = " r " AND $80;z = " r " = 0"
+
+#define T_LD(r)  r " = @" NZ(r)
+#define T_ST(r)  "@ = " r
+#define T_ORA    "a = a OR @" NZ("a")
+#define T_AND    "a = a AND @" NZ("a")
+#define T_EOR    "a = a XOR @" NZ("a")
+#define T_ADC    "#t = a + @ + c;v = (a XOR #t) AND (@ XOR #t) AND $80;a = #t" NZ("a") ";c = #t / 256"
+#define T_SBC    "#t = a + (@ XOR $FF) + c;v = (a XOR #t) AND ((@ XOR $FF) XOR #t) AND $80;a = #t" NZ("a") ";c = #t / 256"
+#define T_ADC_BCD "#t = (a AND 15) + (@ AND 15) + c;#t = #t + (#t + 22) / 32 * 6" \
+                  ";#t = (a AND $F0) + (@ AND $F0) + (#t AND 15) + (#t + 16) / 32 * 16;z = ((a + @ + c) AND 255) = 0" \
+                  ";n = #t AND $80;v = (a XOR #t) AND (@ XOR #t) AND $80;#t = #t + (#t + $160) / $200 * $60" \
+                  ";c = (#t + $100) / $200;a = #t"
+#define T_SBC_BCD "#t = a + (@ XOR $FF) + c;v = (a XOR #t) AND ((@ XOR $FF) XOR #t) AND $80;n = #t AND $80" \
+                  ";z = (#t AND 255) = 0;#t = (a AND 15) + 15 - (@ AND 15) + c;#t = #t + (31 - #t) / 16 * $10A" \
+                  ";#t = (#t AND 15) + (a AND $F0) + $100 - (@ AND $F0) - #t / 256 * 16;#t = #t + ($1FF - #t) / 256 * $A0" \
+                  ";c = (a + (@ XOR $FF) + c) / 256;a = #t"
+#define T_CP(r)  "#t = " r " - @ + 256;n = #t AND $80;z = (#t AND 255) = 0;c = #t / 256"
+#define T_ASL    "c = @ / 128;@ = @ * 2" NZ("@")
+#define T_LSR    "c = @ AND 1;@ = @ / 2;n = 0;z = @ = 0"
+#define T_ROL    "#t = c;c = @ / 128;@ = @ * 2 + #t" NZ("@")
+#define T_ROR    "#t = c;c = @ AND 1;@ = @ / 2 + #t * 128" NZ("@")
+#define T_INC    "@ = @ + 1" NZ("@")
+#define T_DEC    "@ = @ - 1" NZ("@")
+#define T_BIT    "n = @ AND $80;z = (@ AND a) = 0;v = @ AND $40"
+
+struct opcode {
+    const char *name;   /* Mnemonic */
+    byte mode;          /* Addressing mode */
+    byte kind;          /* Kind of operation */
+    byte defs;          /* Flags defined */
+    byte uses;          /* Flags used */
+    const char *code;   /* Template for IntyBASIC */
+    byte writes;        /* Locations written, filled by prepare() */
+    byte reads;         /* Locations read before written, filled by prepare() */
+    const char *native; /* CP1610 template, filled by prepare() */
+} opcodes[256] = {
+    [0x00] = {"BRK", IMM, CALL,   0,         0,    "GOSUB @"},
+    [0x01] = {"ORA", IZX, OP,     FNZ,       0,    T_ORA},
+    [0x05] = {"ORA", ZPG, OP,     FNZ,       0,    T_ORA},
+    [0x06] = {"ASL", ZPG, OP,     FNZ | FC,  0,    T_ASL},
+    [0x08] = {"PHP", IMP, OP,     0,         FALL, "zp(s) = (n <> 0) AND $80 OR (v <> 0) AND $40 OR (z <> 0) AND 2 OR c OR $34;s = s - 1"},
+    [0x09] = {"ORA", IMM, OP,     FNZ,       0,    T_ORA},
+    [0x0a] = {"ASL", ACC, OP,     FNZ | FC,  0,    T_ASL},
+    [0x0d] = {"ORA", ABS, OP,     FNZ,       0,    T_ORA},
+    [0x0e] = {"ASL", ABS, OP,     FNZ | FC,  0,    T_ASL},
+    [0x10] = {"BPL", REL, BRANCH, 0,         FN,   "IF n = 0 THEN GOTO @"},
+    [0x11] = {"ORA", IZY, OP,     FNZ,       0,    T_ORA},
+    [0x15] = {"ORA", ZPX, OP,     FNZ,       0,    T_ORA},
+    [0x16] = {"ASL", ZPX, OP,     FNZ | FC,  0,    T_ASL},
+    [0x18] = {"CLC", IMP, OP,     FC,        0,    "c = 0"},
+    [0x19] = {"ORA", ABY, OP,     FNZ,       0,    T_ORA},
+    [0x1d] = {"ORA", ABX, OP,     FNZ,       0,    T_ORA},
+    [0x1e] = {"ASL", ABX, OP,     FNZ | FC,  0,    T_ASL},
+    [0x20] = {"JSR", ABS, CALL,   0,         0,    "GOSUB @"},
+    [0x21] = {"AND", IZX, OP,     FNZ,       0,    T_AND},
+    [0x24] = {"BIT", ZPG, OP,     FNZ | FV,  0,    T_BIT},
+    [0x25] = {"AND", ZPG, OP,     FNZ,       0,    T_AND},
+    [0x26] = {"ROL", ZPG, OP,     FNZ | FC,  FC,   T_ROL},
+    [0x28] = {"PLP", IMP, OP,     FALL | FD, 0,    "s = s + 1;#t = zp(s);n = #t AND $80;v = #t AND $40;z = #t AND 2;c = #t AND 1"},
+    [0x29] = {"AND", IMM, OP,     FNZ,       0,    T_AND},
+    [0x2a] = {"ROL", ACC, OP,     FNZ | FC,  FC,   T_ROL},
+    [0x2c] = {"BIT", ABS, OP,     FNZ | FV,  0,    T_BIT},
+    [0x2d] = {"AND", ABS, OP,     FNZ,       0,    T_AND},
+    [0x2e] = {"ROL", ABS, OP,     FNZ | FC,  FC,   T_ROL},
+    [0x30] = {"BMI", REL, BRANCH, 0,         FN,   "IF n THEN GOTO @"},
+    [0x31] = {"AND", IZY, OP,     FNZ,       0,    T_AND},
+    [0x35] = {"AND", ZPX, OP,     FNZ,       0,    T_AND},
+    [0x36] = {"ROL", ZPX, OP,     FNZ | FC,  FC,   T_ROL},
+    [0x38] = {"SEC", IMP, OP,     FC,        0,    "c = 1"},
+    [0x39] = {"AND", ABY, OP,     FNZ,       0,    T_AND},
+    [0x3d] = {"AND", ABX, OP,     FNZ,       0,    T_AND},
+    [0x3e] = {"ROL", ABX, OP,     FNZ | FC,  FC,   T_ROL},
+    [0x40] = {"RTI", IMP, RETURN, 0,         0,    "RETURN"},
+    [0x41] = {"EOR", IZX, OP,     FNZ,       0,    T_EOR},
+    [0x45] = {"EOR", ZPG, OP,     FNZ,       0,    T_EOR},
+    [0x46] = {"LSR", ZPG, OP,     FNZ | FC,  0,    T_LSR},
+    [0x48] = {"PHA", IMP, OP,     0,         0,    "zp(s) = a;s = s - 1"},
+    [0x49] = {"EOR", IMM, OP,     FNZ,       0,    T_EOR},
+    [0x4a] = {"LSR", ACC, OP,     FNZ | FC,  0,    T_LSR},
+    [0x4c] = {"JMP", ABS, JUMP,   0,         0,    "GOTO @"},
+    [0x4d] = {"EOR", ABS, OP,     FNZ,       0,    T_EOR},
+    [0x4e] = {"LSR", ABS, OP,     FNZ | FC,  0,    T_LSR},
+    [0x50] = {"BVC", REL, BRANCH, 0,         FV,   "IF v = 0 THEN GOTO @"},
+    [0x51] = {"EOR", IZY, OP,     FNZ,       0,    T_EOR},
+    [0x55] = {"EOR", ZPX, OP,     FNZ,       0,    T_EOR},
+    [0x56] = {"LSR", ZPX, OP,     FNZ | FC,  0,    T_LSR},
+    [0x58] = {"CLI", IMP, OP,     0,         0,    "' CLI"},
+    [0x59] = {"EOR", ABY, OP,     FNZ,       0,    T_EOR},
+    [0x5d] = {"EOR", ABX, OP,     FNZ,       0,    T_EOR},
+    [0x5e] = {"LSR", ABX, OP,     FNZ | FC,  0,    T_LSR},
+    [0x60] = {"RTS", IMP, RETURN, 0,         0,    "RETURN"},
+    [0x61] = {"ADC", IZX, OP,     FALL,      FC | FD, T_ADC},
+    [0x65] = {"ADC", ZPG, OP,     FALL,      FC | FD, T_ADC},
+    [0x66] = {"ROR", ZPG, OP,     FNZ | FC,  FC,   T_ROR},
+    [0x68] = {"PLA", IMP, OP,     FNZ,       0,    "s = s + 1;a = zp(s)" NZ("a")},
+    [0x69] = {"ADC", IMM, OP,     FALL,      FC | FD, T_ADC},
+    [0x6a] = {"ROR", ACC, OP,     FNZ | FC,  FC,   T_ROR},
+    [0x6c] = {"JMP", IND, JUMPI,  0,         0,    "' JMP (@)\t' !!!"},
+    [0x6d] = {"ADC", ABS, OP,     FALL,      FC | FD, T_ADC},
+    [0x6e] = {"ROR", ABS, OP,     FNZ | FC,  FC,   T_ROR},
+    [0x70] = {"BVS", REL, BRANCH, 0,         FV,   "IF v THEN GOTO @"},
+    [0x71] = {"ADC", IZY, OP,     FALL,      FC | FD, T_ADC},
+    [0x75] = {"ADC", ZPX, OP,     FALL,      FC | FD, T_ADC},
+    [0x76] = {"ROR", ZPX, OP,     FNZ | FC,  FC,   T_ROR},
+    [0x78] = {"SEI", IMP, OP,     0,         0,    "' SEI"},
+    [0x79] = {"ADC", ABY, OP,     FALL,      FC | FD, T_ADC},
+    [0x7d] = {"ADC", ABX, OP,     FALL,      FC | FD, T_ADC},
+    [0x7e] = {"ROR", ABX, OP,     FNZ | FC,  FC,   T_ROR},
+    [0x81] = {"STA", IZX, OP,     0,         0,    T_ST("a")},
+    [0x84] = {"STY", ZPG, OP,     0,         0,    T_ST("y")},
+    [0x85] = {"STA", ZPG, OP,     0,         0,    T_ST("a")},
+    [0x86] = {"STX", ZPG, OP,     0,         0,    T_ST("x")},
+    [0x88] = {"DEY", IMP, OP,     FNZ,       0,    "y = y - 1" NZ("y")},
+    [0x8a] = {"TXA", IMP, OP,     FNZ,       0,    "a = x" NZ("a")},
+    [0x8c] = {"STY", ABS, OP,     0,         0,    T_ST("y")},
+    [0x8d] = {"STA", ABS, OP,     0,         0,    T_ST("a")},
+    [0x8e] = {"STX", ABS, OP,     0,         0,    T_ST("x")},
+    [0x90] = {"BCC", REL, BRANCH, 0,         FC,   "IF c = 0 THEN GOTO @"},
+    [0x91] = {"STA", IZY, OP,     0,         0,    T_ST("a")},
+    [0x94] = {"STY", ZPX, OP,     0,         0,    T_ST("y")},
+    [0x95] = {"STA", ZPX, OP,     0,         0,    T_ST("a")},
+    [0x96] = {"STX", ZPY, OP,     0,         0,    T_ST("x")},
+    [0x98] = {"TYA", IMP, OP,     FNZ,       0,    "a = y" NZ("a")},
+    [0x99] = {"STA", ABY, OP,     0,         0,    T_ST("a")},
+    [0x9a] = {"TXS", IMP, OP,     0,         0,    "s = x"},
+    [0x9d] = {"STA", ABX, OP,     0,         0,    T_ST("a")},
+    [0xa0] = {"LDY", IMM, OP,     FNZ,       0,    T_LD("y")},
+    [0xa1] = {"LDA", IZX, OP,     FNZ,       0,    T_LD("a")},
+    [0xa2] = {"LDX", IMM, OP,     FNZ,       0,    T_LD("x")},
+    [0xa4] = {"LDY", ZPG, OP,     FNZ,       0,    T_LD("y")},
+    [0xa5] = {"LDA", ZPG, OP,     FNZ,       0,    T_LD("a")},
+    [0xa6] = {"LDX", ZPG, OP,     FNZ,       0,    T_LD("x")},
+    [0xa8] = {"TAY", IMP, OP,     FNZ,       0,    "y = a" NZ("y")},
+    [0xa9] = {"LDA", IMM, OP,     FNZ,       0,    T_LD("a")},
+    [0xaa] = {"TAX", IMP, OP,     FNZ,       0,    "x = a" NZ("x")},
+    [0xac] = {"LDY", ABS, OP,     FNZ,       0,    T_LD("y")},
+    [0xad] = {"LDA", ABS, OP,     FNZ,       0,    T_LD("a")},
+    [0xae] = {"LDX", ABS, OP,     FNZ,       0,    T_LD("x")},
+    [0xb0] = {"BCS", REL, BRANCH, 0,         FC,   "IF c THEN GOTO @"},
+    [0xb1] = {"LDA", IZY, OP,     FNZ,       0,    T_LD("a")},
+    [0xb4] = {"LDY", ZPX, OP,     FNZ,       0,    T_LD("y")},
+    [0xb5] = {"LDA", ZPX, OP,     FNZ,       0,    T_LD("a")},
+    [0xb6] = {"LDX", ZPY, OP,     FNZ,       0,    T_LD("x")},
+    [0xb8] = {"CLV", IMP, OP,     FV,        0,    "v = 0"},
+    [0xb9] = {"LDA", ABY, OP,     FNZ,       0,    T_LD("a")},
+    [0xba] = {"TSX", IMP, OP,     FNZ,       0,    "x = s" NZ("x")},
+    [0xbc] = {"LDY", ABX, OP,     FNZ,       0,    T_LD("y")},
+    [0xbd] = {"LDA", ABX, OP,     FNZ,       0,    T_LD("a")},
+    [0xbe] = {"LDX", ABY, OP,     FNZ,       0,    T_LD("x")},
+    [0xc0] = {"CPY", IMM, OP,     FNZ | FC,  0,    T_CP("y")},
+    [0xc1] = {"CMP", IZX, OP,     FNZ | FC,  0,    T_CP("a")},
+    [0xc4] = {"CPY", ZPG, OP,     FNZ | FC,  0,    T_CP("y")},
+    [0xc5] = {"CMP", ZPG, OP,     FNZ | FC,  0,    T_CP("a")},
+    [0xc6] = {"DEC", ZPG, OP,     FNZ,       0,    T_DEC},
+    [0xc8] = {"INY", IMP, OP,     FNZ,       0,    "y = y + 1" NZ("y")},
+    [0xc9] = {"CMP", IMM, OP,     FNZ | FC,  0,    T_CP("a")},
+    [0xca] = {"DEX", IMP, OP,     FNZ,       0,    "x = x - 1" NZ("x")},
+    [0xcc] = {"CPY", ABS, OP,     FNZ | FC,  0,    T_CP("y")},
+    [0xcd] = {"CMP", ABS, OP,     FNZ | FC,  0,    T_CP("a")},
+    [0xce] = {"DEC", ABS, OP,     FNZ,       0,    T_DEC},
+    [0xd0] = {"BNE", REL, BRANCH, 0,         FZ,   "IF z = 0 THEN GOTO @"},
+    [0xd1] = {"CMP", IZY, OP,     FNZ | FC,  0,    T_CP("a")},
+    [0xd5] = {"CMP", ZPX, OP,     FNZ | FC,  0,    T_CP("a")},
+    [0xd6] = {"DEC", ZPX, OP,     FNZ,       0,    T_DEC},
+    [0xd8] = {"CLD", IMP, OP,     FD,        0,    "' Entering binary mode"},
+    [0xd9] = {"CMP", ABY, OP,     FNZ | FC,  0,    T_CP("a")},
+    [0xdd] = {"CMP", ABX, OP,     FNZ | FC,  0,    T_CP("a")},
+    [0xde] = {"DEC", ABX, OP,     FNZ,       0,    T_DEC},
+    [0xe0] = {"CPX", IMM, OP,     FNZ | FC,  0,    T_CP("x")},
+    [0xe1] = {"SBC", IZX, OP,     FALL,      FC | FD, T_SBC},
+    [0xe4] = {"CPX", ZPG, OP,     FNZ | FC,  0,    T_CP("x")},
+    [0xe5] = {"SBC", ZPG, OP,     FALL,      FC | FD, T_SBC},
+    [0xe6] = {"INC", ZPG, OP,     FNZ,       0,    T_INC},
+    [0xe8] = {"INX", IMP, OP,     FNZ,       0,    "x = x + 1" NZ("x")},
+    [0xe9] = {"SBC", IMM, OP,     FALL,      FC | FD, T_SBC},
+    [0xea] = {"NOP", IMP, OP,     0,         0,    "' NOP"},
+    [0xec] = {"CPX", ABS, OP,     FNZ | FC,  0,    T_CP("x")},
+    [0xed] = {"SBC", ABS, OP,     FALL,      FC | FD, T_SBC},
+    [0xee] = {"INC", ABS, OP,     FNZ,       0,    T_INC},
+    [0xf0] = {"BEQ", REL, BRANCH, 0,         FZ,   "IF z THEN GOTO @"},
+    [0xf1] = {"SBC", IZY, OP,     FALL,      FC | FD, T_SBC},
+    [0xf5] = {"SBC", ZPX, OP,     FALL,      FC | FD, T_SBC},
+    [0xf6] = {"INC", ZPX, OP,     FNZ,       0,    T_INC},
+    [0xf8] = {"SED", IMP, OP,     FD,        0,    "' Entering decimal mode"},
+    [0xf9] = {"SBC", ABY, OP,     FALL,      FC | FD, T_SBC},
+    [0xfd] = {"SBC", ABX, OP,     FALL,      FC | FD, T_SBC},
+    [0xfe] = {"INC", ABX, OP,     FNZ,       0,    T_INC},
+};
+
+/*
+ ** Cycles used by each instruction, without the extra cycle of a
+ ** branch taken or an index crossing a page.
+ */
+byte cycles[256] = {
+    7, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 0, 4, 6, 0,
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+    6, 6, 0, 0, 3, 3, 5, 0, 4, 2, 2, 0, 4, 4, 6, 0,
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+    6, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 3, 4, 6, 0,
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+    6, 6, 0, 0, 0, 3, 5, 0, 4, 2, 2, 0, 5, 4, 6, 0,
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+    0, 6, 0, 0, 3, 3, 3, 0, 2, 0, 2, 0, 4, 4, 4, 0,
+    2, 6, 0, 0, 4, 4, 4, 0, 2, 5, 2, 0, 0, 5, 0, 0,
+    2, 6, 2, 0, 3, 3, 3, 0, 2, 2, 2, 0, 4, 4, 4, 0,
+    2, 5, 0, 0, 4, 4, 4, 0, 2, 4, 2, 0, 4, 4, 4, 0,
+    2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+    2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+};
+
+/*
+ ** CP1610 templates, for as1600. The registers a, x and y are kept
+ ** in R0, R1 and R2 with values from 0 to 255, R3 and R5 are scratch
+ ** and R4 points to indexed operands. The flags live in memory: VAR_N
+ ** has the N flag in bit 7, VAR_Z is zero when Z is set, VAR_C is 0
+ ** or 1 and VAR_V isn't zero when V is set.
+ **
+ ** Statements are separated by semicolons. A mnemonic ending in *
+ ** takes the operand of the instruction (MVI* gives MVII, MVI or MVI@
+ ** depending on the addressing mode), % is replaced by the operand as
+ ** written for IntyBASIC, and Rv is the register holding the value of
+ ** a read-modify-write instruction (R0 for the accumulator), loaded
+ ** by ^ and stored back by !. The prefixes n:, z:, c: and v: only
+ ** emit the statement if the flag can be used later, f: if any flag
+ ** defined by the instruction can. Comments start with an apostrophe.
+ */
+#define A_NZ(r)  ";n:MVO " r ", VAR_N;z:MVO " r ", VAR_Z"
+#define A_C      ";c:CMPI #$100, Rv;c:CLRR R5;c:ADCR R5;c:MVO R5, VAR_C"
+
+#define A_LD(r)  "MVI* " r A_NZ(r)
+#define A_ST(r)  "MVO* " r
+#define A_ORA    "MVI* R3;MOVR R3, R5;ANDR R0, R5;XORR R3, R0;XORR R5, R0" A_NZ("R0")
+#define A_ADD    ";v:MOVR R0, R5;ADDR R3, R0;ADD VAR_C, R0;v:XORR R0, R5;v:XORR R0, R3;v:ANDR R3, R5" \
+                 ";v:ANDI #$80, R5;v:MVO R5, VAR_V;c:CMPI #$100, R0;c:CLRR R5;c:ADCR R5;c:MVO R5, VAR_C" \
+                 ";ANDI #$FF, R0" A_NZ("R0")
+#define A_ADC_BCD "MVI* R3;z:MOVR R0, R5;z:ADDR R3, R5;z:ADD VAR_C, R5;z:ANDI #$FF, R5;z:MVO R5, VAR_Z;PSHR R0" \
+                  ";MOVR R3, R5;ANDI #$0F, R5;ADD VAR_C, R5;ANDI #$0F, R0;ADDR R5, R0;CMPI #10, R0;BNC $ + 4;ADDI #6, R0" \
+                  ";MOVR R0, R5;ANDI #$0F, R5;CMPI #$10, R0;BNC $ + 4;ADDI #$10, R5;PULR R0;PSHR R0;ANDI #$F0, R0" \
+                  ";ADDR R5, R0;MOVR R3, R5;ANDI #$F0, R5;ADDR R5, R0;PULR R5;v:XORR R0, R5;v:XORR R0, R3;v:ANDR R3, R5" \
+                  ";v:ANDI #$80, R5;v:MVO R5, VAR_V;n:MVO R0, VAR_N;CMPI #$A0, R0;BNC $ + 4;ADDI #$60, R0" \
+                  ";c:CMPI #$100, R0;c:CLRR R5;c:ADCR R5;c:MVO R5, VAR_C;ANDI #$FF, R0"
+#define A_SBC_BCD "MVI* R3;PSHR R0;ANDI #$0F, R0;ADDI #15, R0;ADD VAR_C, R0;MOVR R3, R5;ANDI #$0F, R5;SUBR R5, R0" \
+                  ";CMPI #$10, R0;BC $ + 4;ADDI #$10A, R0;MOVR R0, R5;ANDI #$0F, R5;ANDI #$100, R0;SLR R0, 2;SLR R0, 2" \
+                  ";SUBR R0, R5;PULR R0;PSHR R0;ANDI #$F0, R0;ADDR R5, R0;MOVR R3, R5;ANDI #$F0, R5;SUBR R5, R0" \
+                  ";BPL $ + 4;SUBI #$60, R0;PULR R5;PSHR R0;XORI #$FF, R3;MOVR R5, R0;ADDR R3, R0;ADD VAR_C, R0" \
+                  ";v:XORR R0, R5;v:XORR R0, R3;v:ANDR R3, R5;v:ANDI #$80, R5;v:MVO R5, VAR_V;n:MVO R0, VAR_N" \
+                  ";c:CMPI #$100, R0;c:CLRR R5;c:ADCR R5;c:MVO R5, VAR_C;z:ANDI #$FF, R0;z:MVO R0, VAR_Z;PULR R0;ANDI #$FF, R0"
+#define A_CP(r)  "f:MOVR " r ", R3;f:SUB* R3;c:CLRR R5;c:ADCR R5;c:MVO R5, VAR_C" A_NZ("R3")
+#define A_ROL    "^;ADDR Rv, Rv;ADD VAR_C, Rv" A_C ";ANDI #$FF, Rv;!" A_NZ("Rv")
+#define A_ROR    "^;MVI VAR_C, R5;NEGR R5;ANDI #$100, R5;ADDR R5, Rv;c:MOVR Rv, R5;c:ANDI #1, R5;c:MVO R5, VAR_C" \
+                 ";SLR Rv, 1;!" A_NZ("Rv")
+#define A_BR(f, t, b)   "MVI " f ", R3;" t ";" b " %"
+#define A_PUSH(r)   "MVI VAR_S, R4;ADDI #ZP, R4;MVO@ " r ", R4;MVI VAR_S, R5;DECR R5;ANDI #$FF, R5;MVO R5, VAR_S"
+#define A_PULL(r)   "MVI VAR_S, R5;INCR R5;ANDI #$FF, R5;MVO R5, VAR_S;ADDI #ZP, R5;MVI@ R5, " r
+
+struct {
+    const char *name;
+    const char *code;
+} cp1610[] = {
+    {"ADC", "MVI* R3" A_ADD},
+    {"AND", "AND* R0" A_NZ("R0")},
+    {"ASL", "^;ADDR Rv, Rv" A_C ";ANDI #$FF, Rv;!" A_NZ("Rv")},
+    {"BCC", A_BR("VAR_C", "TSTR R3", "BEQ")},
+    {"BCS", A_BR("VAR_C", "TSTR R3", "BNEQ")},
+    {"BEQ", A_BR("VAR_Z", "TSTR R3", "BEQ")},
+    {"BIT", "MVI* R3;n:MVO R3, VAR_N;v:MOVR R3, R5;v:ANDI #$40, R5;v:MVO R5, VAR_V;z:ANDR R0, R3;z:MVO R3, VAR_Z"},
+    {"BMI", A_BR("VAR_N", "ANDI #$80, R3", "BNEQ")},
+    {"BNE", A_BR("VAR_Z", "TSTR R3", "BNEQ")},
+    {"BPL", A_BR("VAR_N", "ANDI #$80, R3", "BEQ")},
+    {"BVC", A_BR("VAR_V", "TSTR R3", "BEQ")},
+    {"BVS", A_BR("VAR_V", "TSTR R3", "BNEQ")},
+    {"CLC", "c:CLRR R5;c:MVO R5, VAR_C"},
+    {"CLD", "' Entering binary mode"},
+    {"CLI", "' CLI"},
+    {"CLV", "v:CLRR R5;v:MVO R5, VAR_V"},
+    {"CMP", A_CP("R0")},
+    {"CPX", A_CP("R1")},
+    {"CPY", A_CP("R2")},
+    {"DEC", "^;DECR Rv;ANDI #$FF, Rv;!" A_NZ("Rv")},
+    {"DEX", "DECR R1;ANDI #$FF, R1" A_NZ("R1")},
+    {"DEY", "DECR R2;ANDI #$FF, R2" A_NZ("R2")},
+    {"EOR", "XOR* R0" A_NZ("R0")},
+    {"INC", "^;INCR Rv;ANDI #$FF, Rv;!" A_NZ("Rv")},
+    {"INX", "INCR R1;ANDI #$FF, R1" A_NZ("R1")},
+    {"INY", "INCR R2;ANDI #$FF, R2" A_NZ("R2")},
+    {"JMP", "B %"},
+    {"LDA", A_LD("R0")},
+    {"LDX", A_LD("R1")},
+    {"LDY", A_LD("R2")},
+    {"LSR", "^;c:MOVR Rv, R5;c:ANDI #1, R5;c:MVO R5, VAR_C;SLR Rv, 1;!;n:CLRR R5;n:MVO R5, VAR_N;z:MVO Rv, VAR_Z"},
+    {"NOP", "' NOP"},
+    {"ORA", A_ORA},
+    {"PHA", A_PUSH("R0")},
+    {"PHP", "MVI VAR_N, R3;ANDI #$80, R3;ADD VAR_C, R3;ADDI #$34, R3;MVI VAR_V, R5;TSTR R5;BEQ $ + 4;ADDI #$40, R3"
+            ";MVI VAR_Z, R5;TSTR R5;BNEQ $ + 4;ADDI #2, R3;" A_PUSH("R3")},
+    {"PLA", A_PULL("R0") A_NZ("R0")},
+    {"PLP", A_PULL("R3") ";n:MVO R3, VAR_N;v:MOVR R3, R5;v:ANDI #$40, R5;v:MVO R5, VAR_V"
+            ";z:MOVR R3, R5;z:ANDI #2, R5;z:XORI #2, R5;z:MVO R5, VAR_Z;c:ANDI #1, R3;c:MVO R3, VAR_C"},
+    {"ROL", A_ROL},
+    {"ROR", A_ROR},
+    {"RTI", "PULR R7"},
+    {"RTS", "PULR R7"},
+    {"SBC", "MVI* R3;XORI #$FF, R3" A_ADD},
+    {"SEC", "c:MVII #1, R5;c:MVO R5, VAR_C"},
+    {"SED", "' Entering decimal mode"},
+    {"SEI", "' SEI"},
+    {"STA", A_ST("R0")},
+    {"STX", A_ST("R1")},
+    {"STY", A_ST("R2")},
+    {"TAX", "MOVR R0, R1" A_NZ("R1")},
+    {"TAY", "MOVR R0, R2" A_NZ("R2")},
+    {"TSX", "MVI VAR_S, R1" A_NZ("R1")},
+    {"TXA", "MOVR R1, R0" A_NZ("R0")},
+    {"TXS", "MVO R1, VAR_S"},
+    {"TYA", "MOVR R2, R0" A_NZ("R0")},
+    {NULL, NULL},
+};
+
+/*
+ ** Get the destination of a branch, jump or call
+ */
+int destination(struct bank *bank, int address)
+{
+    int calc;
+    
+    switch (R(address)) {
+        case 0x00:  /* BRK uses the IRQ vector */
+            return ADDR(R(0x0ffe) | R(0x0fff) << 8);
+        case 0x20:  /* JSR abs */
+        case 0x4c:  /* JMP abs */
+        case 0x6c:  /* JMP (ind), only the pointer */
+            return ADDR(R(address + 1) | R(address + 2) << 8);
+    }
+    calc = R(address + 1);
+    if (calc >= 128)
+        calc -= 256;
+    return ADDR(address + 2 + calc);
+}
+
+/*
+ ** Label for an address inside a bank
+ */
+char *label(struct context *ctx, int number, int address)
+{
+    char *p;
+    
+    p = ctx->labels[ctx->next_label];
+    ctx->next_label = (ctx->next_label + 1) & 3;
+    address = (address & 0x0fff) | ctx->banks[number].origin;
+    if (ctx->total_banks == 1)
+        sprintf(p, "L%04X", address);
+    else
+        sprintf(p, "B%dL%04X", number, address);
+    return p;
+}
+
+/*
+ ** Bank selected by an instruction, -1 if it doesn't switch banks.
+ ** For Tigervision the value stored must come from an immediate load
+ ** just before.
+ */
+int switch_bank(struct bank *bank, int address)
+{
+    struct opcode *op;
+    int value;
+    
+    op = &opcodes[R(address)];
+    if (bank->ctx->scheme == T3F) {
+        if (op->mode != ZPG || R(address + 1) != 0x3f || strncmp(op->name, "ST", 2) != 0)
+            return -1;
+        if (bank->previous < 0 || opcodes[R(bank->previous)].mode != IMM
+        || strncmp(opcodes[R(bank->previous)].name, "LD", 2) != 0
+        || opcodes[R(bank->previous)].name[2] != op->name[2]) {
+            print(&bank->ctx->log, "Unknown bank switch at $%04X in bank %d\n", address, bank->number);
+            return -1;
+        }
+        return R(bank->previous + 1) % bank->ctx->total_banks;
+    }
+    if (bank->ctx->scheme == NONE || op->kind != OP || op->mode != ABS)
+        return -1;
+    value = R(address + 1) | R(address + 2) << 8;
+    if ((value & 0x1000) == 0 || (value & 0x0fff) < bank->ctx->hotspot
+    || (value & 0x0fff) >= bank->ctx->hotspot + bank->ctx->total_banks)
+        return -1;
+    return (value & 0x0fff) - bank->ctx->hotspot;
+}
+
+/*
+ ** Address where execution continues after a bank switch
+ */
+int continuation(struct bank *bank, int address)
+{
+    if (opcodes[R(address)].kind == CALL)
+        address = destination(bank, address);
+    return address + lengths[opcodes[R(address)].mode];
+}
+
+/*
+ ** Built-in register map. The Intellivision has nothing like the
+ ** TIA video, so those writes go away, the volume and frequency of
+ ** both sound channels go to the PSG channels A and B, the joystick
+ ** and the button come from the first controller (the second one
+ ** for the button of player 2) and the console switches from keys 1
+ ** (reset) and 2 (select). VSYNC and the RIOT timer stay as memory
+ ** for the timing, WSYNC goes away as the display kernels become a
+ ** WAIT.
+ */
+#define DROP(address, name) {H_WRITE, address, name, "", ""}
+
+static const struct hardware hardware_map[] = {
+    {H_WRITE, 0x00, "VSYNC", NULL, NULL},
+    DROP(0x01, "VBLANK"),
+    DROP(0x02, "WSYNC"),
+    DROP(0x03, "RSYNC"),
+    DROP(0x04, "NUSIZ0"),
+    DROP(0x05, "NUSIZ1"),
+    DROP(0x06, "COLUP0"),
+    DROP(0x07, "COLUP1"),
+    DROP(0x08, "COLUPF"),
+    DROP(0x09, "COLUBK"),
+    DROP(0x0a, "CTRLPF"),
+    DROP(0x0b, "REFP0"),
+    DROP(0x0c, "REFP1"),
+    DROP(0x0d, "PF0"),
+    DROP(0x0e, "PF1"),
+    DROP(0x0f, "PF2"),
+    DROP(0x10, "RESP0"),
+    DROP(0x11, "RESP1"),
+    DROP(0x12, "RESM0"),
+    DROP(0x13, "RESM1"),
+    DROP(0x14, "RESBL"),
+    DROP(0x15, "AUDC0"),
+    DROP(0x16, "AUDC1"),
+    {H_WRITE, 0x17, "AUDF0", "POKE $01F0, (@ AND 31) * 7 + 7;POKE $01F4, 0",
+        "MOVR @, R5;ANDI #31, R5;MOVR R5, R4;SLL R5, 2;ADDR R5, R5;SUBR R4, R5;ADDI #7, R5;MVO R5, $01F0;CLRR R5;MVO R5, $01F4"},
+    {H_WRITE, 0x18, "AUDF1", "POKE $01F1, (@ AND 31) * 7 + 7;POKE $01F5, 0",
+        "MOVR @, R5;ANDI #31, R5;MOVR R5, R4;SLL R5, 2;ADDR R5, R5;SUBR R4, R5;ADDI #7, R5;MVO R5, $01F1;CLRR R5;MVO R5, $01F5"},
+    {H_WRITE, 0x19, "AUDV0", "POKE $01FB, @ AND 15", "MOVR @, R5;ANDI #15, R5;MVO R5, $01FB"},
+    {H_WRITE, 0x1a, "AUDV1", "POKE $01FC, @ AND 15", "MOVR @, R5;ANDI #15, R5;MVO R5, $01FC"},
+    DROP(0x1b, "GRP0"),
+    DROP(0x1c, "GRP1"),
+    DROP(0x1d, "ENAM0"),
+    DROP(0x1e, "ENAM1"),
+    DROP(0x1f, "ENABL"),
+    DROP(0x20, "HMP0"),
+    DROP(0x21, "HMP1"),
+    DROP(0x22, "HMM0"),
+    DROP(0x23, "HMM1"),
+    DROP(0x24, "HMBL"),
+    DROP(0x25, "VDELP0"),
+    DROP(0x26, "VDELP1"),
+    DROP(0x27, "VDELBL"),
+    DROP(0x28, "RESMP0"),
+    DROP(0x29, "RESMP1"),
+    DROP(0x2a, "HMOVE"),
+    DROP(0x2b, "HMCLR"),
+    DROP(0x2c, "CXCLR"),
+    DROP(0x280, "SWCHA"),
+    DROP(0x281, "SWACNT"),
+    DROP(0x282, "SWCHB"),
+    DROP(0x283, "SWBCNT"),
+    {H_WRITE, 0x294, "TIM1T", NULL, NULL},
+    {H_WRITE, 0x295, "TIM8T", NULL, NULL},
+    {H_WRITE, 0x296, "TIM64T", NULL, NULL},
+    {H_WRITE, 0x297, "T1024T", NULL, NULL},
+    {H_READ, 0x0c, "INPT4", "((CONT1.BUTTON = 0) AND $80)", NULL},
+    {H_READ, 0x0d, "INPT5", "((CONT2.BUTTON = 0) AND $80)", NULL},
+    {H_READ, 0x280, "SWCHA", "($FF XOR ((CONT1.RIGHT <> 0) AND $80) XOR ((CONT1.LEFT <> 0) AND $40)"
+        " XOR ((CONT1.DOWN <> 0) AND $20) XOR ((CONT1.UP <> 0) AND $10))", NULL},
+    {H_READ, 0x282, "SWCHB", "($FF XOR ((CONT1.KEY = 1) AND 1) XOR ((CONT1.KEY = 2) AND 2))", NULL},
+    {H_READ, 0x284, "INTIM", NULL, NULL},
+};
+
+/*
+ ** Register of the TIA or the RIOT at an address, -1 for RAM and
+ ** ROM. The TIA decodes 6 address lines for writes and 4 for reads.
+ */
+int hardware_register(int value, int access)
+{
+    if (value & 0x1000)                     /* ROM */
+        return -1;
+    if ((value & 0x0280) == 0x0280)         /* RIOT */
+        return 0x40 + (value & 0x1f);
+    if ((value & 0x0280) == 0x0080)         /* RAM */
+        return -1;
+    return value & (access == H_WRITE ? 0x3f : 0x0f);
+}
+
+/*
+ ** Fill the register map with the built-in one and then the lines
+ ** of the text given (can be NULL), each one is:
+ **
+ **     W|R address name keep|drop|basic template|native template
+ **
+ ** Wrong lines are reported and ignored. Returns -1 without memory.
+ */
+int register_map(struct context *ctx, const char *text)
+{
+    struct hardware *h;
+    const struct hardware *d;
+    char *word[5];
+    char *digits;
+    char *p;
+    char *next;
+    int number;
+    int access;
+    int value;
+    int c;
+    
+    for (d = hardware_map; d < hardware_map + sizeof(hardware_map) / sizeof(*d); d++)
+        ctx->registers[d->access][hardware_register(d->address, d->access)] = *d;
+    if (text == NULL)
+        return 0;
+    ctx->map = strdup(text);
+    if (ctx->map == NULL)
+        return -1;
+    number = 0;
+    for (p = ctx->map; p != NULL; p = next) {
+        number++;
+        next = strchr(p, '\n');
+        if (next != NULL)
+            *next++ = '\0';
+        for (c = 0; c < 5; c++) {   /* The template is the rest of the line */
+            while (isspace(*p))
+                p++;
+            word[c] = p;
+            if (c < 4) {
+                while (*p && !isspace(*p))
+                    p++;
+                if (*p)
+                    *p++ = '\0';
+            }
+        }
+        p += strlen(p);
+        while (p > word[4] && isspace(p[-1]))
+            p--;
+        *p = '\0';
+        if (word[0][0] == '\0' || word[0][0] == '#')
+            continue;
+        access = strcmp(word[0], "W") == 0 ? H_WRITE : strcmp(word[0], "R") == 0 ? H_READ : -1;
+        digits = word[1] + (word[1][0] == '$');
+        value = strtol(digits, &p, word[1][0] == '$' ? 16 : 10);
+        if (access < 0 || p == digits || *p != '\0' || word[2][0] == '\0') {
+            print(&ctx->log, "Register map line %d: expected W or R, address and name\n", number);
+            continue;
+        }
+        if ((c = hardware_register(value, access)) < 0) {
+            print(&ctx->log, "Register map line %d: $%04X isn't a TIA or RIOT register\n", number, value);
+            continue;
+        }
+        h = &ctx->registers[access][c];
+        if (strcmp(word[3], "keep") == 0 && word[4][0] == '\0') {
+            h->basic = NULL;
+            h->native = NULL;
+        } else if (strcmp(word[3], "drop") == 0 && word[4][0] == '\0' && access == H_WRITE) {
+            h->basic = "";
+            h->native = "";
+        } else if (strcmp(word[3], "basic") == 0 && word[4][0] != '\0'
+                   && (access == H_WRITE || strlen(word[4]) < sizeof(ctx->operand))) {
+            h->basic = word[4];
+        } else if (strcmp(word[3], "native") == 0 && word[4][0] != '\0' && access == H_WRITE) {
+            h->native = word[4];
+        } else {
+            print(&ctx->log, "Register map line %d: wrong action for %s\n", number, word[2]);
+            continue;
+        }
+        h->access = access;
+        h->address = value;
+        h->name = word[2];
+    }
+    return 0;
+}
+
+/*
+ ** Template of the register map for the access of an instruction to
+ ** the TIA or the RIOT, NULL if it stays as memory. Only the drops
+ ** are checked by the verifier, and C keeps everything.
+ */
+const char *mapped(struct bank *bank, int address, int access)
+{
+    struct hardware *h;
+    struct opcode *op;
+    int value;
+    int c;
+    
+    op = &opcodes[R(address)];
+    if ((op->mode != ZPG && op->mode != ABS) || op->kind != OP
+    || (access == H_WRITE) != (strncmp(op->name, "ST", 2) == 0)
+    || (access == H_READ && (op->writes & LM)))
+        return NULL;
+    value = op->mode == ZPG ? R(address + 1) : R(address + 1) | R(address + 2) << 8;
+    if ((c = hardware_register(value, access)) < 0)
+        return NULL;
+    h = &bank->ctx->registers[access][c];
+    switch (bank->ctx->target) {
+        case C6502_BASIC:
+            return h->basic;
+        case C6502_CP1610:
+            return access == H_WRITE ? h->native : NULL;
+        case C6502_VERIFY:
+            return access == H_WRITE && h->basic != NULL && h->basic[0] == '\0' ? "" : NULL;
+    }
+    return NULL;
+}
+
+/*
+ ** Registers read by an instruction that don't matter, the one stored
+ ** by a write that the register map drops or that doesn't use @
+ */
+int ignored(struct bank *bank, int address)
+{
+    const char *map;
+    
+    map = mapped(bank, address, H_WRITE);
+    if (map == NULL || strchr(map, '@') != NULL)
+        return 0;
+    return VAR(opcodes[R(address)].reads);
+}
+
+/*
+ ** Label for data in the ROM, the one of the first copy written
+ */
+char *data_label(struct bank *bank, int address)
+{
+    int copy;
+    
+    copy = bank->alias[address & 0x0fff];
+    if (copy < 0)
+        return label(bank->ctx, bank->number, address);
+    return label(bank->ctx, copy >> 12, copy & 0x0fff);
+}
+
+/*
+ ** Build the IntyBASIC expression for a memory address
+ */
+void memory(struct bank *bank, char *buf, int value, const char *index)
+{
+    if (value & 0x1000)             /* ROM */
+        sprintf(buf, "%s(%s)", data_label(bank, value), index);
+    else if ((value & 0x0280) == 0x0280)    /* RIOT */
+        sprintf(buf, "L%04X(%s)", value, index);
+    else if (index[0] != '0')       /* TIA and RAM, plus mirrors */
+        sprintf(buf, "zp($%02X + %s)", value & 0xff, index);
+    else if ((value & 0x80) && bank->ctx->scalar[value & 0x7f])
+        sprintf(buf, "zp%02X", value & 0xff);
+    else
+        sprintf(buf, "zp($%02X)", value & 0xff);
+}
+
+/*
+ ** Targets of a zero page pointer, NULL if unknown
+ */
+struct pointer *pointer_of(struct context *ctx, int pointer)
+{
+    if ((pointer & 0x80) == 0 || pointer == 0xff || ctx->pointers[pointer & 0x7f].kind == P_UNKNOWN)
+        return NULL;
+    return &ctx->pointers[pointer & 0x7f];
+}
+
+/*
+ ** Build the IntyBASIC expression for the byte a (zp),Y reaches. The
+ ** ROM tables are indexed directly, selected by the pointer when it
+ ** has more than one, and the unknown targets take the full address.
+ */
+void pointed(struct bank *bank, char *buf, int pointer, int write)
+{
+    struct pointer *p;
+    char low[16];
+    char high[16];
+    char index[32];
+    char table[48];
+    int same_low;
+    int same_high;
+    int c;
+    
+    memory(bank, low, pointer, "0");
+    memory(bank, high, (pointer + 1) & 0xff, "0");
+    p = pointer_of(bank->ctx, pointer);
+    if (p != NULL && p->kind == P_RAM) {
+        sprintf(buf, "zp(%s + y)", low);
+    } else if (p == NULL || write) {    /* Writes into the ROM only touch hotspots */
+        sprintf(buf, "mem(%s + %s * 256 + y)", low, high);
+    } else if (p->total == 1) {
+        sprintf(index, "%s + y", low);
+        memory(bank, buf, p->targets[0], p->kind == P_PAGES ? index : "y");
+    } else {
+        same_low = 1;
+        same_high = 1;
+        for (c = 1; c < p->total; c++) {
+            same_low &= (p->targets[c] & 0xff) == (p->targets[0] & 0xff);
+            same_high &= (p->targets[c] >> 8) == (p->targets[0] >> 8);
+        }
+        sprintf(index, "%s + y", low);
+        strcpy(buf, "(");
+        for (c = 0; c < p->total; c++) {
+            memory(bank, table, p->targets[c], p->kind == P_PAGES ? index : "y");
+            if (p->kind == P_PAGES || same_low)
+                sprintf(buf + strlen(buf), "%s%s = $%02X AND %s", c > 0 ? " OR " : "", high, p->targets[c] >> 8, table);
+            else if (same_high)
+                sprintf(buf + strlen(buf), "%s%s = $%02X AND %s", c > 0 ? " OR " : "", low, p->targets[c] & 0xff, table);
+            else
+                sprintf(buf + strlen(buf), "%s%s + %s * 256 = $%04X AND %s", c > 0 ? " OR " : "", low, high, p->targets[c], table);
+        }
+        strcat(buf, ")");
+    }
+}
+
+/*
+ ** Build the IntyBASIC expression for the operand of an instruction
+ */
+char *operand(struct bank *bank, int address)
+{
+    const char *map;
+    char *buf;
+    struct opcode *op;
+    int value;
+    
+    buf = bank->ctx->operand;
+    op = &opcodes[R(address)];
+    value = R(address + 1) | R(address + 2) << 8;
+    switch (op->mode) {
+        case ACC:
+            return "a";
+        case IMM:
+            if (op->kind == CALL)
+                strcpy(buf, label(bank->ctx, bank->number, destination(bank, address)));
+            else
+                sprintf(buf, "$%02X", value & 0xff);
+            break;
+        case ZPG:
+            if ((map = mapped(bank, address, H_READ)) != NULL)
+                strcpy(buf, map);
+            else
+                memory(bank, buf, value & 0xff, "0");
+            break;
+        case ZPX:
+            sprintf(buf, "zp($%02X + x)", value & 0xff);
+            break;
+        case ZPY:
+            sprintf(buf, "zp($%02X + y)", value & 0xff);
+            break;
+        case IZX:
+            if (bank->ctx->target == C6502_C)   /* Full address */
+                sprintf(buf, "mem(zp(($%02X + x) AND $FF) + zp(($%02X + x) AND $FF) * 256)", value & 0xff, (value + 1) & 0xff);
+            else
+                sprintf(buf, "zp(zp($%02X + x))", value & 0xff);
+            break;
+        case IZY:
+            if (bank->ctx->target == C6502_C)
+                sprintf(buf, "mem(zp($%02X) + zp($%02X) * 256 + y)", value & 0xff, (value + 1) & 0xff);
+            else
+                pointed(bank, buf, value & 0xff, (op->writes & LM) != 0);
+            break;
+        case REL:
+            strcpy(buf, label(bank->ctx, bank->number, destination(bank, address)));
+            break;
+        case ABS:
+            if (bank->switched[address & 0x0fff] >= 0)    /* Call into another bank */
+                strcpy(buf, label(bank->ctx, bank->switched[address & 0x0fff], continuation(bank, address)));
+            else if (bank->switched[address & 0x0fff] == SAME_BANK)    /* The ROM byte */
+                sprintf(buf, "$%02X", R(value));
+            else if (op->kind == JUMP || op->kind == CALL)
+                strcpy(buf, label(bank->ctx, bank->number, destination(bank, address)));
+            else if ((map = mapped(bank, address, H_READ)) != NULL)
+                strcpy(buf, map);
+            else
+                memory(bank, buf, value, "0");
+            break;
+        case ABX:
+            memory(bank, buf, value, "x");
+            break;
+        case ABY:
+            memory(bank, buf, value, "y");
+            break;
+        case IND:
+            sprintf(buf, "$%04X", value);
+            break;
+        default:
+            buf[0] = '\0';
+            break;
+    }
+    return buf;
+}
+
+/*
+ ** Split a template into statements
+ */
+int split(const char *code, const char **stmt, int *len)
+{
+    int total;
+    
+    total = 0;
+    while (*code) {
+        stmt[total] = code;
+        while (*code && *code != ';')
+            code++;
+        len[total] = code - stmt[total];
+        total++;
+        if (*code == ';')
+            code++;
+    }
+    return total;
+}
+
+/*
+ ** Flag assigned by a statement, zero if none
+ */
+int flag_of(const char *stmt)
+{
+    if (stmt[1] != ' ' || stmt[2] != '=' || stmt[3] != ' ')
+        return 0;
+    switch (stmt[0]) {
+        case 'n': return FN;
+        case 'z': return FZ;
+        case 'c': return FC;
+        case 'v': return FV;
+    }
+    return 0;
+}
+
+/*
+ ** Locations read by a piece of template
+ */
+int locations(struct opcode *op, const char *p, int len)
+{
+    const char *end;
+    const char *s;
+    int found;
+    
+    end = p + len;
+    found = 0;
+    while (p < end) {
+        if (*p == '@') {
+            found |= mode_locations[op->mode];
+            p++;
+        } else if (*p == '$') {
+            p++;
+            while (p < end && isxdigit(*p))
+                p++;
+        } else if (*p == '#' || islower(*p)) {
+            s = p++;
+            while (p < end && isalnum(*p))
+                p++;
+            if (p - s == 1) {
+                switch (*s) {
+                    case 'a': found |= LA; break;
+                    case 'x': found |= LX; break;
+                    case 'y': found |= LY; break;
+                    case 's': found |= LS; break;
+                }
+            } else if (p - s == 2 && memcmp(s, "#t", 2) == 0) {
+                found |= LT;
+            } else if (p - s == 2 && memcmp(s, "zp", 2) == 0) {
+                found |= LM;
+            }
+        } else if (isalpha(*p)) {
+            while (p < end && isalnum(*p))
+                p++;
+        } else {
+            p++;
+        }
+    }
+    return found;
+}
+
+/*
+ ** Locations assigned by a statement (flags aren't included)
+ */
+int assigned(struct opcode *op, const char *stmt, int len)
+{
+    int c;
+    
+    if (flag_of(stmt) != 0 || stmt[0] == '\'' || isupper(stmt[0]))
+        return 0;
+    for (c = 0; c + 2 < len; c++) {
+        if (stmt[c] == ' ' && stmt[c + 1] == '=' && stmt[c + 2] == ' ')
+            break;
+    }
+    if (c + 2 >= len)
+        return 0;
+    if (stmt[0] == '@')
+        return op->mode == ACC ? LA : LM;
+    if (memcmp(stmt, "zp(", 3) == 0)
+        return LM;
+    return locations(op, stmt, c);
+}
 
-#define R(addr) rom[(addr) & 0x0fff]
-#define C(addr) checked[(addr) & 0x0fff]
+/*
+ ** Locations read by a statement
+ */
+int used(struct opcode *op, const char *stmt, int len)
+{
+    int c;
+    
+    if (stmt[0] == '\'')
+        return 0;
+    if (flag_of(stmt) != 0)
+        return locations(op, stmt + 4, len - 4);
+    if (isupper(stmt[0]))
+        return locations(op, stmt, len);
+    for (c = 0; c + 2 < len; c++) {
+        if (stmt[c] == ' ' && stmt[c + 1] == '=' && stmt[c + 2] == ' ')
+            break;
+    }
+    return (locations(op, stmt, c) & ~assigned(op, stmt, len)) | locations(op, stmt + c + 3, len - c - 3);
+}
+
+/*
+ ** Prepare the opcode table
+ */
+void prepare(void)
+{
+    const char *stmt[MAX_STMT];
+    int len[MAX_STMT];
+    struct opcode *op;
+    int total;
+    int c;
+    
+    for (op = opcodes; op < opcodes + 256; op++) {
+        if (op->code == NULL)
+            continue;
+        for (c = 0; cp1610[c].name != NULL; c++) {
+            if (strcmp(cp1610[c].name, op->name) == 0)
+                op->native = cp1610[c].code;
+        }
+        total = split(op->code, stmt, len);
+        for (c = 0; c < total; c++) {
+            op->reads |= used(op, stmt[c], len[c]) & ~op->writes;
+            op->writes |= assigned(op, stmt[c], len[c]);
+        }
+    }
+}
+
+/*
+ ** Register compared by CMP, CPX or CPY, zero for other instructions
+ */
+int compare(struct opcode *op)
+{
+    if (strcmp(op->name, "CMP") == 0)
+        return 'a';
+    if (strcmp(op->name, "CPX") == 0)
+        return 'x';
+    if (strcmp(op->name, "CPY") == 0)
+        return 'y';
+    return 0;
+}
+
+/*
+ ** Expression assigned to a flag by the template of an instruction.
+ ** NULL if there is none, or if it uses #t or a location changed
+ ** later by the same instruction.
+ */
+const char *flag_expression(struct opcode *op, int flag, int *length, int *reads)
+{
+    const char *stmt[MAX_STMT];
+    int len[MAX_STMT];
+    int total;
+    int c;
+    int d;
+    
+    total = split(op->code, stmt, len);
+    for (c = 0; c < total; c++) {
+        if (flag_of(stmt[c]) == flag)
+            break;
+    }
+    if (c == total)
+        return NULL;
+    *length = len[c] - 4;
+    *reads = locations(op, stmt[c] + 4, len[c] - 4);
+    if (*reads & LT)
+        return NULL;
+    for (d = c + 1; d < total; d++) {
+        if (assigned(op, stmt[d], len[d]) & *reads)
+            return NULL;
+    }
+    return stmt[c] + 4;
+}
+
+/*
+ ** Find the branches that can test directly the expression that set
+ ** their flag inside the same block. The expression stays valid while
+ ** nothing it reads is written.
+ */
+void fuse(struct bank *bank)
+{
+    int setter[4];
+    int reads[4];
+    struct opcode *op;
+    int address;
+    int length;
+    int flag;
+    int c;
+    int f;
+    
+    for (c = 0; c < 4096; c++)
+        bank->fused[c] = -1;
+    for (c = 0; c < bank->total_blocks; c++) {
+        for (f = 0; f < 4; f++)
+            setter[f] = -1;
+        for (address = bank->blocks[c].start; address < bank->blocks[c].end; address += lengths[op->mode]) {
+            op = &opcodes[R(address)];
+            if (op->kind == BRANCH) {
+                for (f = 0; (1 << f) != op->uses; f++) ;
+                bank->fused[address & 0x0fff] = setter[f];
+                continue;
+            }
+            for (f = 0; f < 4; f++) {
+                if (setter[f] >= 0 && (reads[f] & op->writes) != 0)
+                    setter[f] = -1;
+            }
+            for (f = 0; f < 4; f++) {
+                flag = 1 << f;
+                if ((op->defs & flag) == 0)
+                    continue;
+                setter[f] = -1;
+                if (compare(op) != 0) {
+                    if (flag == FZ || flag == FC) {
+                        setter[f] = address;
+                        reads[f] = mode_locations[op->mode] | (compare(op) == 'a' ? LA : compare(op) == 'x' ? LX : LY);
+                    }
+                } else if (flag_expression(op, flag, &length, &reads[f]) != NULL) {
+                    setter[f] = address;
+                }
+            }
+        }
+    }
+}
+
+/*
+ ** Variable named by a piece of text, zero if it isn't one of the
+ ** variables followed by the optimizer (s and arrays aren't).
+ */
+int variable(const char *p, int len)
+{
+    if (len == 2 && memcmp(p, "#t", 2) == 0)
+        return VT;
+    if (len != 1)
+        return 0;
+    switch (*p) {
+        case 'a': return VA;
+        case 'x': return VX;
+        case 'y': return VY;
+        case 'n': return FN;
+        case 'z': return FZ;
+        case 'c': return FC;
+        case 'v': return FV;
+    }
+    return 0;
+}
+
+/*
+ ** Name of a variable
+ */
+const char *variable_name(int var)
+{
+    switch (var) {
+        case VA: return "a";
+        case VX: return "x";
+        case VY: return "y";
+        case VT: return "#t";
+        case FN: return "n";
+        case FZ: return "z";
+        case FC: return "c";
+        case FV: return "v";
+    }
+    return "";
+}
+
+/*
+ ** Slot of a variable for the known values
+ */
+int slot(int var)
+{
+    int c;
+    
+    for (c = 0; (1 << c) != var; c++) ;
+    return c;
+}
+
+/*
+ ** Variables read by a piece of statement
+ */
+int variables_read(const char *p, int len)
+{
+    const char *end;
+    const char *s;
+    int found;
+    
+    end = p + len;
+    found = 0;
+    while (p < end) {
+        if (*p == '$') {
+            p++;
+            while (p < end && isxdigit(*p))
+                p++;
+        } else if (*p == '#' || isalnum(*p)) {
+            s = p++;
+            while (p < end && isalnum(*p))
+                p++;
+            if (p == end || *p != '(')
+                found |= variable(s, p - s);
+        } else {
+            p++;
+        }
+    }
+    return found;
+}
+
+/*
+ ** Position of the = of an assignment, -1 for other statements
+ */
+int assignment(const char *text)
+{
+    const char *p;
+    int depth;
+    
+    if (text[0] == '\'' || memcmp(text, "IF ", 3) == 0 || memcmp(text, "GOTO ", 5) == 0
+    || memcmp(text, "GOSUB ", 6) == 0 || strcmp(text, "RETURN") == 0)
+        return -1;
+    depth = 0;
+    for (p = text; *p; p++) {
+        if (*p == '(')
+            depth++;
+        else if (*p == ')')
+            depth--;
+        else if (depth == 0 && p[0] == ' ' && p[1] == '=' && p[2] == ' ')
+            return p - text + 1;
+    }
+    return -1;
+}
+
+/*
+ ** Add a statement to the block being lowered
+ */
+void add_stmt(struct context *ctx, const char *text)
+{
+    struct stmt *stmts;
+    int c;
+    
+    if (ctx->total_stmts == ctx->size_stmts) {
+        stmts = realloc(ctx->stmts, (ctx->size_stmts + 1024) * sizeof(struct stmt));
+        if (stmts == NULL) {
+            ctx->pool.failed = 1;
+            return;
+        }
+        ctx->stmts = stmts;
+        ctx->size_stmts += 1024;
+    }
+    c = assignment(text);
+    ctx->stmts[ctx->total_stmts].text = ctx->pool.length;
+    ctx->stmts[ctx->total_stmts].target = c > 0 ? variable(text, c - 1) : 0;
+    ctx->stmts[ctx->total_stmts].keep = 1;
+    ctx->total_stmts++;
+    print(&ctx->pool, "%s", text);
+    put(&ctx->pool, '\0');
+}
+
+/*
+ ** Condition for a branch testing the expression that set its flag
+ */
+void branch_condition(struct bank *bank, int address, char *cond)
+{
+    struct opcode *op;
+    struct opcode *sop;
+    const char *e;
+    char expr[256];
+    int setter;
+    int taken;
+    int length;
+    int reads;
+    int c;
+    
+    op = &opcodes[R(address)];
+    setter = bank->fused[address & 0x0fff];
+    sop = &opcodes[R(setter)];
+    taken = R(address) & 0x20;  /* Bit 5 is the value tested */
+    if (compare(sop) != 0) {
+        sprintf(cond, "%c %s %s", compare(sop),
+                op->uses == FZ ? (taken ? "=" : "<>") : (taken ? ">=" : "<"), operand(bank, setter));
+        return;
+    }
+    e = flag_expression(sop, op->uses, &length, &reads);
+    c = 0;
+    while (length-- > 0) {
+        if (*e == '@') {
+            strcpy(expr + c, operand(bank, setter));
+            c += strlen(expr + c);
+        } else {
+            expr[c++] = *e;
+        }
+        e++;
+    }
+    expr[c] = '\0';
+    if (op->uses == FZ && c > 4 && strcmp(expr + c - 4, " = 0") == 0) {
+        if (!taken)
+            expr[c - 4] = '\0';
+        strcpy(cond, expr);
+    } else if (op->uses == FN && c > 8 && strcmp(expr + c - 8, " AND $80") == 0) {
+        expr[c - 8] = '\0';
+        sprintf(cond, "%s %s $80", expr, taken ? ">=" : "<");
+    } else if (taken) {
+        strcpy(cond, expr);
+    } else {
+        sprintf(cond, "(%s) = 0", expr);
+    }
+}
+
+/*
+ ** ADC or SBC, the instructions changed by the decimal mode
+ */
+int arithmetic(int opcode)
+{
+    return (opcode & 0xe3) == 0x61 || (opcode & 0xe3) == 0xe1;
+}
+
+/*
+ ** Lower a write to the TIA or the RIOT with the template of the
+ ** register map, @ is the register stored
+ */
+void hardware_write(struct bank *bank, int address, const char *map)
+{
+    static const char *names[2][3] = {{"a", "x", "y"}, {"R0", "R1", "R2"}};
+    const char *value;
+    char line[256];
+    char *q;
+    
+    value = names[bank->ctx->target == C6502_CP1610][strchr("AXY", opcodes[R(address)].name[2]) - "AXY"];
+    while (*map) {
+        q = line;
+        for (; *map && *map != ';'; map++) {
+            if (q >= line + sizeof(line) - 4)
+                continue;
+            if (*map == '@') {
+                strcpy(q, value);
+                q += strlen(q);
+            } else {
+                *q++ = *map;
+            }
+        }
+        if (*map)
+            map++;
+        *q = '\0';
+        if (line[0])
+            add_stmt(bank->ctx, line);
+    }
+}
+
+/*
+ ** Write a 16-bit chain as a single operation over #t, the low byte
+ ** and the high byte keep their places. The ADC or SBC chain leaves
+ ** the high byte in A and its flags N and Z.
+ */
+void lower_wide(struct bank *bank, int address)
+{
+    char text[4][2][40];
+    char addend[96];
+    char line[256];
+    int total[4];
+    int live;
+    int last;
+    int sign;
+    int at;
+    int c;
+    
+    memset(total, 0, sizeof(total));
+    sign = '+';
+    last = address;
+    for (at = address; at == address || bank->wide[at & 0x0fff] == W_INSIDE || bank->wide[at & 0x0fff] == W_CARRY;
+         at += lengths[opcodes[R(at)].mode]) {
+        switch (R(at)) {
+            case 0x38: sign = '-'; c = -1; break;   /* SEC */
+            case 0xa5: case 0xad: c = 0; break;     /* LDA */
+            case 0x65: case 0x6d: case 0x69:        /* ADC */
+            case 0xe5: case 0xed: case 0xe9: c = 1; break;  /* SBC */
+            case 0x85: case 0x8d: c = 2; break;     /* STA */
+            case 0xe6: case 0xee: c = 3; break;     /* INC */
+            default: c = -1; break;
+        }
+        if (c >= 0 && total[c] < 2)
+            strcpy(text[c][total[c]++], operand(bank, at));
+        last = at;
+    }
+    if (bank->wide[address & 0x0fff] == W_INC) {
+        sprintf(line, "#t = %s + %s * 256 + 1", text[3][0], text[3][1]);
+        add_stmt(bank->ctx, line);
+        sprintf(line, "%s = #t", text[3][0]);
+        add_stmt(bank->ctx, line);
+        sprintf(line, "%s = #t / 256", text[3][1]);
+        add_stmt(bank->ctx, line);
+        return;
+    }
+    if (text[1][0][0] == '$')
+        sprintf(addend, "$%02lX%02lX", strtol(text[1][1] + 1, NULL, 16), strtol(text[1][0] + 1, NULL, 16));
+    else
+        sprintf(addend, "(%s + %s * 256)", text[1][0], text[1][1]);
+    sprintf(line, "#t = %s + %s * 256 %c %s", text[0][0], text[0][1], sign, addend);
+    add_stmt(bank->ctx, line);
+    sprintf(line, "%s = #t", text[2][0]);
+    add_stmt(bank->ctx, line);
+    sprintf(line, "%s = #t / 256", text[2][1]);
+    add_stmt(bank->ctx, line);
+    add_stmt(bank->ctx, "a = #t / 256");
+    live = bank->live[last & 0x0fff];
+    if (live & FN)
+        add_stmt(bank->ctx, "n = a AND $80");
+    if (live & FZ)
+        add_stmt(bank->ctx, "z = a = 0");
+}
+
+/*
+ ** Write a run of shifts as a multiply or divide by a power of two,
+ ** or ASL, STA t, ASL, CLC, ADC t as a multiply by a constant. Only
+ ** the flags of the last instruction are written.
+ */
+void lower_shift(struct bank *bank, int address)
+{
+    char text[40];
+    char line[256];
+    int count[2];
+    int stored;
+    int store;
+    int live;
+    int last;
+    int at;
+    
+    count[0] = count[1] = 0;
+    stored = 0;
+    store = address;
+    last = address;
+    for (at = address; at == address || bank->wide[at & 0x0fff] == W_INSIDE; at += lengths[opcodes[R(at)].mode]) {
+        if (R(at) == R(address)) {
+            count[stored]++;
+        } else if (R(at) == 0x85 || R(at) == 0x8d) {
+            stored = 1;
+            store = at;
+        }
+        last = at;
+    }
+    strcpy(text, operand(bank, address));
+    live = bank->live[last & 0x0fff];
+    if (bank->wide[address & 0x0fff] == W_SCALE) {
+        sprintf(line, "%s = a * %d", operand(bank, store), 1 << count[0]);
+        add_stmt(bank->ctx, line);
+        sprintf(line, "a = a * %d", (1 << count[0]) + (1 << (count[0] + count[1])));
+        add_stmt(bank->ctx, line);
+    } else if (R(address) & 0x40) {     /* LSR */
+        if (live & FC) {
+            sprintf(line, "c = %s / %d AND 1", text, 1 << (count[0] - 1));
+            add_stmt(bank->ctx, line);
+        }
+        sprintf(line, "%s = %s / %d", text, text, 1 << count[0]);
+        add_stmt(bank->ctx, line);
+    } else {
+        if (live & FC) {
+            sprintf(line, "c = %s / %d AND 1", text, 256 >> count[0]);
+            add_stmt(bank->ctx, line);
+        }
+        sprintf(line, "%s = %s * %d", text, text, 1 << count[0]);
+        add_stmt(bank->ctx, line);
+    }
+    if (bank->wide[address & 0x0fff] == W_SCALE)
+        strcpy(text, "a");
+    if (live & FN) {
+        if (bank->wide[address & 0x0fff] == W_SHIFT && (R(address) & 0x40))
+            strcpy(line, "n = 0");
+        else
+            sprintf(line, "n = %s AND $80", text);
+        add_stmt(bank->ctx, line);
+    }
+    if (live & FZ) {
+        sprintf(line, "z = %s = 0", text);
+        add_stmt(bank->ctx, line);
+    }
+}
+
+/*
+ ** IntyBASIC expression for a place seen by the interpreter
+ */
+void place(struct bank *bank, char *buf, int where)
+{
+    if (where >= PROBE_A)
+        strcpy(buf, where == PROBE_A ? "a" : where == PROBE_X ? "x" : "y");
+    else
+        memory(bank, buf, 0x80 | where, "0");
+}
+
+/*
+ ** Write a JSR to a multiply or divide subroutine as the operation,
+ ** both results of a divide go together in #t
+ */
+void lower_native(struct bank *bank, int address)
+{
+    struct native *n;
+    char operands[2][40];
+    char buf[40];
+    char line[256];
+    int c;
+    
+    n = &bank->ctx->natives[bank->blocks[bank->block_at[destination(bank, address) & 0x0fff]].native - 1];
+    place(bank, operands[0], n->inputs[0]);
+    place(bank, operands[1], n->inputs[1]);
+    if (n->operation == '*')
+        sprintf(line, "#t = %s * %s", operands[0], operands[1]);
+    else
+        sprintf(line, "#t = %s / %s * 256 + %s %% %s", operands[0], operands[1], operands[0], operands[1]);
+    add_stmt(bank->ctx, line);
+    for (c = 0; c < n->total; c++) {
+        place(bank, buf, n->places[c]);
+        if (n->values[c] == PROBE_LOW)
+            sprintf(line, "%s = #t", buf);
+        else if (n->values[c] == PROBE_HIGH)
+            sprintf(line, "%s = #t / 256", buf);
+        else if (n->values[c] >= PROBE_COPY)
+            sprintf(line, "%s = %s", buf, operands[n->values[c] - PROBE_COPY]);
+        else
+            sprintf(line, "%s = %d", buf, n->values[c]);
+        add_stmt(bank->ctx, line);
+    }
+}
+
+/*
+ ** Address of an entry of a jump table
+ */
+int jump_entry(struct bank *bank, struct table *t, int entry)
+{
+    return ((R(t->low + (entry << t->shift)) | R(t->high + (entry << t->shift)) << 8) + t->offset) & 0xffff;
+}
+
+/*
+ ** Recognize the dispatch through a jump table ending at an address,
+ ** LDA hi,X / PHA / LDA lo,X / PHA / RTS or LDA lo,X / STA ptr /
+ ** LDA hi,X / STA ptr+1 / JMP (ptr), and the same with Y. The entries
+ ** are known when AND #mask, ASL and TAX bound the index just before,
+ ** otherwise t->total is 0.
+ */
+int jump_table(struct bank *bank, int address, struct table *t)
+{
+    int loads[2];
+    int first;
+    int mask;
+    int at;
+    int c;
+    
+    if (R(address) == 0x60) {
+        if (R(address - 1) != 0x48 || R(address - 5) != 0x48)
+            return 0;
+        loads[0] = address - 4;
+        loads[1] = address - 8;
+        t->offset = 1;
+        first = address - 8;
+    } else if (R(address) == 0x6c) {
+        c = R(address + 1);
+        if (R(address + 2) != 0 || (c & 0x80) == 0 || c == 0xff
+        || R(address - 2) != 0x85 || R(address - 7) != 0x85
+        || (R(address - 1) != c && R(address - 1) != c + 1) || R(address - 6) != (R(address - 1) ^ c ^ (c + 1)))
+            return 0;
+        loads[0] = R(address - 1) == c ? address - 5 : address - 10;
+        loads[1] = R(address - 1) == c ? address - 10 : address - 5;
+        t->offset = 0;
+        first = address - 10;
+    } else {
+        return 0;
+    }
+    if ((R(loads[0]) != 0xbd && R(loads[0]) != 0xb9) || R(loads[1]) != R(loads[0]))
+        return 0;
+    for (at = first; at <= address; at += lengths[opcodes[R(at)].mode]) {
+        if ((C(at) & 3) == 0 || (at > first && (C(at) & BLOCK)))
+            return 0;
+    }
+    t->index = R(loads[0]) == 0xbd ? RX : RY;
+    t->low = R(loads[0] + 1) | R(loads[0] + 2) << 8;
+    t->high = R(loads[1] + 1) | R(loads[1] + 2) << 8;
+    t->shift = 0;
+    t->total = 0;
+    
+    /* Index bounded by AND #mask, ASL and TAX (or TAY), the instructions
+       between TAX and the loads must leave the index alone */
+    at = first;
+    for (c = 0; c < 4 && R(at) != (t->index == RX ? 0xaa : 0xa8); c++) {
+        if ((C(at) & BLOCK) || (at != first && (opcodes[R(at)].kind != OP
+        || (VAR(opcodes[R(at)].writes) & (t->index == RX ? VX : VY)))))
+            return 1;
+        for (mask = 1; mask <= 3 && ((C(at - mask) & 3) == 0 || lengths[opcodes[R(at - mask)].mode] != mask); mask++)
+            ;
+        if (mask > 3)
+            return 1;
+        at -= mask;
+    }
+    if (R(at) != (t->index == RX ? 0xaa : 0xa8))
+        return 1;
+    for (c = 0; c < 7 && R(at - 1) == 0x0a && (C(at - 1) & 3) != 0 && (C(at) & BLOCK) == 0; c++)
+        at--;
+    mask = R(at - 1);
+    if (R(at - 2) != 0x29 || (C(at - 2) & 3) == 0 || (C(at) & BLOCK) || (mask & (mask + 1)) != 0
+    || mask >= JUMP_ENTRIES || (mask << c) > 0xff)
+        return 1;
+    t->shift = c;
+    t->total = mask + 1;
+    for (c = 0; c < t->total; c++) {
+        if ((jump_entry(bank, t, c) & 0x1000) == 0)     /* Not in the ROM */
+            t->total = 0;
+    }
+    return 1;
+}
+
+/*
+ ** Recognize a JMP (ind), or an RTS or RTI used as a jump, the entries
+ ** of its table are left in t->total (0 if they aren't known)
+ */
+int dispatch(struct bank *bank, int address, struct table *t)
+{
+    if (jump_table(bank, address, t))
+        return 1;
+    t->total = 0;
+    return opcodes[R(address)].kind == JUMPI || (opcodes[R(address)].kind == RETURN && (C(address) & JUMPED));
+}
+
+/*
+ ** Write the dispatch through a bounded jump table as ON GOTO over its
+ ** entries
+ */
+void lower_dispatch(struct bank *bank, struct table *t)
+{
+    struct context *ctx;
+    char line[512];
+    int c;
+    
+    ctx = bank->ctx;
+    if (t->offset)      /* The RTS pulls what was pushed */
+        add_stmt(ctx, "s = s + 2");
+    sprintf(line, "ON %s", t->index == RX ? "x" : "y");
+    if (t->shift)
+        sprintf(line + strlen(line), " / %d", 1 << t->shift);
+    strcat(line, " GOTO ");
+    for (c = 0; c < t->total; c++)
+        sprintf(line + strlen(line), "%s%s", c > 0 ? ", " : "", label(ctx, bank->number, jump_entry(bank, t, c)));
+    add_stmt(ctx, line);
+}
+
+/*
+ ** Check if a block is written whole by the chain before it, like the
+ ** INC of the high byte after INC / BNE
+ */
+int chained(struct bank *bank, int c)
+{
+    int at;
+    
+    for (at = bank->blocks[c].start; at < bank->blocks[c].end; at += lengths[opcodes[R(at)].mode]) {
+        if (bank->wide[at & 0x0fff] != W_INSIDE)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ ** Address where the statements go on from the end of a block,
+ ** passing over the blocks written whole by a chain
+ */
+int listed_after(struct bank *bank, int address)
+{
+    int c;
+    
+    while ((c = bank->block_at[address & 0x0fff]) >= 0 && chained(bank, c))
+        address = bank->blocks[c].end;
+    return address;
+}
+
+/*
+ ** Lower an instruction into statements of the block, ADC and SBC
+ ** are written in BCD where the D flag is always set
+ */
+void lower(struct bank *bank, int address)
+{
+    const char *stmt[MAX_STMT];
+    int len[MAX_STMT];
+    struct context *ctx;
+    struct opcode *op;
+    struct insn *insn;
+    struct table table;
+    char line[512];
+    char cond[280];
+    const char *code;
+    const char *map;
+    const char *p;
+    char *q;
+    int total;
+    int flag;
+    int c;
+    
+    ctx = bank->ctx;
+    op = &opcodes[R(address)];
+    insn = &ctx->insns[ctx->total_insns++];
+    insn->address = address;
+    insn->first = ctx->total_stmts;
+    insn->warn = 0;
+    insn->blank = 0;
+    if (op->kind == OP && bank->switched[address & 0x0fff] >= 0) {
+        insn->type = I_SWITCH;
+        sprintf(line, "GOTO %s\t' Bank switch", label(ctx, bank->switched[address & 0x0fff], continuation(bank, address)));
+        add_stmt(ctx, line);
+        insn->blank = 1;
+    } else if (bank->switched[address & 0x0fff] == SAME_BANK && (op->writes & LM)) {
+        insn->type = I_CODE;    /* Selects the bank running */
+    } else if (op->kind == CALL && bank->calls[address & 0x0fff] == C_TAIL) {
+        insn->type = I_CODE;
+        sprintf(line, "GOTO %s", label(ctx, bank->number, destination(bank, address)));
+        add_stmt(ctx, line);
+        insn->blank = 1;
+    } else if (op->kind == CALL && bank->calls[address & 0x0fff] == C_NATIVE) {
+        insn->type = I_CODE;
+        lower_native(bank, address);
+    } else if (op->code == NULL) {
+        insn->type = I_UNHANDLED;
+        sprintf(line, "' Unhandled opcode $%02X", R(address));
+        add_stmt(ctx, line);
+    } else if (bank->wide[address & 0x0fff] != W_NONE) {
+        insn->type = I_CODE;
+        if (bank->wide[address & 0x0fff] == W_CARRY) {   /* Not needed over an empty block */
+            if (destination(bank, address) != listed_after(bank, address + lengths[op->mode])) {
+                sprintf(line, "GOTO %s", label(ctx, bank->number, destination(bank, address)));
+                add_stmt(ctx, line);
+                insn->blank = 1;
+            }
+        } else if (bank->wide[address & 0x0fff] == W_SHIFT || bank->wide[address & 0x0fff] == W_SCALE) {
+            lower_shift(bank, address);
+        } else if (bank->wide[address & 0x0fff] != W_INSIDE) {
+            lower_wide(bank, address);
+        }
+    } else if ((op->kind == JUMPI || R(address) == 0x60) && ctx->target != C6502_C
+    && jump_table(bank, address, &table) && table.total > 0) {
+        insn->type = I_CODE;
+        lower_dispatch(bank, &table);
+        insn->blank = 1;
+    } else if (op->kind == BRANCH && bank->fused[address & 0x0fff] >= 0) {
+        insn->type = I_BRANCH;
+        branch_condition(bank, address, cond);
+        sprintf(line, "IF %s THEN GOTO %s", cond, label(ctx, bank->number, destination(bank, address)));
+        add_stmt(ctx, line);
+    } else if ((map = mapped(bank, address, H_WRITE)) != NULL) {
+        insn->type = I_CODE;
+        hardware_write(bank, address, map);
+    } else {
+        insn->type = I_CODE;
+        insn->warn = (op->mode == IZX || (op->mode == IZY && pointer_of(ctx, R(address + 1)) == NULL)
+                      || (op->kind == RETURN && dispatch(bank, address, &table)));
+        insn->blank = (op->kind == JUMP);
+        code = op->code;
+        if (arithmetic(R(address)) && bank->decimal[address & 0x0fff] == D_DECIMAL)
+            code = R(address) & 0x80 ? T_SBC_BCD : T_ADC_BCD;
+        total = split(code, stmt, len);
+        for (c = 0; c < total; c++) {
+            flag = flag_of(stmt[c]);
+            if (flag != 0 && (bank->live[address & 0x0fff] & flag) == 0)
+                continue;
+            q = line;
+            for (p = stmt[c]; p < stmt[c] + len[c]; p++) {
+                if (*p == '@') {
+                    strcpy(q, operand(bank, address));
+                    q += strlen(q);
+                } else {
+                    *q++ = *p;
+                }
+            }
+            *q = '\0';
+            add_stmt(ctx, line);
+        }
+    }
+    insn->total = ctx->total_stmts - insn->first;
+}
+
+/*
+ ** Address of a direct operand for CP1610
+ */
+void cp1610_address(struct bank *bank, char *buf, int value)
+{
+    if (value & 0x1000)             /* ROM */
+        strcpy(buf, data_label(bank, value));
+    else if ((value & 0x0280) == 0x0280)    /* RIOT */
+        sprintf(buf, "RIOT+$%02X", value & 0x1f);
+    else                            /* TIA and RAM, plus mirrors */
+        sprintf(buf, "ZP+$%02X", value & 0xff);
+}
+
+/*
+ ** Map the 6502 address in R4 onto the zero page when it isn't in the
+ ** ROM, the ROM only has the labels of its tables
+ */
+void cp1610_ram(struct bank *bank)
+{
+    add_stmt(bank->ctx, "MOVR R4, R5");
+    add_stmt(bank->ctx, "ANDI #$1000, R5");
+    add_stmt(bank->ctx, "BNEQ $ + 6");
+    add_stmt(bank->ctx, "ANDI #$FF, R4");
+    add_stmt(bank->ctx, "ADDI #ZP, R4");
+}
+
+/*
+ ** Point R4 to the operand of an indexed instruction. A (zp),Y
+ ** pointer to ROM tables gets the label of the table it holds, and
+ ** an unknown one the full address.
+ */
+void cp1610_pointer(struct bank *bank, int address)
+{
+    struct opcode *op;
+    struct pointer *p;
+    const char *index;
+    char line[64];
+    int value;
+    int c;
+    
+    op = &opcodes[R(address)];
+    value = R(address + 1) | R(address + 2) << 8;
+    index = (op->mode == ZPY || op->mode == ABY || op->mode == IZY) ? "R2" : "R1";
+    switch (op->mode) {
+        case ABX:
+        case ABY:
+            if ((value & 0x1000) || (value & 0x0280) == 0x0280) {
+                cp1610_address(bank, line + 6, value);
+                memcpy(line, "MVII #", 6);
+                strcat(line, ", R4");
+                add_stmt(bank->ctx, line);
+                sprintf(line, "ADDR %s, R4", index);
+                add_stmt(bank->ctx, line);
+                break;
+            }
+            /* TIA and RAM wrap inside the zero page */
+            /* fall through */
+        case ZPX:
+        case ZPY:
+        case IZX:
+            sprintf(line, "MOVR %s, R4", op->mode == IZX ? "R1" : index);
+            add_stmt(bank->ctx, line);
+            if (value & 0xff) {
+                sprintf(line, "ADDI #$%02X, R4", value & 0xff);
+                add_stmt(bank->ctx, line);
+                add_stmt(bank->ctx, "ANDI #$FF, R4");
+            }
+            add_stmt(bank->ctx, "ADDI #ZP, R4");
+            if (op->mode == IZX) {      /* Both bytes of the pointer */
+                add_stmt(bank->ctx, "MVI@ R4, R5");
+                add_stmt(bank->ctx, "MVI@ R4, R4");
+                add_stmt(bank->ctx, "SWAP R4");
+                add_stmt(bank->ctx, "ADDR R5, R4");
+                cp1610_ram(bank);
+            }
+            break;
+        case IZY:
+            p = pointer_of(bank->ctx, value & 0xff);
+            if (p != NULL && p->kind == P_RAM) {    /* Only the low byte of the pointer */
+                sprintf(line, "MVI ZP+$%02X, R4", value & 0xff);
+                add_stmt(bank->ctx, line);
+                add_stmt(bank->ctx, "ADDR R2, R4");
+                add_stmt(bank->ctx, "ANDI #$FF, R4");
+                add_stmt(bank->ctx, "ADDI #ZP, R4");
+                break;
+            }
+            if (p != NULL && (op->writes & LM) == 0) {
+                if (p->total > 1) {     /* R5 is the table or the page */
+                    sprintf(line, "MVI ZP+$%02X, R5", (value + 1) & 0xff);
+                    add_stmt(bank->ctx, line);
+                    add_stmt(bank->ctx, "SWAP R5");
+                    if (p->kind == P_TABLES) {
+                        sprintf(line, "ADD ZP+$%02X, R5", value & 0xff);
+                        add_stmt(bank->ctx, line);
+                    }
+                }
+                for (c = 0; c < p->total; c++) {
+                    if (p->total > 1) {
+                        sprintf(line, "CMPI #$%04X, R5", p->targets[c]);
+                        add_stmt(bank->ctx, line);
+                        add_stmt(bank->ctx, "BNEQ $ + 4");
+                    }
+                    sprintf(line, "MVII #%s, R4", data_label(bank, p->targets[c]));
+                    add_stmt(bank->ctx, line);
+                }
+                if (p->kind == P_PAGES) {
+                    sprintf(line, "ADD ZP+$%02X, R4", value & 0xff);
+                    add_stmt(bank->ctx, line);
+                }
+                add_stmt(bank->ctx, "ADDR R2, R4");
+                break;
+            }
+            /* The full address, the ROM isn't there and writes into it only touch hotspots */
+            sprintf(line, "MVI ZP+$%02X, R5", (value + 1) & 0xff);
+            add_stmt(bank->ctx, line);
+            add_stmt(bank->ctx, "SWAP R5");
+            sprintf(line, "ADD ZP+$%02X, R5", value & 0xff);
+            add_stmt(bank->ctx, line);
+            add_stmt(bank->ctx, "ADDR R2, R5");
+            add_stmt(bank->ctx, "MOVR R5, R4");
+            cp1610_ram(bank);
+            break;
+    }
+}
+
+/*
+ ** Expand a statement of a CP1610 template for the instruction at
+ ** an address. The pointer is set to 1 once R4 points to the
+ ** operand, and to 2 once R4 was incremented by using it.
+ */
+void cp1610_statement(struct bank *bank, int address, const char *stmt, int len, int *pointer)
+{
+    struct opcode *op;
+    char line[128];
+    char where[64];
+    char mnemonic[8];
+    char reg[8];
+    const char *p;
+    char *q;
+    int value;
+    
+    op = &opcodes[R(address)];
+    if (len == 1 && (stmt[0] == '^' || stmt[0] == '!')) {    /* Load or store Rv */
+        if (op->mode != ACC)
+            cp1610_statement(bank, address, stmt[0] == '^' ? "MVI* R3" : "MVO* R3", 7, pointer);
+        return;
+    }
+    q = line;
+    for (p = stmt; p < stmt + len; p++) {
+        if (*p == '%') {
+            strcpy(q, operand(bank, address));
+            q += strlen(q);
+        } else if (p[0] == 'R' && p[1] == 'v') {
+            *q++ = 'R';
+            *q++ = op->mode == ACC ? '0' : '3';
+            p++;
+        } else {
+            *q++ = *p;
+        }
+    }
+    *q = '\0';
+    q = strchr(line, '*');
+    if (line[0] == '\'') {
+        line[0] = ';';
+        add_stmt(bank->ctx, line);
+        return;
+    }
+    if (q == NULL || q - line >= (int) sizeof(mnemonic) || strlen(q + 2) >= sizeof(reg)) {
+        add_stmt(bank->ctx, line);
+        return;
+    }
+    memcpy(mnemonic, line, q - line);
+    mnemonic[q - line] = '\0';
+    strcpy(reg, q + 2);
+    value = R(address + 1) | R(address + 2) << 8;
+    switch (op->mode) {
+        case IMM:
+            sprintf(line, "%sI #$%02X, %s", mnemonic, value & 0xff, reg);
+            break;
+        case ZPG:
+        case ABS:
+            if (bank->switched[address & 0x0fff] == SAME_BANK) {     /* The ROM byte */
+                sprintf(line, "%sI #$%02X, %s", mnemonic, R(value), reg);
+                break;
+            }
+            cp1610_address(bank, where, op->mode == ZPG ? value & 0xff : value);
+            if (strcmp(mnemonic, "MVO") == 0)
+                sprintf(line, "MVO %s, %s", reg, where);
+            else
+                sprintf(line, "%s %s, %s", mnemonic, where, reg);
+            break;
+        default:
+            if (*pointer == 0)
+                cp1610_pointer(bank, address);
+            else if (*pointer == 2)
+                add_stmt(bank->ctx, "DECR R4");
+            *pointer = 2;
+            if (strcmp(mnemonic, "MVO") == 0)
+                sprintf(line, "MVO@ %s, R4", reg);
+            else
+                sprintf(line, "%s@ R4, %s", mnemonic, reg);
+            break;
+    }
+    add_stmt(bank->ctx, line);
+}
+
+/*
+ ** Branch testing natively the expression that set its flag, the
+ ** operands are the same as when it was set.
+ */
+void cp1610_branch(struct bank *bank, int address)
+{
+    struct opcode *op;
+    struct opcode *sop;
+    const char *e;
+    const char *reg;
+    char line[64];
+    char expr[32];
+    int pointer;
+    int setter;
+    int taken;
+    int length;
+    int reads;
+    
+    op = &opcodes[R(address)];
+    setter = bank->fused[address & 0x0fff];
+    sop = &opcodes[R(setter)];
+    taken = R(address) & 0x20;  /* Bit 5 is the value tested */
+    pointer = 0;
+    if (compare(sop) != 0) {
+        reg = compare(sop) == 'a' ? "R0" : compare(sop) == 'x' ? "R1" : "R2";
+        sprintf(line, "CMP* %s", reg);
+        cp1610_statement(bank, setter, line, strlen(line), &pointer);
+        if (op->uses == FZ)
+            sprintf(line, "%s %s", taken ? "BEQ" : "BNEQ", operand(bank, address));
+        else
+            sprintf(line, "%s %s", taken ? "BC" : "BNC", operand(bank, address));
+        add_stmt(bank->ctx, line);
+        return;
+    }
+    e = flag_expression(sop, op->uses, &length, &reads);
+    if (length >= (int) sizeof(expr))
+        length = sizeof(expr) - 1;
+    memcpy(expr, e, length);
+    expr[length] = '\0';
+    if (strcmp(expr, "0") == 0 || strcmp(expr, "1") == 0) {
+        if ((expr[0] == '1') == (taken != 0)) {
+            sprintf(line, "B %s", operand(bank, address));
+            add_stmt(bank->ctx, line);
+        }
+        return;
+    }
+    
+    /* Register holding the value, loading the operand in R3 if needed */
+    switch (expr[0]) {
+        case 'a': reg = "R0"; break;
+        case 'x': reg = "R1"; break;
+        case 'y': reg = "R2"; break;
+        default:
+            reg = sop->mode == ACC ? "R0" : "R3";
+            if (sop->mode != ACC)
+                cp1610_statement(bank, setter, "MVI* R3", 7, &pointer);
+            break;
+    }
+    if (strcmp(expr + 1, " AND $80") == 0) {
+        sprintf(line, "CMPI #$80, %s", reg);
+        add_stmt(bank->ctx, line);
+        sprintf(line, "%s %s", taken ? "BC" : "BNC", operand(bank, address));
+    } else if (strcmp(expr + 1, " = 0") == 0) {
+        sprintf(line, "TSTR %s", reg);
+        add_stmt(bank->ctx, line);
+        sprintf(line, "%s %s", taken ? "BEQ" : "BNEQ", operand(bank, address));
+    } else if (strcmp(expr, "(@ AND a) = 0") == 0) {
+        add_stmt(bank->ctx, "ANDR R0, R3");
+        sprintf(line, "%s %s", taken ? "BEQ" : "BNEQ", operand(bank, address));
+    } else if (strcmp(expr, "@ AND $40") == 0) {
+        add_stmt(bank->ctx, "ANDI #$40, R3");
+        sprintf(line, "%s %s", taken ? "BNEQ" : "BEQ", operand(bank, address));
+    } else {
+        sprintf(line, "; Unknown condition %s !!!", expr);
+    }
+    add_stmt(bank->ctx, line);
+}
+
+/*
+ ** Jump through a zero page pointer, or to the address pulled by an
+ ** RTS used as a jump, comparing it with the table entries and the
+ ** targets found by the interpreter. Returns 0 if none are known.
+ */
+int cp1610_dispatch(struct bank *bank, int address, struct table *t)
+{
+    const char *stmt[MAX_STMT * 2];
+    int len[MAX_STMT * 2];
+    struct context *ctx;
+    char line[64];
+    int pointer;
+    int entry;
+    int total;
+    int c;
+    
+    ctx = bank->ctx;
+    total = t->total;
+    for (c = 0; c < bank->total_blocks; c++) {
+        if (C(bank->blocks[c].start) & DYNAMIC)
+            total++;
+    }
+    if (total == 0)
+        return 0;
+    pointer = 0;
+    if (R(address) == 0x60) {   /* Low byte first */
+        total = split(A_PULL("R4") ";" A_PULL("R3"), stmt, len);
+        for (c = 0; c < total; c++)
+            cp1610_statement(bank, address, stmt[c], len[c], &pointer);
+        add_stmt(ctx, "SWAP R3");
+        add_stmt(ctx, "ADDR R3, R4");
+        add_stmt(ctx, "INCR R4");
+    } else {
+        sprintf(line, "MVI ZP+$%02X, R4", R(address + 1));
+        add_stmt(ctx, line);
+        sprintf(line, "MVI ZP+$%02X, R3", (R(address + 1) + 1) & 0xff);    /* Wraps inside the page */
+        add_stmt(ctx, line);
+        add_stmt(ctx, "SWAP R3");
+        add_stmt(ctx, "ADDR R3, R4");
+    }
+    add_stmt(ctx, "ANDI #$1FFF, R4");
+    for (c = 0; c < t->total; c++) {
+        sprintf(line, "CMPI #$%04X, R4", jump_entry(bank, t, c) & 0x1fff);
+        add_stmt(ctx, line);
+        sprintf(line, "BEQ %s", label(ctx, bank->number, jump_entry(bank, t, c)));
+        add_stmt(ctx, line);
+    }
+    for (c = 0; c < bank->total_blocks; c++) {
+        if ((C(bank->blocks[c].start) & DYNAMIC) == 0)
+            continue;
+        for (entry = 0; entry < t->total && jump_entry(bank, t, entry) != bank->blocks[c].start; entry++)
+            ;
+        if (entry < t->total)
+            continue;
+        sprintf(line, "CMPI #$%04X, R4", bank->blocks[c].start & 0x1fff);
+        add_stmt(ctx, line);
+        sprintf(line, "BEQ %s", label(ctx, bank->number, bank->blocks[c].start));
+        add_stmt(ctx, line);
+    }
+    add_stmt(ctx, "; Any other address !!!");
+    return 1;
+}
+
+/*
+ ** Lower an instruction into CP1610 statements of the block
+ */
+void lower_cp1610(struct bank *bank, int address)
+{
+    const char *stmt[MAX_STMT * 4];
+    int len[MAX_STMT * 4];
+    struct context *ctx;
+    struct opcode *op;
+    struct insn *insn;
+    struct table table;
+    char line[64];
+    const char *code;
+    const char *map;
+    int pointer;
+    int total;
+    int flags;
+    int flag;
+    int c;
+    
+    ctx = bank->ctx;
+    op = &opcodes[R(address)];
+    insn = &ctx->insns[ctx->total_insns++];
+    insn->address = address;
+    insn->first = ctx->total_stmts;
+    insn->warn = 0;
+    insn->blank = 0;
+    if (op->kind == OP && bank->switched[address & 0x0fff] >= 0) {
+        insn->type = I_SWITCH;
+        sprintf(line, "B %s\t; Bank switch", label(ctx, bank->switched[address & 0x0fff], continuation(bank, address)));
+        add_stmt(ctx, line);
+        insn->blank = 1;
+    } else if (bank->switched[address & 0x0fff] == SAME_BANK && (op->writes & LM)) {
+        insn->type = I_CODE;    /* Selects the bank running */
+    } else if (op->kind == BRANCH && bank->fused[address & 0x0fff] >= 0) {
+        insn->type = I_BRANCH;
+        cp1610_branch(bank, address);
+    } else if (op->kind == CALL && bank->calls[address & 0x0fff] == C_TAIL) {
+        insn->type = I_CODE;
+        sprintf(line, "B %s", operand(bank, address));
+        add_stmt(ctx, line);
+        insn->blank = 1;
+    } else if (op->kind == CALL) {  /* Return address goes into the CP1610 stack */
+        insn->type = I_CODE;
+        sprintf(line, "MVII #R%s, R5", label(ctx, bank->number, address + lengths[op->mode]));
+        add_stmt(ctx, line);
+        add_stmt(ctx, "PSHR R5");
+        sprintf(line, "B %s", operand(bank, address));
+        add_stmt(ctx, line);
+        sprintf(line, "R%s:", label(ctx, bank->number, address + lengths[op->mode]));
+        add_stmt(ctx, line);
+    } else if ((op->kind == JUMPI || op->kind == RETURN) && dispatch(bank, address, &table)) {
+        insn->type = I_CODE;
+        insn->blank = 1;
+        if ((op->kind == JUMPI && R(address + 2) != 0) || R(address) == 0x40 || !cp1610_dispatch(bank, address, &table)) {
+            print(&ctx->log, "Jump without known targets at $%04X\n", address);
+            if (op->kind == JUMPI)
+                sprintf(line, "; JMP (%s)\t; !!!", operand(bank, address));
+            else
+                sprintf(line, "; %s used as a jump\t; !!!", R(address) == 0x40 ? "RTI" : "RTS");
+            add_stmt(ctx, line);
+        }
+    } else if (op->native == NULL) {
+        insn->type = I_UNHANDLED;
+        sprintf(line, "; Unhandled opcode $%02X", R(address));
+        add_stmt(ctx, line);
+    } else if ((map = mapped(bank, address, H_WRITE)) != NULL) {
+        insn->type = I_CODE;
+        hardware_write(bank, address, map);
+    } else {
+        insn->type = I_CODE;
+        insn->warn = (op->mode == IZX || (op->mode == IZY && pointer_of(ctx, R(address + 1)) == NULL));
+        insn->blank = (op->kind == JUMP);
+        flags = bank->live[address & 0x0fff];
+        code = op->native;
+        if (arithmetic(R(address)) && bank->decimal[address & 0x0fff] == D_DECIMAL)
+            code = R(address) & 0x80 ? A_SBC_BCD : A_ADC_BCD;
+        total = split(code, stmt, len);
+        pointer = 0;
+        for (c = 0; c < total; c++) {
+            if (len[c] > 2 && stmt[c][1] == ':') {
+                switch (stmt[c][0]) {
+                    case 'n': flag = FN; break;
+                    case 'z': flag = FZ; break;
+                    case 'c': flag = FC; break;
+                    case 'v': flag = FV; break;
+                    default: flag = op->defs & FALL; break;
+                }
+                if ((flags & flag) == 0)
+                    continue;
+                stmt[c] += 2;
+                len[c] -= 2;
+            }
+            cp1610_statement(bank, address, stmt[c], len[c], &pointer);
+        }
+    }
+    insn->total = ctx->total_stmts - insn->first;
+}
+
+/*
+ ** Values known for the variables while walking a block
+ */
+#define K_NONE  0
+#define K_CONST 1       /* Constant */
+#define K_COPY  2       /* Copy of another variable */
+
+struct known {
+    int type;
+    int value;          /* Constant or variable copied */
+};
+
+/*
+ ** Expression rebuilt by the simplifier
+ */
+struct term {
+    int constant;       /* Value is constant */
+    int value;
+    int changed;        /* Text differs from the original */
+    char text[256];
+};
+
+struct parser {
+    const char *p;
+    struct known *known;
+    int failed;
+    int bank;           /* Bank of the code, for C */
+    struct bstate *state;   /* Program being run, for verification */
+};
+
+/*
+ ** Operators in order of precedence, NOT and negation are unary
+ */
+static const char *operators[][7] = {
+    {"OR", NULL},
+    {"XOR", NULL},
+    {"AND", NULL},
+    {"NOT", NULL},
+    {"<>", "<=", ">=", "=", "<", ">", NULL},
+    {"+", "-", NULL},
+    {"*", "/", "%", NULL},
+    {"-", NULL},
+};
+
+#define LEVEL_NOT    3
+#define LEVEL_MINUS  7
+
+/*
+ ** Text for a constant
+ */
+void number(char *buf, int value)
+{
+    if (value < 10)
+        sprintf(buf, "%d", value);
+    else if (value < 256)
+        sprintf(buf, "$%02X", value);
+    else
+        sprintf(buf, "$%04X", value);
+}
+
+/*
+ ** Operator of a precedence level at the parser position, or NULL
+ */
+const char *operator_at(struct parser *ps, int level)
+{
+    const char **op;
+    int len;
+    
+    while (*ps->p == ' ')
+        ps->p++;
+    for (op = operators[level]; *op != NULL; op++) {
+        len = strlen(*op);
+        if (strncmp(ps->p, *op, len) == 0 && (!isalpha(**op) || !isalnum(ps->p[len]))) {
+            ps->p += len;
+            return *op;
+        }
+    }
+    return NULL;
+}
+
+/*
+ ** Fold an operation over constants as IntyBASIC does it with 16-bit
+ ** values, comparisons give -1 for true. Returns zero when the result
+ ** could depend on the signedness of the operands.
+ */
+int fold(const char *op, int a, int b, int *value)
+{
+    int small;
+    
+    small = (a < 0x8000 && b < 0x8000);
+    if (strcmp(op, "OR") == 0)
+        *value = a | b;
+    else if (strcmp(op, "XOR") == 0)
+        *value = a ^ b;
+    else if (strcmp(op, "AND") == 0)
+        *value = a & b;
+    else if (strcmp(op, "NOT") == 0)
+        *value = ~a;
+    else if (strcmp(op, "+") == 0)
+        *value = a + b;
+    else if (strcmp(op, "-") == 0)
+        *value = a - b;
+    else if (strcmp(op, "*") == 0)
+        *value = a * b;
+    else if (strcmp(op, "=") == 0)
+        *value = -(a == b);
+    else if (strcmp(op, "<>") == 0)
+        *value = -(a != b);
+    else if (!small)
+        return 0;
+    else if (strcmp(op, "<") == 0)
+        *value = -(a < b);
+    else if (strcmp(op, ">") == 0)
+        *value = -(a > b);
+    else if (strcmp(op, "<=") == 0)
+        *value = -(a <= b);
+    else if (strcmp(op, ">=") == 0)
+        *value = -(a >= b);
+    else if (b == 0)
+        return 0;
+    else if (strcmp(op, "/") == 0)
+        *value = a / b;
+    else
+        *value = a % b;
+    *value &= 0xffff;
+    return 1;
+}
+
+void expression(struct parser *ps, int level, struct term *t);
+
+/*
+ ** Simplify a primary expression
+ */
+void primary(struct parser *ps, struct term *t)
+{
+    struct term index;
+    struct known *k;
+    const char *s;
+    char *end;
+    int length;
+    int var;
+    
+    t->constant = 0;
+    t->changed = 0;
+    t->text[0] = '\0';
+    while (*ps->p == ' ')
+        ps->p++;
+    s = ps->p;
+    if (*ps->p == '(') {
+        ps->p++;
+        expression(ps, 0, &index);
+        if (*ps->p != ')') {
+            ps->failed = 1;
+            return;
+        }
+        ps->p++;
+        if (index.constant) {
+            t->constant = 1;
+            t->value = index.value;
+            t->changed = 1;
+            number(t->text, t->value);
+        } else {
+            t->changed = index.changed;
+            length = strlen(index.text);
+            if (length + 3 >= (int) sizeof(t->text)) {
+                ps->failed = 1;
+                return;
+            }
+            t->text[0] = '(';
+            memcpy(t->text + 1, index.text, length);
+            strcpy(t->text + 1 + length, ")");
+        }
+    } else if (*ps->p == '$' || isdigit(*ps->p)) {
+        if (*ps->p == '$')
+            t->value = strtol(ps->p + 1, &end, 16);
+        else
+            t->value = strtol(ps->p, &end, 10);
+        ps->p = end;
+        t->constant = 1;
+        t->value &= 0xffff;
+        memcpy(t->text, s, ps->p - s);
+        t->text[ps->p - s] = '\0';
+    } else if (*ps->p == '#' || isalpha(*ps->p)) {
+        ps->p++;
+        while (isalnum(*ps->p) || *ps->p == '.')
+            ps->p++;
+        length = ps->p - s;
+        if (length >= 32) {
+            ps->failed = 1;
+            return;
+        }
+        if (*ps->p == '(') {    /* Array */
+            ps->p++;
+            expression(ps, 0, &index);
+            if (*ps->p != ')') {
+                ps->failed = 1;
+                return;
+            }
+            ps->p++;
+            t->changed = index.changed;
+            if (index.constant && index.changed) {
+                if (length == 2 && memcmp(s, "zp", 2) == 0 && index.value < 256)
+                    sprintf(index.text, "$%02X", index.value);
+                else
+                    number(index.text, index.value);
+            }
+            if (length + strlen(index.text) + 3 >= sizeof(t->text)) {
+                ps->failed = 1;
+                return;
+            }
+            memcpy(t->text, s, length);
+            t->text[length] = '(';
+            strcpy(t->text + length + 1, index.text);
+            strcat(t->text, ")");
+            return;
+        }
+        memcpy(t->text, s, length);
+        t->text[length] = '\0';
+        var = variable(s, length);
+        if (var == 0)
+            return;
+        k = &ps->known[slot(var)];
+        if (k->type == K_CONST) {
+            t->constant = 1;
+            t->value = k->value;
+            t->changed = 1;
+            number(t->text, t->value);
+        } else if (k->type == K_COPY) {
+            t->changed = 1;
+            strcpy(t->text, variable_name(k->value));
+        }
+    } else {
+        ps->failed = 1;
+    }
+}
+
+/*
+ ** Simplify an expression from a precedence level, replacing the
+ ** variables with known values and folding constants.
+ */
+void expression(struct parser *ps, int level, struct term *t)
+{
+    struct term right;
+    const char *op;
+    int value;
+    
+    if (level == LEVEL_NOT || level == LEVEL_MINUS) {
+        op = operator_at(ps, level);
+        if (op == NULL) {
+            if (level == LEVEL_MINUS)
+                primary(ps, t);
+            else
+                expression(ps, level + 1, t);
+            return;
+        }
+        expression(ps, level, &right);
+        if (right.constant && fold(level == LEVEL_MINUS ? "-" : op, level == LEVEL_MINUS ? 0 : right.value, right.value, &value)) {
+            t->constant = 1;
+            t->value = value;
+            t->changed = 1;
+            number(t->text, value);
+        } else {
+            t->constant = 0;
+            t->changed = right.changed;
+            if (strlen(right.text) + 5 >= sizeof(t->text)) {
+                ps->failed = 1;
+                return;
+            }
+            strcpy(t->text, op);
+            if (level != LEVEL_MINUS)
+                strcat(t->text, " ");
+            memcpy(t->text + strlen(t->text), right.text, strlen(right.text) + 1);
+        }
+        return;
+    }
+    expression(ps, level + 1, t);
+    while (!ps->failed && (op = operator_at(ps, level)) != NULL) {
+        expression(ps, level + 1, &right);
+        if (t->constant && right.constant && fold(op, t->value, right.value, &value)) {
+            t->value = value;
+            t->changed = 1;
+            number(t->text, value);
+        } else if (right.constant && right.value == 0 && (strcmp(op, "+") == 0 || strcmp(op, "-") == 0
+                   || strcmp(op, "OR") == 0 || strcmp(op, "XOR") == 0)) {
+            t->changed = 1;
+        } else if (t->constant && t->value == 0 && (strcmp(op, "+") == 0
+                   || strcmp(op, "OR") == 0 || strcmp(op, "XOR") == 0)) {
+            *t = right;
+            t->changed = 1;
+        } else {
+            t->changed |= right.changed;
+            t->constant = 0;
+            if (strlen(t->text) + strlen(op) + strlen(right.text) + 3 >= sizeof(t->text)) {
+                ps->failed = 1;
+                return;
+            }
+            strcat(t->text, " ");
+            strcat(t->text, op);
+            strcat(t->text, " ");
+            strcat(t->text, right.text);
+        }
+    }
+}
+
+/*
+ ** Simplify a piece of statement, it is left as is if it can't be parsed
+ */
+void simplify(struct known *known, const char *text, int len, struct term *t)
+{
+    struct parser ps;
+    char copy[256];
+    
+    if (len >= (int) sizeof(copy))
+        len = sizeof(copy) - 1;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    ps.p = copy;
+    ps.known = known;
+    ps.failed = 0;
+    expression(&ps, 0, t);
+    while (*ps.p == ' ')
+        ps.p++;
+    if (ps.failed || *ps.p != '\0') {
+        t->constant = 0;
+        t->changed = 0;
+        strcpy(t->text, copy);
+    }
+}
+
+/*
+ ** Replace the text of a statement
+ */
+void replace(struct context *ctx, struct stmt *stmt, const char *text)
+{
+    stmt->text = ctx->pool.length;
+    print(&ctx->pool, "%s", text);
+    put(&ctx->pool, '\0');
+}
+
+/*
+ ** Propagate the values known for the variables inside the block,
+ ** constants and copies of other variables, and fold the constant
+ ** expressions. An IF with a known condition becomes a GOTO or it
+ ** disappears. The variables in the mask start with the values given,
+ ** in the order a, x, y, c.
+ */
+void propagate(struct context *ctx, int outputs, const byte *output)
+{
+    struct known known[16];
+    struct insn *insn;
+    struct stmt *stmt;
+    struct term lhs;
+    struct term rhs;
+    char line[512];
+    const char *text;
+    const char *then;
+    int target;
+    int var;
+    int c;
+    int d;
+    
+    for (c = 0; c < 16; c++)
+        known[c].type = K_NONE;
+    for (c = 0; c < 4; c++) {
+        if (outputs & outputs_of[c]) {
+            known[slot(outputs_of[c])].type = K_CONST;
+            known[slot(outputs_of[c])].value = output[c];
+        }
+    }
+    for (insn = ctx->insns; insn < ctx->insns + ctx->total_insns; insn++) {
+        for (stmt = ctx->stmts + insn->first; stmt < ctx->stmts + insn->first + insn->total; stmt++) {
+            if (ctx->pool.failed)
+                return;
+            text = ctx->pool.data + stmt->text;
+            if (text[0] == '\'')
+                continue;
+            if (memcmp(text, "IF ", 3) == 0) {
+                then = strstr(text, " THEN ");
+                simplify(known, text + 3, then - text - 3, &rhs);
+                if (rhs.constant) {
+                    if (rhs.value != 0) {
+                        strcpy(line, then + 6);
+                        replace(ctx, stmt, line);
+                        insn->blank = 1;
+                    } else {
+                        stmt->keep = 0;
+                    }
+                } else if (rhs.changed) {
+                    sprintf(line, "IF %s%s", rhs.text, then);
+                    replace(ctx, stmt, line);
+                }
+                continue;
+            }
+            c = assignment(text);
+            if (c < 0) {
+                for (d = 0; d < 16; d++)
+                    known[d].type = K_NONE;
+                continue;
+            }
+            target = stmt->target;
+            simplify(known, text + c + 2, strlen(text + c + 2), &rhs);
+            lhs.changed = 0;
+            if (target == 0 && text[c - 2] == ')')     /* Array */
+                simplify(known, text, c - 1, &lhs);
+            if (rhs.changed || lhs.changed) {
+                if (rhs.constant)
+                    number(rhs.text, rhs.value & (target == VT ? 0xffff : 0xff));
+                snprintf(line, sizeof(line), "%.*s = %s", lhs.changed ? (int) strlen(lhs.text) : c - 1,
+                         lhs.changed ? lhs.text : text, rhs.text);
+                replace(ctx, stmt, line);
+            }
+            if (target == 0)
+                continue;
+            for (d = 0; d < 16; d++) {
+                if (known[d].type == K_COPY && known[d].value == target)
+                    known[d].type = K_NONE;
+            }
+            var = variable(rhs.text, strlen(rhs.text));
+            if (rhs.constant) {
+                known[slot(target)].type = K_CONST;
+                known[slot(target)].value = rhs.value & (target == VT ? 0xffff : 0xff);
+            } else if (var != 0 && var != target && (var != VT || target == VT)) {
+                known[slot(target)].type = K_COPY;
+                known[slot(target)].value = var;
+            } else {
+                known[slot(target)].type = K_NONE;
+            }
+        }
+    }
+}
+
+/*
+ ** Remove the assignments to variables that aren't used before being
+ ** assigned again, walking the block backwards from the variables
+ ** live at its exit.
+ */
+void eliminate(struct context *ctx, int live)
+{
+    struct insn *insn;
+    struct stmt *stmt;
+    const char *text;
+    int c;
+    
+    if (ctx->pool.failed)
+        return;
+    for (insn = ctx->insns + ctx->total_insns - 1; insn >= ctx->insns; insn--) {
+        for (stmt = ctx->stmts + insn->first + insn->total - 1; stmt >= ctx->stmts + insn->first; stmt--) {
+            if (!stmt->keep)
+                continue;
+            text = ctx->pool.data + stmt->text;
+            if (text[0] == '\'')
+                continue;
+            if (memcmp(text, "IF ", 3) == 0) {
+                live |= variables_read(text, strstr(text, " THEN ") - text);
+                continue;
+            }
+            c = assignment(text);
+            if (c < 0) {    /* Register map statements */
+                live |= variables_read(text, strlen(text));
+                continue;
+            }
+            if (stmt->target != 0) {
+                if ((live & stmt->target) == 0) {
+                    stmt->keep = 0;
+                    continue;
+                }
+                live &= ~stmt->target;
+            } else {
+                live |= variables_read(text, c);
+            }
+            live |= variables_read(text + c + 2, strlen(text + c + 2));
+        }
+    }
+}
+
+/*
+ ** Write the statements of the block. The assignments to n and z are
+ ** joined on a line, labels go at the start of the line.
+ */
+void write_block(struct bank *bank)
+{
+    struct context *ctx;
+    struct insn *insn;
+    struct stmt *stmt;
+    const char *warn;
+    const char *text;
+    int joined;
+    int flag;
+    
+    ctx = bank->ctx;
+    if (ctx->pool.failed)
+        return;
+    for (insn = ctx->insns; insn < ctx->insns + ctx->total_insns; insn++) {
+        warn = !insn->warn ? "" : ctx->target == C6502_CP1610 ? "\t; !!!" : "\t' !!!";
+        joined = 0;
+        for (stmt = ctx->stmts + insn->first; stmt < ctx->stmts + insn->first + insn->total; stmt++) {
+            if (!stmt->keep)
+                continue;
+            text = ctx->pool.data + stmt->text;
+            flag = stmt->target & FNZ;
+            if (joined == 1 && flag != 0) {
+                put(OUTPUT, ':');
+            } else {
+                if (joined)
+                    print(OUTPUT, "%s\n", warn);
+                if (text[strlen(text) - 1] != ':')
+                    put(OUTPUT, '\t');
+            }
+            joined = flag != 0 ? 1 : 2;
+            print(OUTPUT, "%s", text);
+        }
+        if (joined)
+            print(OUTPUT, "%s\n", warn);
+        if (insn->blank)
+            print(OUTPUT, "\n");
+    }
+}
+
+/*
+ ** Mark a jump target and queue it for discovery
+ */
+void target(struct bank *bank, int address)
+{
+    address = ADDR(address);
+    C(address) |= LABEL | BLOCK;
+    if ((C(address) & (QUEUED | 3)) == 0) {
+        C(address) |= QUEUED;
+        bank->pending[bank->total_pending++] = address;
+    }
+}
+
+/*
+ ** Lower at the call site the subroutine called by a JSR, without
+ ** its RTS
+ */
+void inline_call(struct bank *bank, int address)
+{
+    struct block *b;
+    int at;
+    
+    b = &bank->blocks[bank->block_at[destination(bank, address) & 0x0fff]];
+    for (at = b->start; at < b->last; at += lengths[opcodes[R(at)].mode]) {
+        if (bank->ctx->target == C6502_CP1610)
+            lower_cp1610(bank, at);
+        else
+            lower(bank, at);
+    }
+}
+
+/*
+ ** Analyze one 6502 instruction, returns address of next one
+ */
+int analyze(struct bank *bank, int address)
+{
+    struct opcode *op;
+    struct seed *seeds;
+    struct table table;
+    int value;
+    int other;
+    int c;
+    
+    op = &opcodes[R(address)];
+    C(address) = (C(address) & ~3) | bank->ctx->step;
+    if (bank->ctx->step == 2) {
+        if (bank->calls[address & 0x0fff] == C_INLINE)
+            inline_call(bank, address);
+        else if (bank->ctx->target == C6502_CP1610)
+            lower_cp1610(bank, address);
+        else
+            lower(bank, address);
+        return address + lengths[op->mode];
+    }
+    other = switch_bank(bank, address);
+    if (other < 0 && op->kind == CALL && opcodes[R(destination(bank, address))].kind == OP) {
+        value = bank->previous;
+        bank->previous = -1;
+        other = switch_bank(bank, destination(bank, address));
+        bank->previous = value;
+    }
+    if (other == bank->number && op->kind == OP) {
+        bank->switched[address & 0x0fff] = SAME_BANK;
+        return address + lengths[op->mode];
+    }
+    if (other >= 0 && other != bank->number) {
+        bank->switched[address & 0x0fff] = other;
+        if (bank->total_seeds == bank->size_seeds) {
+            seeds = realloc(bank->seeds, (bank->size_seeds + 64) * sizeof(struct seed));
+            if (seeds == NULL) {
+                bank->ctx->pool.failed = 1;
+                bank->fallthrough = 0;
+                return address + lengths[op->mode];
+            }
+            bank->seeds = seeds;
+            bank->size_seeds += 64;
+        }
+        bank->seeds[bank->total_seeds].bank = other;
+        bank->seeds[bank->total_seeds++].address = continuation(bank, address);
+        if (op->kind == CALL)
+            C(address + lengths[op->mode]) |= BLOCK;
+        else
+            bank->fallthrough = 0;
+        return address + lengths[op->mode];
+    }
+    switch (op->kind) {
+        case UNK:
+            print(&bank->ctx->log, "Unhandled opcode $%02x at $%04x\n", R(address), address);
+            bank->fallthrough = 0;
+            return address + 1;
+        case BRANCH:
+        case CALL:
+            target(bank, destination(bank, address));
+            C(address + lengths[op->mode]) |= BLOCK;
+            break;
+        case JUMP:
+            target(bank, destination(bank, address));
+            bank->fallthrough = 0;
+            break;
+        case JUMPI:
+        case RETURN:
+            if (jump_table(bank, address, &table)) {
+                for (c = 0; c < table.total; c++)
+                    target(bank, jump_entry(bank, &table, c));
+            }
+            bank->fallthrough = 0;
+            break;
+        default:
+            if (op->mode == ABS || op->mode == ABX || op->mode == ABY) {
+                value = R(address + 1) | R(address + 2) << 8;
+                if (value & 0x1000)     /* Label for ROM data */
+                    C(value) |= LABEL;
+            }
+            break;
+    }
+    return address + lengths[op->mode];
+}
+
+/*
+ ** Find code reachable from the worklist without recursion. Each
+ ** address taken from it is followed linearly until control flow
+ ** stops or it reaches code already visited.
+ */
+void discover(struct bank *bank)
+{
+    struct block *blocks;
+    int address;
+    int value;
+    
+    while (bank->total_pending > 0) {
+        address = bank->pending[--bank->total_pending];
+        if (C(address) & 3)
+            continue;
+        if (bank->total_blocks == bank->size_blocks) {
+            blocks = realloc(bank->blocks, (bank->size_blocks + 256) * sizeof(struct block));
+            if (blocks == NULL) {
+                bank->ctx->pool.failed = 1;
+                return;
+            }
+            bank->blocks = blocks;
+            bank->size_blocks += 256;
+        }
+        bank->blocks[bank->total_blocks].start = address;
+        bank->fallthrough = 1;
+        bank->previous = -1;
+        do {
+            value = address;
+            address = analyze(bank, address);
+            bank->previous = value;
+            if ((address & 0x0fff) <= (value & 0x0fff))   /* Runs out of the bank */
+                bank->fallthrough = 0;
+        } while (bank->fallthrough && (C(address) & 3) == 0) ;
+        if (bank->fallthrough)
+            C(address) |= BLOCK;    /* Joins code already visited */
+        bank->blocks[bank->total_blocks++].end = address;
+    }
+}
+
+/*
+ ** Compare two blocks by address (for qsort)
+ */
+int compare_blocks(const void *a, const void *b)
+{
+    return ((struct block *) a)->start - ((struct block *) b)->start;
+}
+
+/*
+ ** Split the linear runs at block boundaries and sort them by address,
+ ** the array gets the size of the blocks found
+ */
+int split_blocks(struct bank *bank)
+{
+    struct block *runs;
+    int total_runs;
+    int address;
+    int c;
+    
+    runs = bank->blocks;
+    total_runs = bank->total_blocks;
+    bank->total_blocks = 0;
+    for (c = 0; c < total_runs; c++) {
+        for (address = runs[c].start + 1; address < runs[c].end; address++) {
+            if ((C(address) & 3) != 0 && (C(address) & BLOCK))
+                bank->total_blocks++;
+        }
+        bank->total_blocks++;
+    }
+    bank->blocks = calloc(bank->total_blocks + 1, sizeof(struct block));
+    if (bank->blocks == NULL) {
+        bank->blocks = runs;
+        bank->total_blocks = total_runs;
+        return -1;
+    }
+    bank->size_blocks = bank->total_blocks + 1;
+    bank->total_blocks = 0;
+    for (c = 0; c < total_runs; c++) {
+        bank->blocks[bank->total_blocks].start = runs[c].start;
+        bank->blocks[bank->total_blocks].last = runs[c].start;
+        for (address = runs[c].start + 1; address < runs[c].end; address++) {
+            if ((C(address) & 3) == 0)
+                continue;
+            if (C(address) & BLOCK) {
+                bank->blocks[bank->total_blocks++].end = address;
+                bank->blocks[bank->total_blocks].start = address;
+            }
+            bank->blocks[bank->total_blocks].last = address;
+        }
+        bank->blocks[bank->total_blocks++].end = runs[c].end;
+    }
+    free(runs);
+    qsort(bank->blocks, bank->total_blocks, sizeof(struct block), compare_blocks);
+    for (c = 0; c < 4096; c++)
+        bank->block_at[c] = -1;
+    for (c = 0; c < bank->total_blocks; c++)
+        bank->block_at[bank->blocks[c].start & 0x0fff] = c;
+    return 0;
+}
+
+/*
+ ** Flags and registers live at the entry of the block starting at an address
+ */
+int entry_live(struct bank *bank, int address)
+{
+    int c;
+    
+    c = bank->block_at[address & 0x0fff];
+    if (c < 0)
+        return LIVE_ALL;
+    return bank->blocks[c].live_in;
+}
+
+struct block *called(struct bank *bank, int address);
+
+/*
+ ** Backward liveness analysis of the flags and registers over the
+ ** control flow graph, iterated until nothing changes. A call to a
+ ** summarized subroutine passes through what it doesn't write, plus
+ ** what it reads. A return goes back to the return sites of its
+ ** subroutine, or after any call if unknown.
+ */
+void liveness(struct bank *bank)
+{
+    int list[4096];
+    int sites[4096];
+    struct block *b;
+    struct block *callee;
+    struct opcode *op;
+    struct table table;
+    int returns;
+    int changed;
+    int address;
+    int flags;
+    int total;
+    int c;
+    int d;
+    
+    for (c = 0; c < bank->total_blocks; c++)
+        bank->blocks[c].live_in = 0;
+    do {
+        changed = 0;
+        returns = 0;
+        for (c = 0; c < bank->total_blocks; c++)
+            sites[c] = 0;
+        for (c = 0; c < bank->total_blocks; c++) {
+            b = &bank->blocks[c];
+            if (opcodes[R(b->last)].kind != CALL)
+                continue;
+            returns |= entry_live(bank, b->end);
+            if ((callee = called(bank, b->last)) != NULL)
+                sites[callee - bank->blocks] |= entry_live(bank, b->end);
+        }
+        for (c = bank->total_blocks - 1; c >= 0; c--) {
+            b = &bank->blocks[c];
+            op = &opcodes[R(b->last)];
+            switch (bank->switched[b->last & 0x0fff] >= 0 ? UNK : op->kind) {
+                case OP:
+                    flags = entry_live(bank, b->end);
+                    break;
+                case BRANCH:
+                    flags = entry_live(bank, b->end) | entry_live(bank, destination(bank, b->last));
+                    break;
+                case CALL:
+                    callee = called(bank, b->last);
+                    if (callee != NULL)
+                        flags = (entry_live(bank, b->end) & ~callee->writes) | callee->reads;
+                    else
+                        flags = entry_live(bank, b->end) | entry_live(bank, destination(bank, b->last));
+                    break;
+                case JUMP:
+                    flags = entry_live(bank, destination(bank, b->last));
+                    break;
+                case JUMPI:
+                case RETURN:
+                    if (dispatch(bank, b->last, &table)) {    /* Entries of the table */
+                        flags = table.total > 0 ? 0 : LIVE_ALL;
+                        for (d = 0; d < table.total; d++)
+                            flags |= entry_live(bank, jump_entry(bank, &table, d));
+                    } else {
+                        flags = b->owner >= 0 ? sites[b->owner] : returns;
+                    }
+                    break;
+                default:
+                    flags = LIVE_ALL;
+                    break;
+            }
+            b->live_out = flags;
+            total = 0;
+            for (address = b->start; address < b->end; address += lengths[opcodes[R(address)].mode])
+                list[total++] = address;
+            while (total > 0) {
+                address = list[--total];
+                op = &opcodes[R(address)];
+                bank->live[address & 0x0fff] = flags;
+                flags &= ~(op->defs | VAR(op->writes));
+                if (op->kind != BRANCH || bank->fused[address & 0x0fff] < 0)
+                    flags |= op->uses & FALL;
+                flags |= VAR(op->reads) & ~ignored(bank, address);
+            }
+            if (flags != b->live_in) {
+                b->live_in = flags;
+                changed = 1;
+            }
+        }
+    } while (changed) ;
+}
+
+/*
+ ** Successors of a block inside the bank, returns how many. The
+ ** entries of a jump table count as successors of its dispatch.
+ */
+#define SUCCESSORS  (2 + JUMP_ENTRIES)
+
+int successors(struct bank *bank, int c, int *next)
+{
+    struct block *b;
+    struct table table;
+    int address[SUCCESSORS];
+    int total;
+    int kind;
+    int found;
+    int d;
+    
+    b = &bank->blocks[c];
+    kind = bank->switched[b->last & 0x0fff] >= 0 ? UNK : opcodes[R(b->last)].kind;
+    total = 0;
+    if (kind == OP || kind == BRANCH || kind == CALL)
+        address[total++] = b->end;
+    if (kind == BRANCH || kind == JUMP)
+        address[total++] = destination(bank, b->last);
+    if ((kind == JUMPI || kind == RETURN) && jump_table(bank, b->last, &table)) {
+        for (d = 0; d < table.total; d++)
+            address[total++] = jump_entry(bank, &table, d);
+    }
+    found = 0;
+    for (d = 0; d < total; d++) {
+        if (bank->block_at[address[d] & 0x0fff] >= 0)
+            next[found++] = bank->block_at[address[d] & 0x0fff];
+    }
+    return found;
+}
+
+/*
+ ** Call graph. Each JSR inside the bank is an edge from the code
+ ** reached from a subroutine entry to the subroutine called. A leaf
+ ** made of a single block is written at the call site when it is
+ ** small, or a bit larger if the call runs in most frames. A JSR just
+ ** before RTS becomes a jump, the RTS of the subroutine returns for
+ ** both, unless the subroutine doesn't pull what it pushes.
+ */
+#define INLINE_SMALL    4       /* Instructions always inlined */
+#define INLINE_HOT      12      /* Instructions inlined when run in most frames */
+
+#define S_LEAF      0x01        /* Doesn't call anything */
+#define S_BLOCK     0x02        /* A single block ending in RTS */
+#define S_STACK     0x04        /* Uses the stack as data */
+#define S_UNSAFE    0x08        /* Unbalanced stack or goes away */
+
+/*
+ ** Walk the code reached from a subroutine entry, returns its flags.
+ ** The blocks reached are left in the list and marked with the entry.
+ */
+int subroutine(struct bank *bank, int entry, int *mark, int *list, int *blocks, int *size)
+{
+    struct opcode *op;
+    struct block *b;
+    struct table table;
+    int next[SUCCESSORS];
+    int pending;
+    int pushes;
+    int calls;
+    int flags;
+    int address;
+    int c;
+    
+    flags = 0;
+    calls = 0;
+    pushes = 0;
+    *size = 0;
+    mark[entry] = entry;
+    list[0] = entry;
+    pending = 1;
+    for (*blocks = 0; *blocks < pending; ++*blocks) {
+        b = &bank->blocks[list[*blocks]];
+        for (address = b->start; address < b->end; address += lengths[op->mode]) {
+            op = &opcodes[R(address)];
+            (*size)++;
+            if (R(address) == 0x48 || R(address) == 0x08 || R(address) == 0x68 || R(address) == 0x28) {
+                flags |= S_STACK;
+                pushes += (R(address) & 0x20) ? -1 : 1;
+            } else if (R(address) == 0xba || R(address) == 0x9a) {
+                flags |= S_STACK | S_UNSAFE;
+            }
+            if (op->kind == CALL)
+                calls++;
+            if (op->kind == UNK || op->kind == JUMPI || R(address) == 0x40 || bank->switched[address & 0x0fff] >= 0
+            || (op->kind == RETURN && dispatch(bank, address, &table)))
+                flags |= S_UNSAFE;      /* Goes away, or its RTS doesn't return */
+        }
+        for (c = successors(bank, b - bank->blocks, next); c > 0; c--) {
+            if (mark[next[c - 1]] != entry) {
+                mark[next[c - 1]] = entry;
+                list[pending++] = next[c - 1];
+            }
+        }
+    }
+    if (pushes != 0)
+        flags |= S_UNSAFE;
+    if (calls == 0)
+        flags |= S_LEAF;
+    if (R(bank->blocks[entry].last) == 0x60)
+        flags |= S_BLOCK;
+    return flags;
+}
+
+/*
+ ** Build the call graph of each bank and choose how each JSR is
+ ** written
+ */
+void call_graph(struct context *ctx)
+{
+    struct bank *bank;
+    struct block *b;
+    int *mark;
+    int *list;
+    int *flags;
+    int *size;
+    int subroutines;
+    int leaves;
+    int inlined;
+    int tail;
+    int number;
+    int limit;
+    int c;
+    int d;
+    int e;
+    
+    mark = malloc(4096 * 4 * sizeof(int));
+    if (mark == NULL) {
+        ctx->log.failed = 1;
+        return;
+    }
+    list = mark + 4096;
+    flags = list + 4096;
+    size = flags + 4096;
+    subroutines = 0;
+    leaves = 0;
+    inlined = 0;
+    tail = 0;
+    for (number = 0; number < ctx->total_banks; number++) {
+        bank = &ctx->banks[number];
+        for (c = 0; c < bank->total_blocks; c++) {
+            mark[c] = -1;
+            flags[c] = -1;
+        }
+        for (c = 0; c < bank->total_blocks; c++) {
+            b = &bank->blocks[c];
+            if (R(b->last) != 0x20 || bank->switched[b->last & 0x0fff] >= 0)
+                continue;
+            d = bank->block_at[destination(bank, b->last) & 0x0fff];
+            if (d < 0)
+                continue;
+            if (flags[d] < 0) {
+                flags[d] = subroutine(bank, d, mark, list, &e, &size[d]);
+                subroutines++;
+                if (flags[d] & S_LEAF)
+                    leaves++;
+            }
+            limit = ctx->frames > 0 && bank->runs[b->last & 0x0fff] * 2 >= (unsigned) ctx->frames ? INLINE_HOT : INLINE_SMALL;
+            if ((flags[d] & (S_LEAF | S_BLOCK | S_STACK | S_UNSAFE)) == (S_LEAF | S_BLOCK) && size[d] - 1 <= limit) {
+                bank->calls[b->last & 0x0fff] = C_INLINE;
+                inlined++;
+            } else if (R(b->end) == 0x60 && bank->block_at[b->end & 0x0fff] >= 0 && (flags[d] & S_UNSAFE) == 0) {
+                bank->calls[b->last & 0x0fff] = C_TAIL;
+                tail++;
+            }
+        }
+    }
+    free(mark);
+    print(&ctx->log, "Call graph: %d subroutine%s, %d lea%s, %d call%s inlined, %d tail call%s\n",
+          subroutines, subroutines == 1 ? "" : "s", leaves, leaves == 1 ? "f" : "ves",
+          inlined, inlined == 1 ? "" : "s", tail, tail == 1 ? "" : "s");
+}
+
+/*
+ ** Summaries of the subroutines, bottom-up over the call graph. The
+ ** flags and registers always written on the way to RTS are found
+ ** first, then the ones read before being written, growing while a
+ ** summary changes because of the calls. The RTS of a subroutine goes
+ ** back to its callers only, so it gets the flags live at their
+ ** return sites, unless other code reaches it too.
+ */
+
+/*
+ ** Block of the subroutine called by a JSR with a summary, or NULL
+ */
+struct block *called(struct bank *bank, int address)
+{
+    int c;
+    
+    if (R(address) != 0x20 || bank->switched[address & 0x0fff] >= 0)
+        return NULL;
+    c = bank->block_at[destination(bank, address) & 0x0fff];
+    if (c < 0 || bank->blocks[c].reads < 0)
+        return NULL;
+    return &bank->blocks[c];
+}
+
+/*
+ ** Flags and registers written by the instructions of a block
+ */
+int block_writes(struct bank *bank, int c)
+{
+    struct opcode *op;
+    struct block *callee;
+    int address;
+    int flags;
+    
+    flags = 0;
+    for (address = bank->blocks[c].start; address < bank->blocks[c].end; address += lengths[op->mode]) {
+        op = &opcodes[R(address)];
+        flags |= (op->defs | VAR(op->writes)) & LIVE_ALL;
+        if ((callee = called(bank, address)) != NULL)
+            flags |= callee->writes;
+    }
+    return flags;
+}
+
+/*
+ ** Flags and registers live after a block inside a subroutine,
+ ** nothing is live at its RTS
+ */
+int local_out(struct bank *bank, int c, int *in)
+{
+    struct block *b;
+    struct block *callee;
+    int after;
+    int dest;
+    
+    b = &bank->blocks[c];
+    after = bank->block_at[b->end & 0x0fff] >= 0 ? in[bank->block_at[b->end & 0x0fff]] : LIVE_ALL;
+    dest = bank->block_at[destination(bank, b->last) & 0x0fff] >= 0 ? in[bank->block_at[destination(bank, b->last) & 0x0fff]] : LIVE_ALL;
+    switch (bank->switched[b->last & 0x0fff] >= 0 ? UNK : opcodes[R(b->last)].kind) {
+        case OP:
+            return after;
+        case BRANCH:
+            return after | dest;
+        case JUMP:
+            return dest;
+        case CALL:
+            callee = called(bank, b->last);
+            return callee != NULL ? (after & ~callee->writes) | callee->reads : LIVE_ALL;
+        case RETURN:
+            return R(b->last) == 0x60 ? 0 : LIVE_ALL;
+    }
+    return LIVE_ALL;
+}
+
+/*
+ ** Summarize a subroutine, its blocks are in the list. Returns non
+ ** zero if the summary changed.
+ */
+int summary(struct bank *bank, int entry, int *list, int blocks, int *in, int *out)
+{
+    struct block *b;
+    struct opcode *op;
+    int next[SUCCESSORS];
+    int address;
+    int changed;
+    int writes;
+    int reads;
+    int flags;
+    int c;
+    int d;
+    int e;
+    
+    /* Always written, intersecting over the paths */
+    for (e = 0; e < blocks; e++)
+        out[list[e]] = LIVE_ALL;
+    do {
+        changed = 0;
+        for (e = 0; e < blocks; e++)
+            in[list[e]] = list[e] == entry ? 0 : LIVE_ALL;
+        for (e = 0; e < blocks; e++) {
+            for (d = successors(bank, list[e], next); d > 0; d--)
+                in[next[d - 1]] &= out[list[e]];
+        }
+        in[entry] = 0;
+        for (e = 0; e < blocks; e++) {
+            flags = in[list[e]] | block_writes(bank, list[e]);
+            if (flags != out[list[e]]) {
+                out[list[e]] = flags;
+                changed = 1;
+            }
+        }
+    } while (changed) ;
+    writes = LIVE_ALL;
+    for (e = 0; e < blocks; e++) {
+        if (R(bank->blocks[list[e]].last) == 0x60)
+            writes &= out[list[e]];
+    }
+    
+    /* Read before being written, walking backwards */
+    for (e = 0; e < blocks; e++)
+        in[list[e]] = 0;
+    do {
+        changed = 0;
+        for (e = blocks - 1; e >= 0; e--) {
+            c = list[e];
+            b = &bank->blocks[c];
+            flags = local_out(bank, c, in);
+            for (d = 0, address = b->start; address < b->end; address += lengths[opcodes[R(address)].mode])
+                out[d++] = address;
+            while (d > 0) {
+                op = &opcodes[R(out[--d])];
+                flags &= ~(op->defs | VAR(op->writes));
+                if (op->kind != BRANCH || bank->fused[out[d] & 0x0fff] < 0)
+                    flags |= op->uses & FALL;
+                flags |= VAR(op->reads);
+            }
+            if (flags != in[c]) {
+                in[c] = flags;
+                changed = 1;
+            }
+        }
+    } while (changed) ;
+    reads = in[entry] & LIVE_ALL;
+    
+    b = &bank->blocks[entry];
+    changed = b->writes != writes || b->reads != reads;
+    b->writes = writes;
+    b->reads = reads;
+    return changed;
+}
+
+/*
+ ** Values of a, x, y and c known after a block, packed a byte each
+ */
+int block_outputs(struct bank *bank, int c, int known, int *values)
+{
+    struct block *callee;
+    struct opcode *op;
+    int address;
+    int flags;
+    int value;
+    int d;
+    
+    for (address = bank->blocks[c].start; address < bank->blocks[c].end; address += lengths[op->mode]) {
+        op = &opcodes[R(address)];
+        callee = called(bank, address);
+        if (callee != NULL)
+            flags = callee->writes;
+        else if (op->kind == CALL)
+            flags = LIVE_ALL;
+        else
+            flags = op->defs | VAR(op->writes);
+        for (d = 0; d < 4; d++) {
+            if ((flags & outputs_of[d]) == 0)
+                continue;
+            known &= ~outputs_of[d];
+            if (callee != NULL)
+                value = (callee->outputs & outputs_of[d]) ? callee->output[d] : -1;
+            else if (op->mode == IMM && strncmp(op->name, "LD", 2) == 0)
+                value = R(address + 1);
+            else if (R(address) == 0x18 || R(address) == 0x38)
+                value = R(address) == 0x38;
+            else
+                value = -1;
+            if (value >= 0) {
+                known |= outputs_of[d];
+                *values = (*values & ~(0xffu << d * 8)) | ((unsigned) value << d * 8);
+            }
+        }
+    }
+    return known;
+}
+
+/*
+ ** Values of a, x, y and c known in two states, returns the ones
+ ** known with the same value in both
+ */
+int agree(int known, int values, int other, int other_values)
+{
+    int d;
+    
+    known &= other;
+    for (d = 0; d < 4; d++) {
+        if (((values ^ other_values) >> d * 8) & 0xff)
+            known &= ~outputs_of[d];
+    }
+    return known;
+}
+
+/*
+ ** Values of a, x, y and c known at every RTS of a subroutine, the
+ ** blocks not reached yet don't take away anything. Returns non zero
+ ** if they changed.
+ */
+int outputs(struct bank *bank, int entry, int *list, int blocks, int *work)
+{
+    struct block *b;
+    int *in;
+    int *out;
+    int *in_values;
+    int *out_values;
+    int next[SUCCESSORS];
+    int changed;
+    int known;
+    int values;
+    int c;
+    int d;
+    int e;
+    
+    in = work;
+    out = in + 4096;
+    in_values = out + 4096;
+    out_values = in_values + 4096;
+    for (e = 0; e < blocks; e++)
+        out[list[e]] = -1;
+    do {
+        changed = 0;
+        for (e = 0; e < blocks; e++)
+            in[list[e]] = -1;
+        in[entry] = 0;
+        for (e = 0; e < blocks; e++) {
+            c = list[e];
+            if (out[c] < 0)
+                continue;
+            for (d = successors(bank, c, next); d > 0; d--) {
+                if (in[next[d - 1]] < 0) {
+                    in[next[d - 1]] = out[c];
+                    in_values[next[d - 1]] = out_values[c];
+                    continue;
+                }
+                in[next[d - 1]] = agree(in[next[d - 1]], in_values[next[d - 1]], out[c], out_values[c]);
+            }
+        }
+        for (e = 0; e < blocks; e++) {
+            c = list[e];
+            if (in[c] < 0)
+                continue;
+            values = in_values[c];
+            known = block_outputs(bank, c, in[c], &values);
+            if (known != out[c] || agree(known, values, out[c], out_values[c]) != known) {
+                out[c] = known;
+                out_values[c] = values;
+                changed = 1;
+            }
+        }
+    } while (changed) ;
+    known = VA | VX | VY | FC;
+    values = 0;
+    d = 0;
+    for (e = 0; e < blocks; e++) {
+        c = list[e];
+        if (R(bank->blocks[c].last) != 0x60 || out[c] < 0)
+            continue;
+        known = agree(known, d ? values : out_values[c], out[c], out_values[c]);
+        values = out_values[c];
+        d = 1;
+    }
+    if (!d)
+        known = 0;
+    b = &bank->blocks[entry];
+    changed = agree(known, values, b->outputs, b->output[0] | (b->output[1] << 8) | (b->output[2] << 16) | (b->output[3] << 24)) != known
+           || known != b->outputs;
+    b->outputs = known;
+    for (c = 0; c < 4; c++)
+        b->output[c] = values >> c * 8;
+    return changed;
+}
+
+/*
+ ** Summarize the subroutines of a bank, returns how many or -1
+ ** without memory
+ */
+int summarize(struct bank *bank)
+{
+    struct block *b;
+    int *entries;
+    int *mark;
+    int *list;
+    int *in;
+    int *out;
+    int total;
+    int blocks;
+    int size;
+    int flags;
+    int busy;
+    int c;
+    int d;
+    int e;
+    
+    entries = malloc(4096 * 7 * sizeof(int));
+    if (entries == NULL)
+        return -1;
+    mark = entries + 4096;
+    list = mark + 4096;
+    in = list + 4096;
+    out = in + 4096;
+    total = 0;
+    for (c = 0; c < bank->total_blocks; c++) {
+        in[c] = 0;
+        mark[c] = -1;
+        bank->blocks[c].reads = -1;
+        bank->blocks[c].writes = 0;
+        bank->blocks[c].outputs = 0;
+        bank->blocks[c].owner = -1;
+    }
+    for (c = 0; c < bank->total_blocks; c++) {
+        b = &bank->blocks[c];
+        if (R(b->last) != 0x20 || bank->switched[b->last & 0x0fff] >= 0)
+            continue;
+        d = bank->block_at[destination(bank, b->last) & 0x0fff];
+        if (d < 0 || in[d])
+            continue;
+        in[d] = 1;
+        flags = subroutine(bank, d, mark, list, &blocks, &size);
+        for (e = 0; e < blocks; e++) {
+            b = &bank->blocks[list[e]];
+            if (opcodes[R(b->last)].kind == RETURN)
+                b->owner = (b->owner == -1 && (flags & S_UNSAFE) == 0) ? d : -2;
+        }
+        if ((flags & S_UNSAFE) == 0) {
+            entries[total++] = d;
+            bank->blocks[d].reads = 0;
+        }
+    }
+    
+    /* Code reached from outside of the subroutines shares the RTS */
+    for (c = 0; c < bank->total_blocks; c++)
+        in[c] = mark[c] < 0 || (C(bank->blocks[c].start) & DYNAMIC);
+    for (e = 0; e < bank->ctx->total_banks; e++) {
+        for (c = 0; c < bank->ctx->banks[e].total_blocks; c++) {
+            d = bank->ctx->banks[e].blocks[c].last;
+            if (bank->ctx->banks[e].switched[d & 0x0fff] == bank->number
+            && (d = bank->block_at[continuation(&bank->ctx->banks[e], d) & 0x0fff]) >= 0)
+                in[d] = 1;
+        }
+    }
+    blocks = 0;
+    for (c = 0; c < bank->total_blocks; c++) {
+        if (in[c])
+            list[blocks++] = c;
+    }
+    while (blocks > 0) {
+        c = list[--blocks];
+        if (bank->blocks[c].owner >= 0)
+            bank->blocks[c].owner = -2;
+        for (e = successors(bank, c, out); e > 0; e--) {
+            if (!in[out[e - 1]]) {
+                in[out[e - 1]] = 1;
+                list[blocks++] = out[e - 1];
+            }
+        }
+    }
+    
+    /* Until no summary changes */
+    for (c = 0; c < bank->total_blocks; c++)
+        mark[c] = -1;
+    do {
+        busy = 0;
+        for (c = 0; c < total; c++) {
+            subroutine(bank, entries[c], mark, list, &blocks, &size);
+            for (e = 0; e < blocks; e++)
+                mark[list[e]] = -1;
+            busy |= summary(bank, entries[c], list, blocks, in, out);
+        }
+    } while (busy) ;
+    for (d = 0; d <= total; d++) {
+        busy = 0;
+        for (c = 0; c < total; c++) {
+            subroutine(bank, entries[c], mark, list, &blocks, &size);
+            for (e = 0; e < blocks; e++)
+                mark[list[e]] = -1;
+            busy |= outputs(bank, entries[c], list, blocks, in);
+        }
+        if (!busy)
+            break;
+    }
+    free(entries);
+    return total;
+}
+
+/*
+ ** Modes after a block, the modes at each instruction are saved if
+ ** asked
+ */
+int decimal_out(struct bank *bank, int c, int mode, int save)
+{
+    int address;
+    
+    for (address = bank->blocks[c].start; address < bank->blocks[c].end; address += lengths[opcodes[R(address)].mode]) {
+        if (save)
+            bank->decimal[address & 0x0fff] = mode;
+        if (mode == 0)
+            continue;
+        if (R(address) == 0xf8)         /* SED */
+            mode = D_DECIMAL;
+        else if (R(address) == 0xd8)    /* CLD */
+            mode = D_BINARY;
+        else if (R(address) == 0x28)    /* PLP */
+            mode = D_BINARY | D_DECIMAL;
+    }
+    return mode;
+}
+
+/*
+ ** Add modes to the entry of the block starting at an address,
+ ** returns non zero if they grow
+ */
+int decimal_join(struct bank *bank, int address, int mode)
+{
+    int c;
+    
+    c = bank->block_at[address & 0x0fff];
+    if (c < 0 || (bank->blocks[c].decimal | mode) == bank->blocks[c].decimal)
+        return 0;
+    bank->blocks[c].decimal |= mode;
+    return 1;
+}
+
+/*
+ ** Decimal mode at each instruction, followed over the control flow
+ ** graph of all the banks from the reset vector in binary mode, as
+ ** the interpreter starts. A return site gets the modes at the RTS
+ ** of a summarized subroutine, a bank switch passes them to the
+ ** other bank, and the code reached in unknown ways gets the modes
+ ** at the indirect jumps and at the returns that aren't known.
+ */
+void decimal_mode(struct context *ctx)
+{
+    int returns[4096];
+    struct bank *bank;
+    struct block *b;
+    struct block *callee;
+    int changed;
+    int unknown;
+    int number;
+    int mode;
+    int bcd;
+    int c;
+    
+    for (number = 0; number < ctx->total_banks; number++) {
+        for (c = 0; c < ctx->banks[number].total_blocks; c++)
+            ctx->banks[number].blocks[c].decimal = 0;
+    }
+    bank = &ctx->banks[(ctx->scheme == F8 || ctx->scheme == F6 || ctx->scheme == F4) ? ctx->total_banks - 1 : 0];
+    decimal_join(bank, R(0x0ffc) | (R(0x0ffd) << 8), D_BINARY);
+    do {
+        changed = 0;
+        unknown = 0;
+        for (number = 0; number < ctx->total_banks; number++) {
+            bank = &ctx->banks[number];
+            for (c = 0; c < bank->total_blocks; c++) {
+                b = &bank->blocks[c];
+                if (opcodes[R(b->last)].kind == JUMPI || (opcodes[R(b->last)].kind == RETURN && b->owner < 0))
+                    unknown |= decimal_out(bank, c, b->decimal, 0);
+            }
+        }
+        for (number = 0; number < ctx->total_banks; number++) {
+            bank = &ctx->banks[number];
+            for (c = 0; c < bank->total_blocks; c++)
+                returns[c] = 0;
+            for (c = 0; c < bank->total_blocks; c++) {
+                b = &bank->blocks[c];
+                if (R(b->last) == 0x60 && b->owner >= 0)
+                    returns[b->owner] |= decimal_out(bank, c, b->decimal, 0);
+            }
+            for (c = 0; c < bank->total_blocks; c++) {
+                b = &bank->blocks[c];
+                if (C(b->start) & DYNAMIC)
+                    changed |= decimal_join(bank, b->start, unknown);
+                mode = decimal_out(bank, c, b->decimal, 0);
+                if (mode == 0)
+                    continue;
+                if (bank->switched[b->last & 0x0fff] >= 0) {
+                    changed |= decimal_join(&ctx->banks[bank->switched[b->last & 0x0fff]], continuation(bank, b->last), mode);
+                    continue;
+                }
+                switch (opcodes[R(b->last)].kind) {
+                    case OP:
+                        changed |= decimal_join(bank, b->end, mode);
+                        break;
+                    case BRANCH:
+                        changed |= decimal_join(bank, b->end, mode);
+                        changed |= decimal_join(bank, destination(bank, b->last), mode);
+                        break;
+                    case JUMP:
+                        changed |= decimal_join(bank, destination(bank, b->last), mode);
+                        break;
+                    case CALL:
+                        changed |= decimal_join(bank, destination(bank, b->last), mode);
+                        callee = called(bank, b->last);
+                        changed |= decimal_join(bank, b->end, callee != NULL ? returns[callee - bank->blocks] : unknown);
+                        break;
+                }
+            }
+        }
+    } while (changed) ;
+    bcd = 0;
+    for (number = 0; number < ctx->total_banks; number++) {
+        bank = &ctx->banks[number];
+        for (c = 0; c < bank->total_blocks; c++)
+            decimal_out(bank, c, bank->blocks[c].decimal, 1);
+        for (c = 0; c < 4096; c++) {
+            if ((C(c) & 3) == 0 || !arithmetic(R(c)))
+                continue;
+            if (bank->decimal[c] == D_DECIMAL)
+                bcd++;
+            else if (bank->decimal[c] == (D_BINARY | D_DECIMAL))
+                print(&ctx->log, "Decimal mode not known at %s, written in binary\n", label(ctx, number, ADDR(c)));
+        }
+    }
+    print(&ctx->log, "Decimal mode: %d ADC/SBC in BCD\n", bcd);
+}
+
+/*
+ ** Zero page byte accessed directly by an instruction, or -1
+ */
+int direct(struct bank *bank, int address)
+{
+    struct opcode *op;
+    int value;
+    
+    op = &opcodes[R(address)];
+    value = R(address + 1) | R(address + 2) << 8;
+    if (op->mode == ZPG)
+        value &= 0xff;
+    else if (op->mode != ABS)
+        return -1;
+    if ((value & 0x1280) != 0x0080)
+        return -1;
+    return value & 0xff;
+}
+
+/*
+ ** Check for ADC (after CLC) or SBC (after SEC) of an immediate or a
+ ** zero page byte in binary mode
+ */
+int wide_arithmetic(struct bank *bank, int address, int carry)
+{
+    int immediate;
+    
+    immediate = carry == 0x18 ? 0x69 : 0xe9;
+    if (bank->decimal[address & 0x0fff] != D_BINARY)
+        return 0;
+    if (R(address) == immediate)
+        return 1;
+    return (R(address) == immediate - 4 || R(address) == immediate + 4) && direct(bank, address) >= 0;
+}
+
+/*
+ ** Match CLC, LDA lo, ADC, STA lo, LDA hi, ADC, STA hi (CLC can go
+ ** after the first LDA, SBC goes with SEC) over two pairs of bytes,
+ ** with the carry and overflow unused after it. Returns the address
+ ** after the chain, or -1.
+ */
+int add_chain(struct bank *bank, int address)
+{
+    int insns[6];
+    int total;
+    int carry;
+    int at;
+    int c;
+    
+    carry = 0;
+    total = 0;
+    for (at = address; total < 6; at += lengths[opcodes[R(at)].mode]) {
+        if ((C(at) & 3) == 0 || (at != address && (C(at) & BLOCK)))
+            return -1;
+        if ((R(at) == 0x18 || R(at) == 0x38) && carry == 0 && total < 2)
+            carry = R(at);
+        else
+            insns[total++] = at;
+    }
+    if (carry == 0)
+        return -1;
+    for (c = 0; c < 6; c += 3) {
+        if ((R(insns[c]) != 0xa5 && R(insns[c]) != 0xad) || direct(bank, insns[c]) < 0
+        || !wide_arithmetic(bank, insns[c + 1], carry)
+        || (R(insns[c + 2]) != 0x85 && R(insns[c + 2]) != 0x8d) || direct(bank, insns[c + 2]) < 0)
+            return -1;
+    }
+    if (direct(bank, insns[3]) != direct(bank, insns[0]) + 1 || direct(bank, insns[5]) != direct(bank, insns[2]) + 1)
+        return -1;
+    if (opcodes[R(insns[1])].mode == IMM ? R(insns[4]) != R(insns[1])
+    : direct(bank, insns[4]) != direct(bank, insns[1]) + 1)
+        return -1;
+    if (direct(bank, insns[2]) == direct(bank, insns[3]) || direct(bank, insns[2]) == direct(bank, insns[4]))
+        return -1;  /* The low byte stored is read again */
+    if (bank->live[insns[5] & 0x0fff] & (FC | FV))
+        return -1;
+    return at;
+}
+
+/*
+ ** Match INC lo, BNE over INC hi, INC hi, with N and Z unused after
+ ** it and nothing else jumping to INC hi. Returns the address after
+ ** the chain, or -1.
+ */
+int increment_chain(struct bank *bank, int address)
+{
+    int branch;
+    int high;
+    int end;
+    
+    branch = address + lengths[opcodes[R(address)].mode];
+    high = branch + 2;
+    end = high + lengths[opcodes[R(high)].mode];
+    if ((R(address) != 0xe6 && R(address) != 0xee) || direct(bank, address) < 0 || R(branch) != 0xd0
+    || (C(branch) & BLOCK) || (R(high) != 0xe6 && R(high) != 0xee)
+    || direct(bank, high) != direct(bank, address) + 1 || destination(bank, branch) != end
+    || (C(high) & (LABEL | DYNAMIC)) || (C(high) & 3) == 0 || (bank->live[branch & 0x0fff] & (FN | FZ)))
+        return -1;
+    return end;
+}
+
+/*
+ ** Count the copies of an instruction in a row inside a block, up to 8
+ */
+int run_of(struct bank *bank, int address)
+{
+    int length;
+    int total;
+    int at;
+    
+    length = lengths[opcodes[R(address)].mode];
+    at = address;
+    for (total = 0; total < 8 && (C(at) & 3) != 0 && (at == address || (C(at) & BLOCK) == 0)
+         && memcmp(&bank->rom[at & 0x0fff], &bank->rom[address & 0x0fff], length) == 0; total++)
+        at += length;
+    return total;
+}
+
+/*
+ ** Match two or more ASL or LSR of A or of a zero page byte in a row.
+ ** Returns the address after the run, or -1.
+ */
+int shift_chain(struct bank *bank, int address)
+{
+    int total;
+    
+    switch (R(address)) {
+        case 0x0a: case 0x4a:   /* ASL A and LSR A */
+            break;
+        case 0x06: case 0x0e: case 0x46: case 0x4e:
+            if (direct(bank, address) >= 0)
+                break;
+            return -1;
+        default:
+            return -1;
+    }
+    total = run_of(bank, address);
+    if (total < 2)
+        return -1;
+    return address + total * lengths[opcodes[R(address)].mode];
+}
+
+/*
+ ** Match ASL A, STA t, ASL A, CLC, ADC t (one or more ASL each time),
+ ** a multiply by a constant like 10, with the carry and overflow
+ ** unused after it. Returns the address after it, or -1.
+ */
+int scale_chain(struct bank *bank, int address)
+{
+    int first;
+    int second;
+    int store;
+    int end;
+    int at;
+    
+    first = R(address) == 0x0a ? run_of(bank, address) : 0;
+    store = address + first;
+    at = store + lengths[opcodes[R(store)].mode];
+    second = R(at) == 0x0a ? run_of(bank, at) : 0;
+    at += second;
+    if (first == 0 || second == 0 || first + second > 7 || (R(store) != 0x85 && R(store) != 0x8d)
+    || direct(bank, store) < 0 || R(at) != 0x18 || (R(at + 1) != 0x65 && R(at + 1) != 0x6d)
+    || direct(bank, at + 1) != direct(bank, store) || bank->decimal[(at + 1) & 0x0fff] != D_BINARY
+    || (bank->live[(at + 1) & 0x0fff] & (FC | FV)))
+        return -1;
+    end = at + 1 + lengths[opcodes[R(at + 1)].mode];
+    for (at = address; at < end; at += lengths[opcodes[R(at)].mode]) {
+        if ((C(at) & 3) == 0 || (at != address && (C(at) & BLOCK)))
+            return -1;
+    }
+    return end;
+}
+
+/*
+ ** Find the chains written as one operation, for the IntyBASIC output
+ ** and its verifier
+ */
+void chains(struct context *ctx)
+{
+    struct bank *bank;
+    struct block *b;
+    int additions;
+    int increments;
+    int shifts;
+    int address;
+    int end;
+    int c;
+    
+    additions = 0;
+    increments = 0;
+    shifts = 0;
+    for (c = 0; c < ctx->total_banks; c++) {
+        bank = &ctx->banks[c];
+        for (b = bank->blocks; b < bank->blocks + bank->total_blocks; b++) {
+            address = b->start;
+            while (address < b->end) {
+                if (bank->wide[address & 0x0fff] == W_NONE && (end = add_chain(bank, address)) >= 0) {
+                    bank->wide[address & 0x0fff] = W_ADD;
+                    additions++;
+                } else if (bank->wide[address & 0x0fff] == W_NONE && (end = increment_chain(bank, address)) >= 0) {
+                    bank->wide[address & 0x0fff] = W_INC;
+                    increments++;
+                } else if (bank->wide[address & 0x0fff] == W_NONE && (end = scale_chain(bank, address)) >= 0) {
+                    bank->wide[address & 0x0fff] = W_SCALE;
+                    shifts++;
+                } else if (bank->wide[address & 0x0fff] == W_NONE && (end = shift_chain(bank, address)) >= 0) {
+                    bank->wide[address & 0x0fff] = W_SHIFT;
+                    shifts++;
+                } else {
+                    address += lengths[opcodes[R(address)].mode];
+                    continue;
+                }
+                while ((address += lengths[opcodes[R(address)].mode]) < end)
+                    bank->wide[address & 0x0fff] = R(address) == 0xd0 ? W_CARRY : W_INSIDE;
+            }
+        }
+    }
+    print(&ctx->log, "Chains: %d 16-bit ADC/SBC, %d INC/BNE/INC, %d shifts and multiplies\n", additions, increments, shifts);
+}
+
+/*
+ ** A loop of a single block that clears the RAM through an index or
+ ** the stack zeroes the variables it covered once it ends, after the
+ ** branch back
+ */
+void clear_variables(struct bank *bank, struct block *b)
+{
+    struct context *ctx;
+    struct clear *k;
+    char buf[64];
+    char line[80];
+    int d;
+    
+    ctx = bank->ctx;
+    if (opcodes[R(b->last)].kind != BRANCH || destination(bank, b->last) != b->start || ctx->total_insns == 0)
+        return;
+    for (k = ctx->clears; k < ctx->clears + ctx->total_clears; k++) {
+        if (k->number != bank->number || k->mixed || ADDR(k->address) < b->start || ADDR(k->address) >= b->end)
+            continue;
+        for (d = 0; d < 128; d++) {
+            if (k->bytes[d] && ctx->scalar[d]) {
+                memory(bank, buf, 0x80 | d, "0");
+                sprintf(line, "%s = 0", buf);
+                add_stmt(ctx, line);
+                ctx->insns[ctx->total_insns - 1].total++;
+            }
+        }
+    }
+}
+
+/*
+ ** Lower a block into the IR and optimize it. A block only reached
+ ** by returning from a summarized subroutine starts with its outputs
+ ** known, and a subroutine written inline leaves live what is live
+ ** after the call.
+ */
+void lower_block(struct bank *bank, int c)
+{
+    struct block *b;
+    struct block *callee;
+    int address;
+    int live;
+    
+    b = &bank->blocks[c];
+    bank->ctx->total_insns = 0;
+    bank->ctx->total_stmts = 0;
+    bank->ctx->pool.length = 0;
+    address = b->start;
+    do {
+        address = analyze(bank, address);
+    } while (address < b->end) ;
+    if (bank->ctx->target != C6502_CP1610) {
+        clear_variables(bank, b);
+        callee = NULL;
+        if (c > 0 && b[-1].end == b->start && bank->calls[b[-1].last & 0x0fff] != C_TAIL
+        && (C(b->start) & (LABEL | DYNAMIC)) == 0)
+            callee = called(bank, b[-1].last);
+        propagate(bank->ctx, callee != NULL ? callee->outputs : 0, callee != NULL ? callee->output : NULL);
+        live = b->live_out;
+        if (bank->calls[b->last & 0x0fff] == C_INLINE || bank->calls[b->last & 0x0fff] == C_NATIVE)
+            live = entry_live(bank, b->end);
+        eliminate(bank->ctx, live);
+    }
+}
+
+/*
+ ** Cost model. The 6502 cycles of a block are the sum of its
+ ** instructions without branches taken nor pages crossed. The cost
+ ** of the output is an estimate in CP1610 cycles, the IntyBASIC
+ ** statements are priced as the code IntyBASIC generates for them.
+ */
+#define VCS_FRAME       (76 * 262)      /* 6502 cycles per frame */
+#define INTV_FRAME      14934           /* CP1610 cycles per frame */
+#define HOTSPOTS        20              /* Blocks in the report */
+
+/*
+ ** CP1610 instructions with their own cycles, the others go by their
+ ** last letter: register 6, immediate 8, indirect 8, direct 10.
+ */
+static const struct {
+    const char *name;
+    int cycles;
+} cp1610_cycles[] = {
+    {"MVI@", 8},
+    {"MVO@", 9},
+    {"MVI", 10},
+    {"MVO", 11},
+    {"PSHR", 9},
+    {"PULR", 11},
+    {"SWAP", 6},
+    {"SLR", 6},
+    {"SLL", 6},
+    {"B", 9},
+    {"J", 12},
+    {"JSR", 12},
+    {NULL, 0},
+};
+
+/*
+ ** IntyBASIC statements, cycles besides their expressions
+ */
+#define COST_GOTO       9       /* B */
+#define COST_GOSUB      12      /* CALL */
+#define COST_RETURN     11      /* PULR R7 */
+#define COST_IF         15      /* TSTR and branch */
+#define COST_ON         30      /* CMPI, branch, ADDI and MVI@ into R7 */
+#define COST_STORE      11      /* MVO */
+#define COST_INDEXED    17      /* ADDI and MVO@ */
+#define COST_CONSTANT   8       /* MVII */
+#define COST_LOAD       10      /* MVI */
+#define COST_ARRAY      16      /* ADDI and MVI@ */
+#define COST_OPERATOR   6       /* ADDR, ANDR... */
+#define COST_COMPARE    20      /* CMPR, branch and the -1 or 0 */
+#define COST_MULTIPLY   120     /* Call to the multiplication */
+#define COST_DIVIDE     300     /* Call to the division */
+
+/*
+ ** Cost of a CP1610 statement
+ */
+int cp1610_cost(const char *text)
+{
+    char name[8];
+    int length;
+    int c;
+    
+    length = strcspn(text, " \t");
+    if (text[0] == ';' || text[length - 1] == ':' || length >= (int) sizeof(name))
+        return 0;
+    memcpy(name, text, length);
+    name[length] = '\0';
+    for (c = 0; cp1610_cycles[c].name != NULL; c++) {
+        if (strcmp(cp1610_cycles[c].name, name) == 0)
+            return cp1610_cycles[c].cycles;
+    }
+    if (name[0] == 'B')             /* Conditional branch, taken or not */
+        return 8;
+    switch (name[length - 1]) {
+        case 'R': return 6;
+        case 'I':
+        case '@': return 8;
+    }
+    return 10;
+}
+
+void cost_expression(struct parser *ps, int level, int *cost, int *value);
+
+/*
+ ** Cycles of a power of two, -1 for other values
+ */
+int power_of_two(int value)
+{
+    int c;
+    
+    for (c = 0; c < 16; c++) {
+        if (value == 1 << c)
+            return c;
+    }
+    return -1;
+}
+
+/*
+ ** Cost of an IntyBASIC primary expression, the value is set for
+ ** constants and -1 for the others.
+ */
+void cost_primary(struct parser *ps, int *cost, int *value)
+{
+    char *end;
+    int index;
+    
+    *value = -1;
+    while (*ps->p == ' ')
+        ps->p++;
+    if (*ps->p == '(') {
+        ps->p++;
+        cost_expression(ps, 0, cost, value);
+        if (*ps->p != ')')
+            ps->failed = 1;
+        ps->p++;
+    } else if (*ps->p == '$' || isdigit(*ps->p)) {
+        *value = strtol(ps->p + (*ps->p == '$'), &end, *ps->p == '$' ? 16 : 10) & 0xffff;
+        ps->p = end;
+        *cost = COST_CONSTANT;
+    } else if (*ps->p == '#' || isalpha(*ps->p)) {
+        ps->p++;
+        while (isalnum(*ps->p) || *ps->p == '.')
+            ps->p++;
+        *cost = COST_LOAD;
+        if (*ps->p == '(') {    /* Array */
+            ps->p++;
+            cost_expression(ps, 0, cost, &index);
+            if (*ps->p != ')')
+                ps->failed = 1;
+            ps->p++;
+            *cost = index >= 0 ? COST_LOAD : *cost + COST_ARRAY;
+        }
+    } else {
+        ps->failed = 1;
+    }
+}
+
+/*
+ ** Cost of an IntyBASIC expression from a precedence level
+ */
+void cost_expression(struct parser *ps, int level, int *cost, int *value)
+{
+    const char *op;
+    int right;
+    int shifts;
+    int c;
+    
+    if (level == LEVEL_NOT || level == LEVEL_MINUS) {
+        op = operator_at(ps, level);
+        if (op == NULL) {
+            if (level == LEVEL_MINUS)
+                cost_primary(ps, cost, value);
+            else
+                cost_expression(ps, level + 1, cost, value);
+            return;
+        }
+        cost_expression(ps, level, cost, value);
+        *cost += COST_OPERATOR;
+        *value = -1;
+        return;
+    }
+    cost_expression(ps, level + 1, cost, value);
+    while (!ps->failed && (op = operator_at(ps, level)) != NULL) {
+        cost_expression(ps, level + 1, &c, &right);
+        shifts = right >= 0 ? power_of_two(right) : -1;
+        if (right >= 0 && *value < 0)   /* Immediate operand */
+            c = COST_CONSTANT - COST_OPERATOR;
+        if (level == LEVEL_NOT + 1)
+            c += COST_COMPARE;
+        else if (strcmp(op, "*") == 0)
+            c += shifts >= 0 ? shifts * 3 : COST_MULTIPLY;
+        else if (strcmp(op, "/") == 0)
+            c += shifts == 8 ? 14 : shifts >= 0 ? shifts * 3 : COST_DIVIDE;
+        else if (strcmp(op, "%") == 0)
+            c += shifts >= 0 ? COST_OPERATOR : COST_DIVIDE;
+        else
+            c += COST_OPERATOR;
+        *cost += c;
+        if (*value < 0 || right < 0 || !fold(op, *value, right, value))
+            *value = -1;
+    }
+}
+
+/*
+ ** Cost of a piece of IntyBASIC statement, the value is set if it
+ ** is constant and -1 if not.
+ */
+int cost_of(const char *text, int len, int *value)
+{
+    struct parser ps;
+    char copy[256];
+    int cost;
+    
+    if (len >= (int) sizeof(copy))
+        len = sizeof(copy) - 1;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    ps.p = copy;
+    ps.failed = 0;
+    cost = 0;
+    cost_expression(&ps, 0, &cost, value);
+    return ps.failed ? COST_LOAD : cost;
+}
+
+/*
+ ** Cost of an IntyBASIC statement
+ */
+int basic_cost(const char *text)
+{
+    const char *p;
+    int value;
+    int cost;
+    int c;
+    
+    if (text[0] == '\'')
+        return 0;
+    if (memcmp(text, "GOTO ", 5) == 0)
+        return COST_GOTO;
+    if (memcmp(text, "GOSUB ", 6) == 0)
+        return COST_GOSUB;
+    if (strcmp(text, "RETURN") == 0)
+        return COST_RETURN;
+    if (memcmp(text, "POKE ", 5) == 0) {
+        p = strchr(text, ',');
+        return p == NULL ? COST_STORE : cost_of(p + 1, strlen(p + 1), &value) + COST_STORE;
+    }
+    if (memcmp(text, "IF ", 3) == 0) {
+        p = strstr(text, " THEN ");
+        return p == NULL ? COST_IF : cost_of(text + 3, p - text - 3, &value) + COST_IF;
+    }
+    if (memcmp(text, "ON ", 3) == 0) {
+        p = strstr(text, " GOTO ");
+        return p == NULL ? COST_ON : cost_of(text + 3, p - text - 3, &value) + COST_ON;
+    }
+    c = assignment(text);
+    if (c < 0)
+        return 0;
+    cost = cost_of(text + c + 2, strlen(text + c + 2), &value);
+    if (text[c - 2] != ')')     /* Variable */
+        return cost + COST_STORE;
+    p = strchr(text, '(');
+    c = cost_of(p + 1, text + c - 2 - p - 1, &value);
+    return value >= 0 ? cost + COST_STORE : cost + c + COST_INDEXED;
+}
+
+/*
+ ** Cycles of the 6502 block and cost of its statements once lowered
+ */
+void block_cost(struct bank *bank, int c)
+{
+    struct context *ctx;
+    struct block *b;
+    struct stmt *stmt;
+    const char *text;
+    int address;
+    
+    ctx = bank->ctx;
+    b = &bank->blocks[c];
+    b->cycles = 0;
+    for (address = b->start; address < b->end; address += lengths[opcodes[R(address)].mode])
+        b->cycles += cycles[R(address)];
+    b->cost = 0;
+    for (stmt = ctx->stmts; stmt < ctx->stmts + ctx->total_stmts && !ctx->pool.failed; stmt++) {
+        if (!stmt->keep)
+            continue;
+        text = ctx->pool.data + stmt->text;
+        b->cost += ctx->target == C6502_CP1610 ? cp1610_cost(text) : basic_cost(text);
+    }
+}
+
+/*
+ ** Compare blocks for the report, most expensive first
+ */
+int compare_costs(const void *a, const void *b)
+{
+    const double *x = a;
+    const double *y = b;
+    
+    return x[0] < y[0] ? 1 : x[0] > y[0] ? -1 : 0;
+}
+
+/*
+ ** Report the blocks where the output spends more time. Once the ROM
+ ** was traced each block is weighted by its runs per frame, without
+ ** the runs of a subroutine written at the call site.
+ */
+void hotspots(struct context *ctx)
+{
+    struct bank *bank;
+    struct block *b;
+    unsigned *inlined;
+    double *list;
+    double runs;
+    double vcs;
+    double intv;
+    int total;
+    int c;
+    int d;
+    
+    total = 0;
+    for (c = 0; c < ctx->total_banks; c++)
+        total += ctx->banks[c].total_blocks;
+    list = malloc((total + 1) * 3 * sizeof(double));
+    inlined = malloc(4096 * sizeof(unsigned));
+    if (list == NULL || inlined == NULL) {
+        free(list);
+        free(inlined);
+        return;
+    }
+    total = 0;
+    vcs = 0;
+    intv = 0;
+    for (c = 0; c < ctx->total_banks; c++) {
+        bank = &ctx->banks[c];
+        memset(inlined, 0, 4096 * sizeof(unsigned));
+        for (d = 0; d < bank->total_blocks; d++) {
+            b = &bank->blocks[d];
+            if (bank->calls[b->last & 0x0fff] == C_INLINE || bank->calls[b->last & 0x0fff] == C_NATIVE)
+                inlined[destination(bank, b->last) & 0x0fff] += bank->runs[b->last & 0x0fff];
+        }
+        for (d = 0; d < bank->total_blocks; d++) {
+            b = &bank->blocks[d];
+            runs = ctx->frames > 0 ? (double) bank->runs[b->start & 0x0fff] / ctx->frames : 1;
+            vcs += runs * b->cycles;
+            if (ctx->frames > 0)
+                runs -= (double) inlined[b->start & 0x0fff] / ctx->frames;
+            if (runs <= 0)
+                continue;
+            list[total * 3] = runs * b->cost;
+            list[total * 3 + 1] = runs;
+            list[total * 3 + 2] = c * 4096 + d;
+            intv += runs * b->cost;
+            total++;
+        }
+    }
+    qsort(list, total, 3 * sizeof(double), compare_costs);
+    print(&ctx->log, "Hotspots (%s):\n", ctx->frames > 0 ? "cycles per frame" : "cycles of each block");
+    print(&ctx->log, "    Block        6502  Output    Runs   Total     %%\n");
+    for (c = 0; c < total && c < HOTSPOTS; c++) {
+        bank = &ctx->banks[(int) list[c * 3 + 2] / 4096];
+        b = &bank->blocks[(int) list[c * 3 + 2] % 4096];
+        print(&ctx->log, "    %-10s %6d  %6d  %6.1f  %6.0f  %4.1f\n", label(ctx, bank->number, b->start),
+              b->cycles, b->cost, list[c * 3 + 1], list[c * 3], intv > 0 ? list[c * 3] * 100 / intv : 0);
+    }
+    if (ctx->frames > 0) {
+        print(&ctx->log, "The 6502 instructions take %.0f cycles per frame (%.0f%% of the frame), the output about %.0f\n",
+              vcs, vcs * 100 / VCS_FRAME, intv);
+        print(&ctx->log, "The output needs %.1f times the frame of the Intellivision\n", intv / INTV_FRAME);
+    }
+    free(list);
+    free(inlined);
+}
+
+/*
+ ** Natural loops. The dominators of the blocks come from the control
+ ** flow graph of the bank, with the entries hanging from a virtual
+ ** root: the start, the subroutines, the code reached from other
+ ** banks or dynamically, and the blocks without predecessors. An
+ ** edge going to a block that dominates its origin closes a loop.
+ ** The IntyBASIC target writes a loop as a structured one when its
+ ** blocks follow each other in the listing and the last one jumps
+ ** back to the first.
+ */
+
+/*
+ ** Instruction before another inside a block, -1 for the first one
+ */
+int before(struct bank *bank, int c, int address)
+{
+    int previous;
+    int at;
+    
+    previous = -1;
+    for (at = bank->blocks[c].start; at < address; at += lengths[opcodes[R(at)].mode])
+        previous = at;
+    return previous;
+}
+
+/*
+ ** Flags known when a branch closing a loop falls through, the result
+ ** tested is zero for BNE and negative for BPL. Only the flags taken
+ ** from the same result are known.
+ */
+int exit_flags(struct bank *bank, int address, int *set)
+{
+    struct opcode *sop;
+    const char *n;
+    const char *z;
+    int setter;
+    int ln;
+    int lz;
+    int reads;
+    int shared;
+    
+    *set = 0;
+    setter = bank->fused[address & 0x0fff];
+    if (setter < 0)
+        return 0;
+    sop = &opcodes[R(setter)];
+    if (compare(sop) != 0) {
+        if (R(address) != 0xd0)
+            return 0;
+        *set = FZ | FC;
+        return FN | FZ | FC;
+    }
+    n = flag_expression(sop, FN, &ln, &reads);
+    z = flag_expression(sop, FZ, &lz, &reads);
+    shared = n != NULL && z != NULL && ln > 8 && lz > 4 && ln - 8 == lz - 4 && memcmp(n, z, lz - 4) == 0
+             && memcmp(n + ln - 8, " AND $80", 8) == 0 && memcmp(z + lz - 4, " = 0", 4) == 0;
+    if (R(address) == 0xd0) {
+        *set = FZ;
+        return FZ | (shared ? FN : 0);
+    }
+    if (R(address) == 0x10) {
+        *set = FN;
+        return FN | (shared ? FZ : 0);
+    }
+    return 0;
+}
+
+/*
+ ** Check if a loop counts with X or Y loaded just before it. DEX or
+ ** DEY with BNE become FOR r = k TO 1 STEP -1, INX or INY with a CPX
+ ** or CPY immediate and BNE become FOR r = k TO m - 1. The register
+ ** can't change elsewhere in the loop, nor in subroutines not inlined.
+ */
+void counted(struct bank *bank, struct loop *loop, int preheader)
+{
+    struct opcode *op;
+    struct block *b;
+    int address;
+    int at;
+    int setter;
+    int counter;
+    int value;
+    int init;
+    int last;
+    int c;
+    
+    last = bank->blocks[loop->latch].last;
+    setter = bank->fused[last & 0x0fff];
+    if (R(last) != 0xd0 || setter < 0 || loop->setter != setter || preheader < 0)
+        return;
+    if (R(setter) == 0xca || R(setter) == 0x88) {
+        loop->step = setter;
+    } else if ((R(setter) == 0xe0 || R(setter) == 0xc0) && R(setter + 1) > 0) {
+        loop->step = before(bank, loop->latch, setter);
+        if (loop->step < 0 || R(loop->step) != (R(setter) == 0xe0 ? 0xe8 : 0xc8))
+            return;
+    } else {
+        return;
+    }
+    counter = VAR(opcodes[R(loop->step)].writes);
+    if ((loop->hoisted & opcodes[R(setter)].defs) != (bank->live[setter & 0x0fff] & opcodes[R(setter)].defs))
+        return;
+    if (bank->blocks[loop->header].live_in & (opcodes[R(setter)].defs | opcodes[R(loop->step)].defs))
+        return;
+    for (c = loop->header; c <= loop->latch; c++) {
+        for (address = bank->blocks[c].start; address < bank->blocks[c].end; address += lengths[op->mode]) {
+            op = &opcodes[R(address)];
+            if (address == loop->step)
+                continue;
+            if (op->kind == CALL && bank->calls[address & 0x0fff] == C_INLINE) {
+                b = &bank->blocks[bank->block_at[destination(bank, address) & 0x0fff]];
+                for (at = b->start; at < b->last; at += lengths[opcodes[R(at)].mode]) {
+                    if (VAR(opcodes[R(at)].writes) & counter)
+                        return;
+                }
+                continue;
+            }
+            if ((VAR(op->writes) & counter) || op->kind == CALL || bank->switched[address & 0x0fff] >= 0)
+                return;
+        }
+    }
+    init = -1;
+    for (address = bank->blocks[preheader].start; address < bank->blocks[preheader].end; address += lengths[op->mode]) {
+        op = &opcodes[R(address)];
+        if (VAR(op->writes) & counter)
+            init = address;
+        else if (init >= 0 && (VAR(op->reads) & counter))
+            init = -2;
+        if (op->kind == CALL || bank->switched[address & 0x0fff] >= 0)
+            init = -2;
+    }
+    if (init < 0 || R(init) != (counter == VX ? 0xa2 : 0xa0))
+        return;
+    value = R(init + 1);
+    if (loop->step == setter) {
+        if (value == 0)
+            return;
+        loop->limit = 1;
+    } else {
+        if (value >= R(setter + 1))
+            return;
+        loop->limit = R(setter + 1) - 1;
+    }
+    loop->type = L_FOR;
+    loop->counter = counter;
+    loop->first = value;
+    loop->init = init;
+}
+
+/*
+ ** Check if a counted loop is a display kernel: it stores into WSYNC,
+ ** the other registers it writes are dropped by the register map, it
+ ** doesn't write RAM, and nothing else it leaves in the registers or
+ ** flags is used after it. The scanlines are the iterations times
+ ** the WSYNC stores of the body.
+ */
+void kernel(struct bank *bank, struct loop *loop)
+{
+    struct opcode *op;
+    const char *map;
+    int address;
+    int value;
+    int start;
+    int end;
+    int exit;
+    int wsync;
+    int c;
+    
+    start = bank->blocks[loop->header].start;
+    end = bank->blocks[loop->latch].end;
+    exit = entry_live(bank, end);
+    wsync = 0;
+    for (c = loop->header; c <= loop->latch; c++) {
+        for (address = bank->blocks[c].start; address < bank->blocks[c].end; address += lengths[op->mode]) {
+            op = &opcodes[R(address)];
+            if (op->code == NULL || op->kind == CALL || op->kind == JUMPI || op->kind == RETURN
+            || bank->switched[address & 0x0fff] >= 0 || ((op->writes | op->reads) & LS))
+                return;
+            if ((op->kind == BRANCH || op->kind == JUMP)
+            && (destination(bank, address) < start || destination(bank, address) >= end))
+                return;
+            if (address != loop->step && address != loop->setter
+            && ((VAR(op->writes) & exit & ~loop->counter) || (op->defs & exit & ~opcodes[R(loop->setter)].defs)))
+                return;
+            if ((op->writes & LM) == 0)
+                continue;
+            value = R(address + 1) | R(address + 2) << 8;
+            if (op->mode == ZPG)
+                value &= 0xff;
+            if (strncmp(op->name, "ST", 2) != 0 || (op->mode != ZPG && op->mode != ABS)
+            || (value = hardware_register(value, H_WRITE)) < 0 || value >= 0x40)
+                return;
+            map = bank->ctx->registers[H_WRITE][value].basic;
+            if (value == 0x02)
+                wsync++;
+            else if (map == NULL || map[0] != '\0')
+                return;
+        }
+    }
+    if (wsync == 0)
+        return;
+    loop->type = L_KERNEL;
+    loop->lines = (loop->first > loop->limit ? loop->first - loop->limit : loop->limit - loop->first) + 1;
+    loop->lines *= wsync;
+}
+
+/*
+ ** Check if a loop waits for the RIOT timer: a single block loading
+ ** INTIM until it is zero (LDA, LDX or LDY with BNE), or testing
+ ** TIMINT until it expires (BIT with BPL, Z and V can't be used
+ ** after it).
+ */
+void poll(struct bank *bank, struct loop *loop)
+{
+    struct opcode *op;
+    int address;
+    int last;
+    int exit;
+    int c;
+    
+    address = bank->blocks[loop->header].start;
+    last = bank->blocks[loop->latch].last;
+    if (loop->header != loop->latch || before(bank, loop->header, last) != address)
+        return;
+    op = &opcodes[R(address)];
+    if (op->mode != ABS)
+        return;
+    c = hardware_register(R(address + 1) | R(address + 2) << 8, H_READ);
+    exit = entry_live(bank, bank->blocks[loop->latch].end);
+    if (R(last) == 0xd0 && strncmp(op->name, "LD", 2) == 0 && c == 0x44)
+        loop->type = L_POLL;
+    else if (R(last) == 0x10 && strcmp(op->name, "BIT") == 0 && c == 0x45 && (exit & (FZ | FV)) == 0)
+        loop->type = L_POLL;
+}
+
+/*
+ ** Find the loops of a bank that can be structured, the listing
+ ** starts at an address. Returns -1 when there is no memory.
+ */
+int find_loops(struct bank *bank, int start)
+{
+    struct loop *loop;
+    struct block *b;
+    int *work;
+    int *from;
+    int *to;
+    int *succ_first;
+    int *succs;
+    int *pred_first;
+    int *preds;
+    int *number;
+    int *order;
+    int *idom;
+    int *stack;
+    int *body;
+    int next[SUCCESSORS];
+    int total;
+    int edges;
+    int room;
+    int root;
+    int post;
+    int depth;
+    int latch;
+    int count;
+    int changed;
+    int last;
+    int set;
+    int c;
+    int d;
+    int e;
+    int f;
+    
+    bank->total_loops = 0;
+    total = bank->total_blocks;
+    root = total;
+    room = total + 1;       /* Edges, one from the root for each block at most */
+    for (c = 0; c < total; c++)
+        room += successors(bank, c, next);
+    work = malloc((room * 4 + (total + 2) * 7) * sizeof(int));
+    bank->loops = malloc((total + 1) * sizeof(struct loop));
+    if (work == NULL || bank->loops == NULL) {
+        free(work);
+        return -1;
+    }
+    from = work;
+    to = from + room;
+    succ_first = to + room;
+    succs = succ_first + (total + 1) + 1;
+    pred_first = succs + room;
+    preds = pred_first + (total + 1) + 1;
+    number = preds + room;
+    order = number + (total + 1);
+    idom = order + (total + 1);
+    stack = idom + (total + 1);
+    body = stack + (total + 1);
+    
+    /* Edges, with the entries coming from the root */
+    edges = 0;
+    for (c = 0; c < total; c++)
+        body[c] = 0;
+    for (c = 0; c < total; c++) {
+        d = successors(bank, c, next);
+        for (e = 0; e < d; e++) {
+            from[edges] = c;
+            to[edges++] = next[e];
+            body[next[e]]++;
+        }
+    }
+    for (c = 0; c < total; c++) {
+        b = &bank->blocks[c];
+        if (opcodes[R(b->last)].kind == CALL && bank->switched[b->last & 0x0fff] < 0
+        && (d = bank->block_at[destination(bank, b->last) & 0x0fff]) >= 0)
+            body[d] = -1;
+    }
+    for (f = 0; f < bank->ctx->total_banks; f++) {
+        for (c = 0; c < bank->ctx->banks[f].total_blocks; c++) {
+            last = bank->ctx->banks[f].blocks[c].last;
+            if (bank->ctx->banks[f].switched[last & 0x0fff] == bank->number
+            && (d = bank->block_at[continuation(&bank->ctx->banks[f], last) & 0x0fff]) >= 0)
+                body[d] = -1;
+        }
+    }
+    for (c = 0; c < total; c++) {
+        if (body[c] <= 0 || (C(bank->blocks[c].start) & DYNAMIC) || bank->blocks[c].start == start) {
+            from[edges] = root;
+            to[edges++] = c;
+        }
+    }
+    
+    /* Both directions */
+    for (c = 0; c <= total + 1; c++) {
+        succ_first[c] = 0;
+        pred_first[c] = 0;
+    }
+    for (e = 0; e < edges; e++) {
+        succ_first[from[e] + 1]++;
+        pred_first[to[e] + 1]++;
+    }
+    for (c = 0; c <= total; c++) {
+        succ_first[c + 1] += succ_first[c];
+        pred_first[c + 1] += pred_first[c];
+    }
+    for (c = 0; c <= total; c++) {
+        number[c] = succ_first[c];
+        order[c] = pred_first[c];
+    }
+    for (e = 0; e < edges; e++) {
+        succs[number[from[e]]++] = to[e];
+        preds[order[to[e]]++] = from[e];
+    }
+    
+    /* Postorder from the root, stack holds the next successor to visit */
+    for (c = 0; c <= total; c++)
+        number[c] = -1;
+    post = 0;
+    depth = 0;
+    body[depth] = root;
+    stack[depth++] = succ_first[root];
+    number[root] = -2;
+    while (depth > 0) {
+        c = body[depth - 1];
+        if (stack[depth - 1] < succ_first[c + 1]) {
+            d = succs[stack[depth - 1]++];
+            if (number[d] == -1) {
+                number[d] = -2;
+                body[depth] = d;
+                stack[depth++] = succ_first[d];
+            }
+        } else {
+            number[c] = post;
+            order[post++] = c;
+            depth--;
+        }
+    }
+    
+    /* Immediate dominators, iterated in reverse postorder */
+    for (c = 0; c <= total; c++)
+        idom[c] = -1;
+    idom[root] = root;
+    do {
+        changed = 0;
+        for (c = post - 2; c >= 0; c--) {
+            d = -1;
+            for (e = pred_first[order[c]]; e < pred_first[order[c] + 1]; e++) {
+                f = preds[e];
+                if (idom[f] < 0)
+                    continue;
+                if (d < 0) {
+                    d = f;
+                    continue;
+                }
+                while (f != d) {
+                    while (number[f] < number[d])
+                        f = idom[f];
+                    while (number[d] < number[f])
+                        d = idom[d];
+                }
+            }
+            if (idom[order[c]] != d) {
+                idom[order[c]] = d;
+                changed = 1;
+            }
+        }
+    } while (changed) ;
+    
+    /* Loops, the body is found walking back from each latch */
+    for (c = 0; c < total; c++)
+        body[c] = -1;
+    for (c = 0; c < total; c++) {
+        if (number[c] < 0)
+            continue;
+        latch = -1;
+        count = 0;
+        depth = 0;
+        for (e = pred_first[c]; e < pred_first[c + 1]; e++) {
+            d = preds[e];
+            if (d == root || number[d] < 0)
+                continue;
+            for (f = d; f != c && f != root; f = idom[f]) ;
+            if (f != c)
+                continue;
+            if (d > latch)
+                latch = d;
+            if (body[d] != c) {
+                body[d] = c;
+                stack[depth++] = d;
+                count++;
+            }
+        }
+        if (latch < 0)
+            continue;
+        if (body[c] != c) {
+            body[c] = c;
+            count++;
+        }
+        while (depth > 0) {
+            d = stack[--depth];
+            if (d == c)
+                continue;
+            for (e = pred_first[d]; e < pred_first[d + 1]; e++) {
+                f = preds[e];
+                if (f == root || body[f] == c)
+                    continue;
+                body[f] = c;
+                stack[depth++] = f;
+                count++;
+            }
+        }
+        
+        /* Contiguous, closed by a branch or a jump, in listing order */
+        if (count != latch - c + 1)
+            continue;
+        for (d = c; d < latch; d++) {
+            if (body[d] != c || bank->blocks[d].end != bank->blocks[d + 1].start)
+                break;
+        }
+        last = bank->blocks[latch].last;
+        if (d < latch || bank->switched[last & 0x0fff] >= 0
+        || (opcodes[R(last)].kind != BRANCH && R(last) != 0x4c)
+        || destination(bank, last) != bank->blocks[c].start
+        || ((bank->blocks[c].start - start) & 0x0fff) > ((bank->blocks[latch].start - start) & 0x0fff))
+            continue;
+        for (loop = bank->loops; loop < bank->loops + bank->total_loops; loop++) {
+            if (loop->latch == latch || (loop->latch >= c && loop->latch < latch))
+                break;
+        }
+        if (loop < bank->loops + bank->total_loops)
+            continue;
+        loop = &bank->loops[bank->total_loops++];
+        loop->header = c;
+        loop->latch = latch;
+        loop->type = L_DO;
+        loop->step = -1;
+        loop->init = -1;
+        
+        /* Flags of the test at the end computed once at the exit */
+        loop->setter = -1;
+        loop->hoisted = 0;
+        loop->set = 0;
+        if (opcodes[R(last)].kind == BRANCH && (f = bank->fused[last & 0x0fff]) >= 0
+        && before(bank, latch, last) == f) {
+            e = exit_flags(bank, last, &set) & bank->live[f & 0x0fff] & ~bank->blocks[c].live_in;
+            if (compare(&opcodes[R(f)]) != 0 && e != (bank->live[f & 0x0fff] & opcodes[R(f)].defs))
+                e = 0;
+            loop->setter = f;
+            loop->hoisted = e;
+            loop->set = set & e;
+        }
+        
+        /* Only the loop and the block before can go into the header */
+        d = c - 1;
+        if (d < 0 || bank->blocks[d].end != bank->blocks[c].start
+        || ((bank->blocks[d].start - start) & 0x0fff) > ((bank->blocks[c].start - start) & 0x0fff))
+            d = -1;
+        for (e = pred_first[c]; e < pred_first[c + 1]; e++) {
+            if (preds[e] != d && preds[e] != latch)
+                d = -1;
+        }
+        if (pred_first[c + 1] - pred_first[c] != 2)
+            d = -1;
+        counted(bank, loop, d);
+        if (loop->type == L_FOR)
+            kernel(bank, loop);
+        else
+            poll(bank, loop);
+    }
+    free(work);
+    return 0;
+}
+
+/*
+ ** Structure the statements of a block lowered for IntyBASIC. The
+ ** header of a loop starts it, the latch ends it with the test of
+ ** its branch, and the counter of FOR isn't loaded before.
+ */
+void structure(struct bank *bank, int c)
+{
+    struct context *ctx;
+    struct loop *loop;
+    struct insn *insn;
+    struct stmt *stmt;
+    char line[256];
+    char first[16];
+    char limit[16];
+    const char *text;
+    const char *then;
+    
+    ctx = bank->ctx;
+    if (ctx->pool.failed)
+        return;
+    for (loop = bank->loops; loop < bank->loops + bank->total_loops; loop++) {
+        if (loop->type != L_DO && loop->header == c + 1) {
+            for (insn = ctx->insns; insn < ctx->insns + ctx->total_insns; insn++) {
+                for (stmt = ctx->stmts + insn->first; stmt < ctx->stmts + insn->first + insn->total; stmt++) {
+                    if (insn->address == loop->init && stmt->target == loop->counter)
+                        stmt->keep = 0;
+                }
+            }
+        }
+        if (loop->header == c) {
+            number(first, loop->first);
+            number(limit, loop->limit);
+            if (loop->type == L_DO)
+                print(OUTPUT, "\tDO\n");
+            else
+                print(OUTPUT, "\tFOR %s = %s TO %s%s\n", variable_name(loop->counter), first, limit,
+                      loop->step == loop->setter ? " STEP -1" : "");
+        }
+    }
+    for (loop = bank->loops; loop < bank->loops + bank->total_loops; loop++) {
+        if (loop->latch == c)
+            break;
+    }
+    if (loop == bank->loops + bank->total_loops)
+        return;
+    for (insn = ctx->insns; insn < ctx->insns + ctx->total_insns - 1; insn++) {
+        for (stmt = ctx->stmts + insn->first; stmt < ctx->stmts + insn->first + insn->total; stmt++) {
+            if (loop->type == L_FOR && (insn->address == loop->step || insn->address == loop->setter))
+                stmt->keep = 0;
+            else if (insn->address == loop->setter && (stmt->target & loop->hoisted))
+                stmt->keep = 0;
+            else if (insn->address == loop->setter && stmt->target == VT && compare(&opcodes[R(loop->setter)]) != 0
+                     && loop->hoisted == (bank->live[loop->setter & 0x0fff] & opcodes[R(loop->setter)].defs))
+                stmt->keep = 0;
+        }
+    }
+    insn = &ctx->insns[ctx->total_insns - 1];
+    for (stmt = ctx->stmts + insn->first; stmt < ctx->stmts + insn->first + insn->total; stmt++) {
+        if (stmt->keep)
+            break;
+    }
+    text = stmt < ctx->stmts + insn->first + insn->total ? ctx->pool.data + stmt->text : "";
+    if (loop->type == L_FOR) {
+        sprintf(line, "NEXT %s", variable_name(loop->counter));
+    } else if (memcmp(text, "IF ", 3) == 0) {
+        then = strstr(text, " THEN ");
+        sprintf(line, "LOOP WHILE %.*s", (int) (then - text - 3), text + 3);
+    } else if (memcmp(text, "GOTO ", 5) == 0) {
+        strcpy(line, "LOOP");
+    } else {
+        strcpy(line, "LOOP WHILE 0");
+    }
+    if (*text) {
+        replace(ctx, stmt, line);
+    } else {
+        add_stmt(ctx, line);
+        insn->total++;
+    }
+    if (loop->hoisted & FN) {
+        add_stmt(ctx, (loop->set & FN) ? "n = $80" : "n = 0");
+        insn->total++;
+    }
+    if (loop->hoisted & FZ) {
+        add_stmt(ctx, (loop->set & FZ) ? "z = 1" : "z = 0");
+        insn->total++;
+    }
+    if (loop->hoisted & FC) {
+        add_stmt(ctx, (loop->set & FC) ? "c = 1" : "c = 0");
+        insn->total++;
+    }
+}
+
+#define SCALARS     64      /* Zero page addresses promoted at most */
+
+/*
+ ** Promote the zero page addresses only accessed directly to IntyBASIC
+ ** variables, zp($80) becomes zp80, the ones run most first. The
+ ** interpreter marks the bytes read through an index, a pointer or
+ ** the stack, or written there with something else than zero, these
+ ** stay in zp() as the arrays they are, and so do the bases of the
+ ** indexed accesses it didn't run. Clearing the RAM doesn't count, the
+ ** loop zeroes the variables when it ends. Without a trace nothing is
+ ** known about them and nothing is promoted.
+ */
+void scalars(struct context *ctx)
+{
+    struct bank *bank;
+    struct block *b;
+    struct opcode *op;
+    unsigned heat[128];
+    byte excluded[128];
+    int promoted;
+    int address;
+    int value;
+    int best;
+    int c;
+    int d;
+    
+    if (ctx->frames == 0)
+        return;
+    memset(heat, 0, sizeof(heat));
+    for (d = 0; d < 128; d++)
+        excluded[d] = ctx->indexed[d] | ctx->scattered[d];
+    for (c = 0; c < ctx->total_banks; c++) {
+        bank = &ctx->banks[c];
+        for (b = bank->blocks; b < bank->blocks + bank->total_blocks; b++) {
+            for (address = b->start; address < b->end; address += lengths[op->mode]) {
+                op = &opcodes[R(address)];
+                value = R(address + 1) | R(address + 2) << 8;
+                if (op->mode == ZPG || op->mode == ZPX || op->mode == ZPY || op->mode == IZX || op->mode == IZY)
+                    value &= 0xff;
+                if ((value & 0x1280) != 0x0080 || lengths[op->mode] == 1 || op->mode == IMM || op->mode == REL)
+                    continue;
+                if (op->mode == ZPG || op->mode == ABS || op->mode == IZY) {
+                    heat[value & 0x7f] += bank->runs[address & 0x0fff] + 1;
+                } else if (op->mode == IND) {       /* Pointer of JMP () */
+                    excluded[value & 0x7f] = 1;
+                    excluded[(value + 1) & 0x7f] = 1;
+                } else if (bank->runs[address & 0x0fff] == 0) {
+                    excluded[value & 0x7f] = 1;
+                }
+            }
+        }
+    }
+    for (promoted = 0; promoted < SCALARS; promoted++) {
+        best = -1;
+        for (d = 0; d < 128; d++) {
+            if (heat[d] != 0 && !excluded[d] && (best < 0 || heat[d] > heat[best]))
+                best = d;
+        }
+        if (best < 0)
+            break;
+        ctx->scalar[best] = 1;
+        heat[best] = 0;
+    }
+    print(&ctx->log, "Promoted %d zero page addresses to variables\n", promoted);
+}
+
+/*
+ ** Add a value written into a pointer or one of its bytes, -1 if it
+ ** isn't known
+ */
+void pointer_value(int *count, int *values, int value)
+{
+    int c;
+    
+    if (*count < 0)
+        return;
+    for (c = 0; c < *count && values[c] != value; c++)
+        ;
+    if (value < 0 || (c == *count && c == POINTER_TARGETS))
+        *count = -1;
+    else if (c == *count)
+        values[(*count)++] = value;
+}
+
+/*
+ ** Find where the pointers of (zp),Y can point. Each byte of a pointer
+ ** must be written directly with constants, loaded earlier in the same
+ ** block, and the pages the interpreter saw through the pointer must
+ ** be among them. Zeroes written by index are the RAM being cleared
+ ** and don't count. The pointers into the ROM get labels on their
+ ** tables, or on their pages when the low byte is computed. Without a
+ ** trace nothing is known and the full address is read.
+ */
+void pointers(struct context *ctx)
+{
+    struct bank *bank;
+    struct block *b;
+    struct opcode *op;
+    struct pointer *p;
+    int values[128][POINTER_TARGETS];
+    int counts[128];
+    int pairs[128][POINTER_TARGETS];
+    int paired[128];
+    int written[128];
+    int kinds[4];
+    byte used[128];
+    int known[3];
+    int address;
+    int value;
+    int reg;
+    int pass;
+    int c;
+    int d;
+    int e;
+    
+    if (ctx->frames == 0)
+        return;
+    for (d = 0; d < 128; d++) {
+        counts[d] = ctx->scattered[d] ? -1 : 0;
+        paired[d] = 0;
+    }
+    for (c = 0; c < ctx->total_banks; c++) {
+        bank = &ctx->banks[c];
+        for (b = bank->blocks; b < bank->blocks + bank->total_blocks; b++) {
+            known[0] = known[1] = known[2] = -1;
+            for (d = 0; d < 128; d++)
+                written[d] = -2;
+            for (address = b->start; address < b->end; address += lengths[op->mode]) {
+                op = &opcodes[R(address)];
+                value = R(address + 1) | R(address + 2) << 8;
+                if (op->mode == ZPG || op->mode == ZPX || op->mode == ZPY || op->mode == IMM)
+                    value &= 0xff;
+                if ((op->writes & LM) && (value & 0x1280) == 0x0080 && (op->mode == ZPG || op->mode == ABS)) {
+                    reg = (R(address) & 0xf7) == 0x85 ? 0 : (R(address) & 0xf7) == 0x86 ? 1
+                        : (R(address) & 0xf7) == 0x84 ? 2 : -1;
+                    pointer_value(&counts[value & 0x7f], values[value & 0x7f], reg >= 0 ? known[reg] : -1);
+                    written[value & 0x7f] = written[value & 0x7f] == -2 && reg >= 0 ? known[reg] : -1;
+                } else if ((op->writes & LM) && (value & 0x1280) == 0x0080 && lengths[op->mode] > 1
+                && op->mode != IZX && op->mode != IZY && bank->runs[address & 0x0fff] == 0) {
+                    counts[value & 0x7f] = -1;      /* Indexed store never run */
+                }
+                switch (R(address)) {
+                    case 0xa9: known[0] = value; break;     /* LDA # */
+                    case 0xa2: known[1] = value; break;     /* LDX # */
+                    case 0xa0: known[2] = value; break;     /* LDY # */
+                    case 0xaa: known[1] = known[0]; break;  /* TAX */
+                    case 0xa8: known[2] = known[0]; break;  /* TAY */
+                    case 0x8a: known[0] = known[1]; break;  /* TXA */
+                    case 0x98: known[0] = known[2]; break;  /* TYA */
+                    default:
+                        if ((op->writes & LA) || op->kind == CALL)
+                            known[0] = -1;
+                        if ((op->writes & LX) || op->kind == CALL)
+                            known[1] = -1;
+                        if ((op->writes & LY) || op->kind == CALL)
+                            known[2] = -1;
+                        break;
+                }
+            }
+            for (d = 0; d < 127; d++) {     /* Both bytes written together */
+                if (written[d] != -2 || written[d + 1] != -2)
+                    pointer_value(&paired[d], pairs[d], written[d] >= 0 && written[d + 1] >= 0 ? written[d + 1] << 8 | written[d] : -1);
+            }
+        }
+    }
+    for (d = 0; d < 127; d++) {
+        p = &ctx->pointers[d];
+        p->kind = P_UNKNOWN;
+        p->total = 0;
+        if (counts[d + 1] <= 0)
+            continue;
+        for (c = 0; c < 256; c++) {     /* Pages seen must be expected */
+            for (e = 0; e < counts[d + 1] && values[d + 1][e] != c; e++)
+                ;
+            if ((ctx->pages[d][c >> 3] & (1 << (c & 7))) && e == counts[d + 1])
+                break;
+        }
+        for (e = 0; e < counts[d + 1] && values[d + 1][e] == 0; e++)
+            ;
+        if (c < 256)
+            continue;
+        if (e == counts[d + 1]) {
+            p->kind = P_RAM;
+            continue;
+        }
+        for (e = 0; e < counts[d + 1] && (values[d + 1][e] & 0x10); e++)
+            ;
+        if (e < counts[d + 1])      /* Not only ROM */
+            continue;
+        if (paired[d] > 0) {
+            p->kind = P_TABLES;
+            p->total = paired[d];
+            memcpy(p->targets, pairs[d], sizeof(p->targets));
+        } else if (counts[d] > 0 && counts[d] * counts[d + 1] <= POINTER_TARGETS) {
+            p->kind = P_TABLES;
+            for (e = 0; e < counts[d + 1]; e++) {
+                for (c = 0; c < counts[d]; c++)
+                    p->targets[p->total++] = values[d + 1][e] << 8 | values[d][c];
+            }
+        } else {
+            p->kind = P_PAGES;
+            for (e = 0; e < counts[d + 1]; e++)
+                p->targets[p->total++] = values[d + 1][e] << 8;
+        }
+    }
+    
+    /* The targets must be data in every bank using them, then get labels */
+    memset(used, 0, sizeof(used));
+    for (pass = 0; pass < 2; pass++) {
+        for (c = 0; c < ctx->total_banks; c++) {
+            bank = &ctx->banks[c];
+            for (b = bank->blocks; b < bank->blocks + bank->total_blocks; b++) {
+                for (address = b->start; address < b->end; address += lengths[op->mode]) {
+                    op = &opcodes[R(address)];
+                    if (op->mode != IZY)
+                        continue;
+                    used[R(address + 1) & 0x7f] |= (R(address + 1) & 0x80) != 0;
+                    if ((p = pointer_of(ctx, R(address + 1))) == NULL || p->kind == P_RAM)
+                        continue;
+                    for (e = 0; e < p->total; e++) {
+                        if (pass == 0 && (C(p->targets[e]) & 3) != 0)
+                            p->kind = P_UNKNOWN;
+                        else if (pass == 1)
+                            C(p->targets[e]) |= LABEL;
+                    }
+                }
+            }
+        }
+    }
+    memset(kinds, 0, sizeof(kinds));
+    for (d = 0; d < 128; d++) {
+        if (used[d])
+            kinds[ctx->pointers[d].kind]++;
+    }
+    print(&ctx->log, "Pointers: %d to RAM, %d to ROM tables, %d to ROM pages, %d unknown\n",
+          kinds[P_RAM], kinds[P_TABLES], kinds[P_PAGES], kinds[P_UNKNOWN]);
+}
+
+/*
+ ** Choose the RIOT timer wait written as WAIT, the one the interpreter
+ ** ran the most. A VCS frame usually waits twice, at the end of the
+ ** vertical blank and of the overscan, and the Intellivision must
+ ** wait once. Returns -1 when there is no memory.
+ */
+int frame_wait(struct context *ctx, int first, int start)
+{
+    struct bank *bank;
+    struct loop *loop;
+    unsigned most;
+    int address;
+    int c;
+    
+    ctx->wait_address = -1;
+    most = 0;
+    for (c = 0; c < ctx->total_banks; c++) {
+        bank = &ctx->banks[c];
+        if (find_loops(bank, c == first ? start : bank->origin))
+            return -1;
+        for (loop = bank->loops; loop < bank->loops + bank->total_loops; loop++) {
+            address = bank->blocks[loop->header].start;
+            if (loop->type == L_POLL && (ctx->wait_address < 0 || bank->runs[address & 0x0fff] > most)) {
+                ctx->wait_bank = c;
+                ctx->wait_address = address;
+                most = bank->runs[address & 0x0fff];
+            }
+        }
+        free(bank->loops);
+        bank->loops = NULL;
+        bank->total_loops = 0;
+    }
+    return 0;
+}
+
+/*
+ ** Write a loop collapsed into the values it leaves. The frame wait
+ ** goes into the RIOT timer wait chosen, or when there is none into
+ ** the display kernels that draw most of the screen (shorter bands
+ ** would wait more than once per frame). The CP1610 output only
+ ** collapses the RIOT timer waits, calling FRAME_WAIT.
+ */
+void collapse(struct bank *bank, struct loop *loop)
+{
+    static const char *registers[] = {"R0", "R1", "R2"};
+    char value[16];
+    int exit;
+    int last;
+    
+    exit = entry_live(bank, bank->blocks[loop->latch].end);
+    if (bank->ctx->target == C6502_CP1610) {
+        print(OUTPUT, "\t; Wait for the RIOT timer\n");
+        if (bank->ctx->wait_bank == bank->number && bank->ctx->wait_address == bank->blocks[loop->header].start)
+            print(OUTPUT, "\tCALL FRAME_WAIT\n");
+        last = bank->blocks[loop->latch].start;
+        if (R(last) == 0x2c) {
+            if (exit & FN)
+                print(OUTPUT, "\tMVII #$80, R5\n\tMVO R5, VAR_N\n");
+            return;
+        }
+        if (exit & VAR(opcodes[R(last)].writes))
+            print(OUTPUT, "\tCLRR %s\n", registers[strchr("AXY", opcodes[R(last)].name[2]) - "AXY"]);
+        if (exit & (FN | FZ))
+            print(OUTPUT, "\tCLRR R5\n");
+        if (exit & FN)
+            print(OUTPUT, "\tMVO R5, VAR_N\n");
+        if (exit & FZ)
+            print(OUTPUT, "\tMVO R5, VAR_Z\n");
+        return;
+    }
+    if (loop->type == L_POLL) {
+        print(OUTPUT, "\t' Wait for the RIOT timer\n");
+        if (bank->ctx->wait_bank == bank->number && bank->ctx->wait_address == bank->blocks[loop->header].start)
+            print(OUTPUT, "\tWAIT\n");
+        last = bank->blocks[loop->latch].start;
+        if (R(last) == 0x2c) {
+            if (exit & FN)
+                print(OUTPUT, "\tn = $80\n");
+            return;
+        }
+        if (exit & VAR(opcodes[R(last)].writes))
+            print(OUTPUT, "\t%s = 0\n", variable_name(VAR(opcodes[R(last)].writes)));
+        if (exit & FN)
+            print(OUTPUT, "\tn = 0\n");
+        if (exit & FZ)
+            print(OUTPUT, "\tz = 1\n");
+        return;
+    }
+    last = R(loop->setter + 1) & 0xff;
+    print(OUTPUT, "\t' Display kernel of %d lines\n", loop->lines);
+    if (exit & loop->counter) {
+        number(value, loop->step == loop->setter ? 0 : last);
+        print(OUTPUT, "\t%s = %s\n", variable_name(loop->counter), value);
+    }
+    if (loop->lines >= 96 && bank->ctx->wait_address < 0)
+        print(OUTPUT, "\tWAIT\n");
+    if (loop->hoisted & FN)
+        print(OUTPUT, "\t%s\n", (loop->set & FN) ? "n = $80" : "n = 0");
+    if (loop->hoisted & FZ)
+        print(OUTPUT, "\t%s\n", (loop->set & FZ) ? "z = 1" : "z = 0");
+    if (loop->hoisted & FC)
+        print(OUTPUT, "\t%s\n", (loop->set & FC) ? "c = 1" : "c = 0");
+}
+
+/*
+ ** Data tables, the runs of bytes outside blocks in the order they
+ ** are written. A table found inside the data written before isn't
+ ** written again, its labels name the same place of the first copy
+ ** (the banks of F8, F6 and F4 often repeat graphics, and 3F repeats
+ ** the last 2K in each bank). Tables are merged whole, as an indexed
+ ** read can go past the next label. The half of a 2K ROM without the
+ ** start is all a copy of the other one, except its code. Returns -1
+ ** when there is no memory.
+ */
+#define MIN_TABLE   8       /* Smaller tables aren't merged */
+
+int data_tables(struct context *ctx, int first, int start)
+{
+    struct bank *bank;
+    struct bank *other;
+    byte *data;
+    byte table[4096];
+    int *where;
+    int *number;
+    int used;
+    int total;
+    int begin;
+    int offset;
+    int length;
+    int address;
+    int copy;
+    int bytes;
+    int merged;
+    int c;
+    int d;
+    int e;
+    
+    data = malloc(ctx->total_banks * 4096);
+    where = malloc(ctx->total_banks * 4096 * 2 * sizeof(int));
+    if (data == NULL || where == NULL) {
+        free(data);
+        free(where);
+        return -1;
+    }
+    number = where + ctx->total_banks * 4096;    /* Table of each byte */
+    used = 0;
+    total = 0;
+    bytes = 0;
+    merged = 0;
+    if (ctx->mirrored) {
+        bank = &ctx->banks[first];
+        for (offset = 0; offset < 2048; offset++) {
+            address = ADDR(start + 2048 + offset);
+            if (bank->block_at[address & 0x0fff] >= 0)
+                continue;
+            bank->alias[address & 0x0fff] = bank->number * 4096 + ((address ^ 0x0800) & 0x0fff);
+            if (offset == 0 || bank->alias[ADDR(address - 1) & 0x0fff] < 0 || (C(address) & LABEL))
+                C(address ^ 0x0800) |= LABEL;
+        }
+    }
+    for (c = 0; c < ctx->total_banks; c++) {
+        bank = &ctx->banks[(first + c) % ctx->total_banks];
+        begin = bank == &ctx->banks[first] ? start : bank->origin;
+        offset = 0;
+        while (offset < 4096) {
+            d = bank->block_at[ADDR(begin + offset) & 0x0fff];
+            if (d >= 0) {
+                offset += bank->blocks[d].end - bank->blocks[d].start;
+                continue;
+            }
+            if (bank->alias[ADDR(begin + offset) & 0x0fff] >= 0) {   /* Mirror */
+                offset++;
+                continue;
+            }
+            for (length = 0; offset + length < 4096 && bank->block_at[ADDR(begin + offset + length) & 0x0fff] < 0
+            && bank->alias[ADDR(begin + offset + length) & 0x0fff] < 0; length++)
+                table[length] = R(begin + offset + length);
+            bytes += length;
+            for (d = 0; length >= MIN_TABLE && d + length <= used; d++) {
+                if (data[d] == table[0] && number[d] == number[d + length - 1] && memcmp(data + d, table, length) == 0)
+                    break;
+            }
+            if (length >= MIN_TABLE && d + length <= used) {
+                merged += length;
+                for (e = 0; e < length; e++) {
+                    address = ADDR(begin + offset + e);
+                    copy = where[d + e];
+                    bank->alias[address & 0x0fff] = copy;
+                    other = &ctx->banks[copy >> 12];
+                    if (e == 0 || (C(address) & LABEL))
+                        other->checked[copy & 0x0fff] |= LABEL;
+                }
+            } else {
+                for (d = 0; d < length; d++) {
+                    data[used] = table[d];
+                    where[used] = bank->number * 4096 + (ADDR(begin + offset + d) & 0x0fff);
+                    number[used++] = total;
+                }
+                total++;
+            }
+            offset += length;
+        }
+    }
+    print(&ctx->log, "Data: %d bytes in %d tables, %d bytes merged with copies\n", bytes - merged, total, merged);
+    free(data);
+    free(where);
+    return 0;
+}
+
+/*
+ ** Write a row of data, up to 8 bytes that don't cross a label.
+ ** Returns the bytes written.
+ */
+int data_row(struct bank *bank, int start, int offset)
+{
+    int address;
+    int c;
+    
+    print(OUTPUT, "\t%s ", bank->ctx->target == C6502_CP1610 ? "DECLE" : "DATA");
+    for (c = 0; c < 8 && offset + c < 4096; c++) {
+        address = ADDR(start + offset + c);
+        if (bank->block_at[address & 0x0fff] >= 0 || bank->alias[address & 0x0fff] >= 0
+        || (c > 0 && (C(address) & LABEL)))
+            break;
+        print(OUTPUT, "%s$%02X", c > 0 ? "," : "", R(address));
+    }
+    print(OUTPUT, "\n");
+    return c;
+}
+
+/*
+ ** Emit the program, walking the blocks in address order from the
+ ** starting address. Each block is lowered and optimized before
+ ** being written, IntyBASIC gets the loops structured. Bytes outside
+ ** blocks are data.
+ */
+void emit(struct bank *bank, int start)
+{
+    struct loop *loop;
+    int offset;
+    int address;
+    int c;
+    
+    bank->ctx->step = 2;
+    if ((bank->ctx->target == C6502_BASIC || bank->ctx->target == C6502_CP1610) && find_loops(bank, start))
+        bank->ctx->pool.failed = 1;
+    offset = 0;
+    while (offset < 4096) {
+        address = ADDR(start + offset);
+        c = bank->block_at[address & 0x0fff];
+        if (c < 0 && bank->alias[address & 0x0fff] >= 0) {     /* Copy of a table */
+            if (offset == 0 || bank->alias[ADDR(start + offset - 1) & 0x0fff] < 0)
+                print(OUTPUT, "\t%c Same data as %s\n", bank->ctx->target == C6502_CP1610 ? ';' : '\'',
+                      data_label(bank, address));
+            offset++;
+            continue;
+        }
+        if (C(address) & LABEL)
+            print(OUTPUT, "%s:\n", label(bank->ctx, bank->number, address));
+        if (c < 0) {
+            offset += data_row(bank, start, offset);
+            continue;
+        }
+        for (loop = bank->loops; loop < bank->loops + bank->total_loops; loop++) {
+            if (((loop->type == L_KERNEL && bank->ctx->target == C6502_BASIC) || loop->type == L_POLL)
+            && loop->header == c)
+                break;
+        }
+        if (loop < bank->loops + bank->total_loops) {
+            collapse(bank, loop);
+            offset += bank->blocks[loop->latch].end - bank->blocks[c].start;
+            continue;
+        }
+        lower_block(bank, c);
+        block_cost(bank, c);
+        if (!chained(bank, c)) {
+            print(OUTPUT, "\t%c %d cycles on 6502, about %d on CP1610\n", bank->ctx->target == C6502_CP1610 ? ';' : '\'',
+                  bank->blocks[c].cycles, bank->blocks[c].cost);
+        }
+        if (bank->total_loops > 0 && bank->ctx->target == C6502_BASIC)
+            structure(bank, c);
+        write_block(bank);
+        offset += bank->blocks[c].end - bank->blocks[c].start;
+    }
+    free(bank->loops);
+    bank->loops = NULL;
+    bank->total_loops = 0;
+}
+
+/*
+ ** C translation. The IntyBASIC statements of the IR are translated
+ ** to C, so the same propagation is used. Each entry point of a
+ ** subroutine becomes a function with the code reached from it, the
+ ** labels are goto targets and JSR is a function call. A function
+ ** stops at the start of VSYNC once the frames asked are done, and
+ ** it is resumed later by calling again the functions in the path.
+ */
+#define C_TEXT  512
+
+/*
+ ** Operators translated to C
+ */
+static const char *c_operators[][2] = {
+    {"OR", "|"},
+    {"XOR", "^"},
+    {"AND", "&"},
+    {"<>", "!="},
+    {"=", "=="},
+    {NULL, NULL},
+};
+
+/*
+ ** State of the function being written
+ */
+struct cfunc {
+    struct buffer body;         /* Statements */
+    struct buffer cases;        /* Resume points */
+    int points;
+    int *blocks;                /* Blocks reached, bank * 4096 + index */
+    int total_blocks;
+};
+
+/*
+ ** Add text to a C translation, marking a failure if it doesn't fit
+ */
+void c_text(struct parser *ps, char *out, const char *format, ...)
+{
+    va_list ap;
+    int length;
+    
+    va_start(ap, format);
+    length = vsnprintf(out, C_TEXT, format, ap);
+    va_end(ap);
+    if (length < 0 || length >= C_TEXT)
+        ps->failed = 1;
+}
+
+/*
+ ** Access to an IntyBASIC array: the zero page, a full address, or
+ ** ROM and RIOT through a label. Writes the value if not NULL.
+ */
+void c_access(struct parser *ps, const char *name, int length, const char *index, const char *value, char *out)
+{
+    char *end;
+    int address;
+    int number;
+    int known;
+    
+    address = strtol(index, &end, 0);
+    known = (*end == '\0');
+    if (length == 2 && memcmp(name, "zp", 2) == 0) {
+        address &= 0xff;
+        if (known && (address & 0x80) && value)
+            c_text(ps, out, "st->ram[0x%02X] = %s", address & 0x7f, value);
+        else if (known && (address & 0x80))
+            c_text(ps, out, "st->ram[0x%02X]", address & 0x7f);
+        else if (known && value)
+            c_text(ps, out, "tia_write(st, 0x%02X, %s)", address, value);
+        else if (known)
+            c_text(ps, out, "tia_read(st, 0x%02X)", address);
+        else if (value)
+            c_text(ps, out, "zp_write(st, %s & 0xFF, %s)", index, value);
+        else
+            c_text(ps, out, "zp_read(st, %s & 0xFF)", index);
+    } else if (length == 3 && memcmp(name, "mem", 3) == 0) {
+        if (value)
+            c_text(ps, out, "wr(st, %s, %s)", index, value);
+        else
+            c_text(ps, out, "rd(st, %d, %s)", ps->bank, index);
+    } else if (length > 1 && (name[0] == 'B' || name[0] == 'L')) {
+        number = 0;
+        if (name[0] == 'B')
+            number = strtol(name + 1, &end, 10);
+        else
+            end = (char *) name;
+        if (*end != 'L') {
+            ps->failed = 1;
+            return;
+        }
+        address = strtol(end + 1, NULL, 16);
+        if (address & 0x1000) {         /* ROM */
+            if (value)
+                c_text(ps, out, "(void) (%s)", value);
+            else if (known)
+                c_text(ps, out, "rom[%d][0x%03X]", number, (address + strtol(index, NULL, 0)) & 0x0fff);
+            else
+                c_text(ps, out, "rom[%d][(0x%03X + %s) & 0xFFF]", number, address & 0x0fff, index);
+        } else if (value) {             /* RIOT */
+            c_text(ps, out, "riot_write(st, 0x%03X + %s, %s)", address, index, value);
+        } else {
+            c_text(ps, out, "riot_read(st, 0x%03X + %s)", address, index);
+        }
+    } else {
+        ps->failed = 1;
+    }
+}
+
+void c_expression(struct parser *ps, int level, char *out);
+
+/*
+ ** Translate an IntyBASIC primary expression into C
+ */
+void c_primary(struct parser *ps, char *out)
+{
+    char index[C_TEXT];
+    const char *s;
+    char *end;
+    int length;
+    
+    out[0] = '\0';
+    while (*ps->p == ' ')
+        ps->p++;
+    s = ps->p;
+    if (*ps->p == '(') {
+        ps->p++;
+        c_expression(ps, 0, out);
+        if (*ps->p != ')')
+            ps->failed = 1;
+        ps->p++;
+    } else if (*ps->p == '$') {
+        c_text(ps, out, "0x%02lX", strtol(ps->p + 1, &end, 16));
+        ps->p = end;
+    } else if (isdigit(*ps->p)) {
+        c_text(ps, out, "%ld", strtol(ps->p, &end, 10));
+        ps->p = end;
+    } else if (*ps->p == '#' || isalpha(*ps->p)) {
+        ps->p++;
+        while (isalnum(*ps->p))
+            ps->p++;
+        length = ps->p - s;
+        if (*ps->p == '(') {    /* Array */
+            ps->p++;
+            c_expression(ps, 0, index);
+            if (*ps->p != ')') {
+                ps->failed = 1;
+                return;
+            }
+            ps->p++;
+            c_access(ps, s, length, index, NULL, out);
+        } else if (length == 2 && memcmp(s, "#t", 2) == 0) {
+            strcpy(out, "t");
+        } else if (length == 1 && *s == 's') {
+            strcpy(out, "st->sp");
+        } else if (length == 1 && strchr("axynzcv", *s) != NULL) {
+            out[0] = *s;
+            out[1] = '\0';
+        } else {
+            ps->failed = 1;
+        }
+    } else {
+        ps->failed = 1;
+    }
+}
+
+/*
+ ** Translate an IntyBASIC expression into C from a precedence level.
+ ** Each operation gets its parentheses because the bitwise operators
+ ** of C have another precedence, and comparisons give -1 for true as
+ ** in IntyBASIC.
+ */
+void c_expression(struct parser *ps, int level, char *out)
+{
+    char left[C_TEXT];
+    char right[C_TEXT];
+    const char *op;
+    int c;
+    
+    if (level == LEVEL_NOT || level == LEVEL_MINUS) {
+        op = operator_at(ps, level);
+        if (op == NULL) {
+            if (level == LEVEL_MINUS)
+                c_primary(ps, out);
+            else
+                c_expression(ps, level + 1, out);
+            return;
+        }
+        c_expression(ps, level, right);
+        c_text(ps, out, "(%s%s)", level == LEVEL_MINUS ? "-" : "~", right);
+        return;
+    }
+    c_expression(ps, level + 1, out);
+    while (!ps->failed && (op = operator_at(ps, level)) != NULL) {
+        c_expression(ps, level + 1, right);
+        strcpy(left, out);
+        for (c = 0; c_operators[c][0] != NULL; c++) {
+            if (strcmp(c_operators[c][0], op) == 0)
+                break;
+        }
+        if (c_operators[c][0] != NULL)
+            op = c_operators[c][1];
+        c_text(ps, out, "%s(%s %s %s)", level == LEVEL_NOT + 1 ? "-" : "", left, op, right);
+    }
+}
+
+/*
+ ** Translate a whole IntyBASIC expression, returns zero if it can't
+ */
+int c_translate(struct bank *bank, const char *text, int len, char *out)
+{
+    struct parser ps;
+    char copy[C_TEXT];
+    
+    if (len >= C_TEXT)
+        return 0;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    ps.p = copy;
+    ps.known = NULL;
+    ps.failed = 0;
+    ps.bank = bank->number;
+    c_expression(&ps, 0, out);
+    while (*ps.p == ' ')
+        ps.p++;
+    return !ps.failed && *ps.p == '\0';
+}
+
+/*
+ ** Check if the parenthesis starting a text closes at its end
+ */
+int balanced(const char *text)
+{
+    int depth;
+    
+    depth = 0;
+    do {
+        if (*text == '(')
+            depth++;
+        else if (*text == ')')
+            depth--;
+        text++;
+    } while (depth > 0 && *text) ;
+    return depth == 0 && *text == '\0';
+}
+
+/*
+ ** Translate an IntyBASIC statement into C, returns zero if it can't
+ */
+int c_statement(struct bank *bank, const char *text, char *out)
+{
+    struct parser ps;
+    char value[C_TEXT];
+    char index[C_TEXT];
+    const char *then;
+    const char *p;
+    int c;
+    
+    if (text[0] == '\'') {
+        c_text(&ps, out, "/* %s */", text + 2);
+        return 1;
+    }
+    if (memcmp(text, "GOTO ", 5) == 0) {
+        p = strchr(text, '\t');
+        c_text(&ps, out, "goto %.*s;", p ? (int) (p - text - 5) : (int) strlen(text + 5), text + 5);
+        return 1;
+    }
+    if (memcmp(text, "IF ", 3) == 0) {
+        then = strstr(text, " THEN GOTO ");
+        if (then == NULL || !c_translate(bank, text + 3, then - text - 3, value))
+            return 0;
+        if (value[0] == '-' && value[1] == '(' && balanced(value + 1))  /* Only the truth matters */
+            memmove(value, value + 1, strlen(value));
+        c_text(&ps, out, "if (%s) {\n\t\tst->cycles++;\n\t\tgoto %s;\n\t}", value, then + 11);
+        return 1;
+    }
+    c = assignment(text);
+    if (c < 0 || !c_translate(bank, text + c + 2, strlen(text + c + 2), value))
+        return 0;
+    if (text[c - 2] != ')') {   /* Variable */
+        if (!c_translate(bank, text, c - 1, index))
+            return 0;
+        c_text(&ps, out, "%s = %s;", index, value);
+        return 1;
+    }
+    p = strchr(text, '(');
+    if (p == NULL || !c_translate(bank, p + 1, text + c - 2 - p - 1, index))
+        return 0;
+    ps.failed = 0;
+    ps.bank = bank->number;
+    c_access(&ps, text, p - text, index, value, out);
+    strcat(out, ";");
+    return !ps.failed;
+}
+
+/*
+ ** Jump through a pointer, or to the address pulled by an RTS used as
+ ** a jump, only to the blocks of the function. An RTI used as a jump
+ ** stops.
+ */
+void c_dispatch(struct bank *bank, struct cfunc *f, int address)
+{
+    int pointer;
+    int start;
+    int c;
+    
+    if (R(address) == 0x40) {
+        print(&f->body, "\tHALT(0x%04X);\t/* RTI used as a jump */\n", address);
+        return;
+    }
+    if (R(address) == 0x60) {
+        print(&f->body, "\tt = (zp_read(st, (st->sp + 1) & 0xff) | zp_read(st, (st->sp + 2) & 0xff) << 8) + 1;\n");
+        print(&f->body, "\tst->sp += 2;\n");
+    } else {
+        pointer = R(address + 1) | R(address + 2) << 8;
+        print(&f->body, "\tt = rd(st, %d, 0x%04X) | rd(st, %d, 0x%04X) << 8;\n",
+              bank->number, pointer, bank->number, (pointer & 0xff00) | ((pointer + 1) & 0xff));
+    }
+    print(&f->body, "\tswitch (t & 0x1FFF) {\n");
+    for (c = 0; c < f->total_blocks; c++) {
+        if (f->blocks[c] / 4096 != bank->number)
+            continue;
+        start = bank->blocks[f->blocks[c] % 4096].start;
+        print(&f->body, "\t\tcase 0x%04X: goto %s;\n", start & 0x1fff, label(bank->ctx, bank->number, start));
+    }
+    print(&f->body, "\t}\n\tHALT(0x%04X);\n", address);
+}
+
+/*
+ ** Write the statements of the block as C. The cycles are added
+ ** before each instruction that can look at them.
+ */
+void c_block(struct bank *bank, struct cfunc *f)
+{
+    struct context *ctx;
+    struct opcode *op;
+    struct insn *insn;
+    struct stmt *stmt;
+    struct table table;
+    char line[C_TEXT];
+    const char *text;
+    int pending;
+    int address;
+    int joined;
+    int flag;
+    
+    ctx = bank->ctx;
+    if (ctx->pool.failed)
+        return;
+    pending = 0;
+    for (insn = ctx->insns; insn < ctx->insns + ctx->total_insns; insn++) {
+        op = &opcodes[R(insn->address)];
+        pending += cycles[R(insn->address)];
+        if (pending != 0 && (op->kind != OP || (op->mode != IMP && op->mode != IMM && op->mode != ACC)
+        || ((op->reads | op->writes) & LS) != 0)) {
+            print(&f->body, "\tst->cycles += %d;\n", pending);
+            pending = 0;
+        }
+        if (insn->type == I_UNHANDLED) {
+            print(&f->body, "\tHALT(0x%04X);\t/* Unhandled opcode $%02X */\n", insn->address, R(insn->address));
+            continue;
+        }
+        if ((op->kind == BRANCH || op->kind == JUMP) && insn->type != I_SWITCH
+        && (destination(bank, insn->address) & 0x0fff) <= (insn->address & 0x0fff))
+            print(&f->body, "\tLOOP(0x%04X);\n", insn->address);
+        if (insn->type == I_CODE && (op->kind == JUMPI || (op->kind == RETURN && dispatch(bank, insn->address, &table)))) {
+            c_dispatch(bank, f, insn->address);
+            continue;
+        }
+        joined = 0;
+        for (stmt = ctx->stmts + insn->first; stmt < ctx->stmts + insn->first + insn->total; stmt++) {
+            if (!stmt->keep)
+                continue;
+            text = ctx->pool.data + stmt->text;
+            flag = stmt->target & FNZ;
+            if (joined == 1 && flag != 0)
+                put(&f->body, ' ');
+            else if (joined)
+                print(&f->body, "\n\t");
+            else
+                put(&f->body, '\t');
+            joined = flag != 0 ? 1 : 2;
+            if (memcmp(text, "GOSUB ", 6) == 0) {
+                address = insn->address + 2;
+                print(&f->body, "PUSH(0x%02X);\n\tPUSH(0x%02X);\n", address >> 8, address & 0xff);
+                if (op->mode == IMM)    /* BRK */
+                    print(&f->body, "\tPUSH(0x30);\n");
+                print(&f->body, "\tCALL(sub_%s, %d);", text + 6, ++f->points);
+                print(&f->cases, "\t\tcase %d: goto Y%d;\n", f->points, f->points);
+            } else if (strcmp(text, "RETURN") == 0) {
+                print(&f->body, "RETURN(%d);", op->mode == IMP && R(insn->address) == 0x40 ? 3 : 2);
+            } else if (c_statement(bank, text, line)) {
+                print(&f->body, "%s", line);
+                if (strncmp(line, "tia_write(st, 0x00,", 19) == 0 || strncmp(line, "tia_write(st, 0x40,", 19) == 0) {
+                    print(&f->body, "\n\tFRAME(%d);", ++f->points);
+                    print(&f->cases, "\t\tcase %d: st->resuming = 0; goto Y%d;\n", f->points, f->points);
+                }
+            } else {
+                print(&ctx->log, "Statement not translated at $%04X: %s\n", insn->address, text);
+                print(&f->body, "HALT(0x%04X);\t/* %s */", insn->address, text);
+            }
+        }
+        if (joined)
+            put(&f->body, '\n');
+    }
+    if (pending != 0)
+        print(&f->body, "\tst->cycles += %d;\n", pending);
+}
+
+/*
+ ** Add a block to the ones reached by a function
+ */
+void c_reach(struct context *ctx, struct cfunc *f, int number, int address, int *reached, int mark)
+{
+    int c;
+    
+    c = ctx->banks[number].block_at[address & 0x0fff];
+    if (c < 0 || reached[number * 4096 + c] == mark)
+        return;
+    reached[number * 4096 + c] = mark;
+    f->blocks[f->total_blocks++] = number * 4096 + c;
+}
+
+/*
+ ** Compare two integers (for qsort)
+ */
+int compare_ints(const void *a, const void *b)
+{
+    return *(int *) a - *(int *) b;
+}
+
+/*
+ ** Write the function for a subroutine, with all the code reached
+ ** from its entry without passing through a return. Blocks shared by
+ ** many subroutines are repeated in each one.
+ */
+void c_function(struct context *ctx, int number, int address, int *reached, int mark)
+{
+    struct cfunc f;
+    struct bank *bank;
+    struct block *b;
+    struct opcode *op;
+    struct table table;
+    const char *name;
+    int next;
+    int c;
+    
+    memset(&f, 0, sizeof(f));
+    f.blocks = malloc(ctx->total_banks * 4096 * sizeof(int));
+    if (f.blocks == NULL) {
+        ctx->output.failed = 1;
+        return;
+    }
+    c_reach(ctx, &f, number, address, reached, mark);
+    for (c = 0; c < f.total_blocks; c++) {
+        bank = &ctx->banks[f.blocks[c] / 4096];
+        b = &bank->blocks[f.blocks[c] % 4096];
+        op = &opcodes[R(b->last)];
+        if (bank->switched[b->last & 0x0fff] >= 0) {
+            if (op->kind == CALL)
+                c_reach(ctx, &f, bank->number, b->end, reached, mark);
+            else
+                c_reach(ctx, &f, bank->switched[b->last & 0x0fff], continuation(bank, b->last), reached, mark);
+            continue;
+        }
+        if (op->kind == BRANCH || op->kind == JUMP)
+            c_reach(ctx, &f, bank->number, destination(bank, b->last), reached, mark);
+        if ((op->kind == JUMPI || op->kind == RETURN) && dispatch(bank, b->last, &table)) {
+            for (next = 0; next < table.total; next++)
+                c_reach(ctx, &f, bank->number, jump_entry(bank, &table, next), reached, mark);
+            for (next = 0; next < bank->total_blocks; next++) {     /* Targets found by the interpreter */
+                if (C(bank->blocks[next].start) & DYNAMIC)
+                    c_reach(ctx, &f, bank->number, bank->blocks[next].start, reached, mark);
+            }
+        }
+        if (op->kind == OP || op->kind == BRANCH || op->kind == CALL)
+            c_reach(ctx, &f, bank->number, b->end, reached, mark);
+    }
+    if (f.total_blocks > 1)     /* Entry stays first */
+        qsort(f.blocks + 1, f.total_blocks - 1, sizeof(int), compare_ints);
+    for (c = 0; c < f.total_blocks; c++) {
+        bank = &ctx->banks[f.blocks[c] / 4096];
+        b = &bank->blocks[f.blocks[c] % 4096];
+        print(&f.body, "%s:\n", label(ctx, bank->number, b->start));
+        lower_block(bank, f.blocks[c] % 4096);
+        c_block(bank, &f);
+        op = &opcodes[R(b->last)];
+        if (bank->switched[b->last & 0x0fff] >= 0 && op->kind != CALL)
+            continue;
+        if (op->kind != OP && op->kind != BRANCH && op->kind != CALL)
+            continue;
+        next = bank->block_at[b->end & 0x0fff];
+        if (next < 0)
+            print(&f.body, "\tHALT(0x%04X);\n", b->end);
+        else if (c + 1 == f.total_blocks || f.blocks[c + 1] != bank->number * 4096 + next)
+            print(&f.body, "\tgoto %s;\n", label(ctx, bank->number, b->end));
+    }
+    name = label(ctx, number, address);
+    print(&ctx->output, "static int sub_%s(struct vcs *st)\n{\n\tLOCALS;\n\n", name);
+    print(&ctx->output, "\tif (d >= MAX_DEPTH) {\n\t\tst->halted = 0x%04X;\n\t\treturn 1;\n\t}\n", address);
+    if (f.points)
+        print(&ctx->output, "\tif (st->resuming) {\n\t\tswitch (st->resume[d]) {\n%s\t\t}\n\t}\n",
+              f.cases.data);
+    print(&ctx->output, "%s}\n\n", f.body.data ? f.body.data : "");
+    if (f.body.failed || f.cases.failed)
+        ctx->output.failed = 1;
+    free(f.body.data);
+    free(f.cases.data);
+    free(f.blocks);
+}
+
+/*
+ ** Start of a C program: the state of the machine, the ROM and the
+ ** access to the TIA and the RIOT.
+ */
+static const char *c_prelude[] = {
+    "/*",
+    " ** Generated by c6502 from an Atari VCS ROM",
+    " **",
+    " ** Call vcs_reset() once, then vcs_step() runs frames (counted at",
+    " ** the start of VSYNC) and returns how many were run. The registers,",
+    " ** RAM, TIA writes and RIOT timer are in struct vcs, the controls",
+    " ** are inpt[] (INPT0-INPT5 at 8-13), swcha and swchb.",
+    " **",
+    " ** Compile with -DVCS_MAIN to measure the speed.",
+    " */",
+    "",
+    "#include <stdint.h>",
+    "#include <string.h>",
+    "",
+    "#pragma GCC diagnostic ignored \"-Wunused-label\"",
+    "#pragma GCC diagnostic ignored \"-Wunused-function\"",
+    "",
+    "#define MAX_DEPTH    128",
+    "#define FRAME_LIMIT  (76 * 262 * 10)     /* Cycles without VSYNC before stopping */",
+    "",
+    "struct vcs {",
+    "    uint8_t a, x, y, sp;",
+    "    uint8_t n, z, c, v;         /* Flags as in the IntyBASIC output */",
+    "    uint8_t ram[128];",
+    "    uint8_t tia[64];            /* Last values written to the TIA */",
+    "    uint8_t inpt[16];           /* Values read from the TIA */",
+    "    uint8_t swcha;",
+    "    uint8_t swchb;",
+    "    uint8_t timer;              /* Value written to the RIOT timer */",
+    "    int shift;                  /* Timer interval (1 << shift cycles) */",
+    "    uint64_t timer_start;",
+    "    uint64_t cycles;",
+    "    uint64_t deadline;          /* Stops a loop that doesn't reach VSYNC */",
+    "    long frames;                /* Frames left in this step */",
+    "    long frame;                 /* Frames run */",
+    "    int depth;                  /* Functions called */",
+    "    int resume[MAX_DEPTH];      /* Point where each function stopped */",
+    "    int resuming;",
+    "    int halted;                 /* Address of code it couldn't run, -1 if reset returned */",
+    "};",
+    "",
+    NULL
+};
+
+static const char *c_devices[] = {
+    "static uint8_t tia_read(struct vcs *st, int address)",
+    "{",
+    "    return st->inpt[address & 0x0f];",
+    "}",
+    "",
+    "static void tia_write(struct vcs *st, int address, uint8_t value)",
+    "{",
+    "    address &= 0x3f;",
+    "    if (address == 0x00 && (value & 2) && (st->tia[0] & 2) == 0) {    /* VSYNC */",
+    "        st->frames--;",
+    "        st->frame++;",
+    "        st->deadline = st->cycles + FRAME_LIMIT;",
+    "    } else if (address == 0x02) {    /* WSYNC */",
+    "        st->cycles = (st->cycles + 75) / 76 * 76;",
+    "    }",
+    "    st->tia[address] = value;",
+    "}",
+    "",
+    "static uint8_t riot_read(struct vcs *st, int address)",
+    "{",
+    "    uint64_t elapsed;",
+    "    uint64_t end;",
+    "    ",
+    "    if ((address & 0x04) == 0)",
+    "        return (address & 3) == 0 ? st->swcha : (address & 3) == 2 ? st->swchb : 0;",
+    "    elapsed = st->cycles - st->timer_start;",
+    "    end = (uint64_t) st->timer << st->shift;",
+    "    if (address & 1)    /* TIMINT */",
+    "        return elapsed > end ? 0xc0 : 0x00;",
+    "    if (elapsed <= end)",
+    "        return st->timer - (elapsed >> st->shift);",
+    "    return (uint8_t) (end - elapsed);",
+    "}",
+    "",
+    "static void riot_write(struct vcs *st, int address, uint8_t value)",
+    "{",
+    "    static const int shifts[] = {0, 3, 6, 10};",
+    "    ",
+    "    if ((address & 0x14) == 0x14) {",
+    "        st->timer = value;",
+    "        st->shift = shifts[address & 3];",
+    "        st->timer_start = st->cycles;",
+    "    }",
+    "}",
+    "",
+    "static uint8_t zp_read(struct vcs *st, int address)",
+    "{",
+    "    return (address & 0x80) ? st->ram[address & 0x7f] : tia_read(st, address);",
+    "}",
+    "",
+    "static void zp_write(struct vcs *st, int address, uint8_t value)",
+    "{",
+    "    if (address & 0x80)",
+    "        st->ram[address & 0x7f] = value;",
+    "    else",
+    "        tia_write(st, address, value);",
+    "}",
+    "",
+    "static uint8_t rd(struct vcs *st, int bank, int address)",
+    "{",
+    "    if (address & 0x1000)",
+    "        return rom[bank][address & 0x0fff];",
+    "    if ((address & 0x0280) == 0x0280)",
+    "        return riot_read(st, address);",
+    "    return zp_read(st, address & 0xff);",
+    "}",
+    "",
+    "static void wr(struct vcs *st, int address, uint8_t value)",
+    "{",
+    "    if (address & 0x1000)",
+    "        return;",
+    "    if ((address & 0x0280) == 0x0280)",
+    "        riot_write(st, address, value);",
+    "    else",
+    "        zp_write(st, address & 0xff, value);",
+    "}",
+    "",
+    "#define LOCALS  uint8_t a = st->a, x = st->x, y = st->y, n = st->n, z = st->z, c = st->c, v = st->v; \\",
+    "                unsigned t = 0; int d = st->depth++; (void) (a | x | y | n | z | c | v | t)",
+    "#define SAVE    (st->a = a, st->x = x, st->y = y, st->n = n, st->z = z, st->c = c, st->v = v)",
+    "#define LOAD    (a = st->a, x = st->x, y = st->y, n = st->n, z = st->z, c = st->c, v = st->v)",
+    "#define PUSH(value)     zp_write(st, st->sp--, (value))",
+    "#define STOP(point)     do { SAVE; st->resume[d] = (point); st->depth = d; return 1; } while (0)",
+    "#define HALT(address)   do { st->halted = (address); STOP(0); } while (0)",
+    "#define RETURN(bytes)   do { SAVE; st->sp += (bytes); st->depth = d; return 0; } while (0)",
+    "#define CALL(f, point)  Y##point: SAVE; if (f(st)) STOP(point); LOAD",
+    "#define FRAME(point)    if (st->frames <= 0) STOP(point); Y##point:",
+    "#define LOOP(address)   if (st->cycles > st->deadline) HALT(address)",
+    "",
+    NULL
+};
+
+static const char *c_epilogue[] = {
+    "void vcs_reset(struct vcs *st)",
+    "{",
+    "    memset(st, 0, sizeof(*st));",
+    "    memset(st->inpt + 8, 0x80, 6);     /* Buttons released */",
+    "    st->swcha = 0xff;",
+    "    st->swchb = 0x0b;",
+    "    st->sp = 0xfd;",
+    "    st->timer = 0xff;",
+    "    st->shift = 10;",
+    "}",
+    "",
+    "long vcs_step(struct vcs *st, long frames)",
+    "{",
+    "    if (st->halted)",
+    "        return 0;",
+    "    st->frames = frames;",
+    "    st->deadline = st->cycles + FRAME_LIMIT;",
+    "    st->depth = 0;",
+    "    if (ENTRY(st) == 0)",
+    "        st->halted = -1;",
+    "    st->resuming = 1;",
+    "    return frames - st->frames;",
+    "}",
+    "",
+    "#ifdef VCS_MAIN",
+    "#include <stdio.h>",
+    "#include <stdlib.h>",
+    "#include <time.h>",
+    "",
+    "int main(int argc, char *argv[])",
+    "{",
+    "    static struct vcs st;",
+    "    clock_t start;",
+    "    double time;",
+    "    long frames;",
+    "    ",
+    "    frames = argc > 1 ? atol(argv[1]) : 100000;",
+    "    vcs_reset(&st);",
+    "    start = clock();",
+    "    frames = vcs_step(&st, frames);",
+    "    time = (double) (clock() - start) / CLOCKS_PER_SEC;",
+    "    printf(\"%ld frames in %.3f s, %.0f frames per second\\n\", frames, time, time > 0 ? frames / time : 0);",
+    "    if (st.halted)",
+    "        printf(\"Stopped at $%04X\\n\", st.halted & 0xffff);",
+    "    return 0;",
+    "}",
+    "#endif",
+    NULL
+};
+
+/*
+ ** Write lines of fixed text
+ */
+void lines(struct context *ctx, const char **text)
+{
+    while (*text != NULL)
+        print(&ctx->output, "%s\n", *text++);
+}
+
+/*
+ ** Emit the C program: the ROM, a function for the reset routine and
+ ** another for each subroutine, and the functions to run it.
+ */
+void emit_c(struct context *ctx, int first, int start)
+{
+    struct bank *bank;
+    struct block *b;
+    struct opcode *op;
+    int *entries;
+    int *reached;
+    int total;
+    int c;
+    int d;
+    
+    ctx->step = 2;
+    entries = malloc((ctx->total_banks * 4096 + 1) * sizeof(int));
+    reached = calloc(ctx->total_banks * 4096, sizeof(int));
+    if (entries == NULL || reached == NULL) {
+        free(entries);
+        free(reached);
+        ctx->output.failed = 1;
+        return;
+    }
+    
+    /* The reset routine and the destinations of JSR */
+    total = 0;
+    entries[total++] = first * 4096 + (start & 0x0fff);
+    for (c = 0; c < ctx->total_banks; c++) {
+        bank = &ctx->banks[c];
+        for (b = bank->blocks; b < bank->blocks + bank->total_blocks; b++) {
+            op = &opcodes[R(b->last)];
+            if (op->kind != CALL)
+                continue;
+            if (bank->switched[b->last & 0x0fff] >= 0)
+                entries[total] = bank->switched[b->last & 0x0fff] * 4096 + (continuation(bank, b->last) & 0x0fff);
+            else
+                entries[total] = c * 4096 + (destination(bank, b->last) & 0x0fff);
+            for (d = 0; d < total && entries[d] != entries[total]; d++) ;
+            if (d == total && ctx->banks[entries[total] / 4096].block_at[entries[total] % 4096] >= 0)
+                total++;
+        }
+    }
+    
+    lines(ctx, c_prelude);
+    print(&ctx->output, "static const uint8_t rom[%d][4096] = {\n", ctx->total_banks);
+    for (c = 0; c < ctx->total_banks; c++) {
+        print(&ctx->output, "    {");
+        for (d = 0; d < 4096; d++)
+            print(&ctx->output, "%s0x%02x,", d % 16 == 0 ? "\n\t" : " ", ctx->banks[c].rom[d]);
+        print(&ctx->output, "\n    },\n");
+    }
+    print(&ctx->output, "};\n\n");
+    lines(ctx, c_devices);
+    for (c = 0; c < total; c++)
+        print(&ctx->output, "static int sub_%s(struct vcs *);\n", label(ctx, entries[c] / 4096, entries[c] % 4096));
+    print(&ctx->output, "\n");
+    for (c = 0; c < total; c++)
+        c_function(ctx, entries[c] / 4096, ctx->banks[entries[c] / 4096].origin | (entries[c] % 4096), reached, c + 1);
+    print(&ctx->output, "#define ENTRY   sub_%s\n\n", label(ctx, first, start));
+    lines(ctx, c_epilogue);
+    free(entries);
+    free(reached);
+}
+
+/*
+ ** Analyze all the banks in rounds. Inside a round each bank only
+ ** touches its own data, so they can be processed independently, and
+ ** the jumps found into other banks are queued for the next round.
+ */
+int analyze_banks(struct context *ctx)
+{
+    struct bank *bank;
+    struct seed *seed;
+    struct table table;
+    int summaries;
+    int tables;
+    int entries;
+    int busy;
+    int c;
+    int d;
+    
+    ctx->step = 1;
+    do {
+        for (c = 0; c < ctx->total_banks; c++)
+            discover(&ctx->banks[c]);
+        if (ctx->pool.failed)
+            return -1;
+        busy = 0;
+        for (c = 0; c < ctx->total_banks; c++) {
+            bank = &ctx->banks[c];
+            for (seed = bank->seeds; seed < bank->seeds + bank->total_seeds; seed++) {
+                target(&ctx->banks[seed->bank], seed->address);
+                busy = 1;
+            }
+            bank->total_seeds = 0;
+        }
+    } while (busy) ;
+    tables = 0;
+    entries = 0;
+    for (c = 0; c < ctx->total_banks; c++) {
+        bank = &ctx->banks[c];
+        for (d = 0; d < 4096; d++) {
+            if ((bank->checked[d] & 3) && (bank->rom[d] == 0x60 || bank->rom[d] == 0x6c) && jump_table(bank, ADDR(d), &table)) {
+                tables++;
+                entries += table.total;
+            }
+        }
+    }
+    print(&ctx->log, "Jump tables: %d dispatches, %d entries bounded\n", tables, entries);
+    for (c = 0; c < ctx->total_banks; c++) {
+        if (split_blocks(&ctx->banks[c]))
+            return -1;
+        fuse(&ctx->banks[c]);
+    }
+    summaries = 0;
+    for (c = 0; c < ctx->total_banks; c++) {
+        d = summarize(&ctx->banks[c]);
+        if (d < 0)
+            return -1;
+        summaries += d;
+        liveness(&ctx->banks[c]);
+    }
+    print(&ctx->log, "Summaries: %d subroutine%s\n", summaries, summaries == 1 ? "" : "s");
+    decimal_mode(ctx);
+    if (ctx->target != C6502_C)
+        call_graph(ctx);
+    if (ctx->target == C6502_BASIC || ctx->target == C6502_VERIFY)
+        chains(ctx);
+    return 0;
+}
+
+/*
+ ** Count the Tigervision bank switches of a ROM, a store into $3F
+ ** just after loading the same register with a bank number, and the
+ ** absolute accesses to the F8, F6 and F4 hotspots
+ */
+void count_switches(const byte *image, size_t size, int *stores, int *hotspots)
+{
+    static const byte loads[] = {0xa0, 0xa9, 0xa2};    /* For STY, STA and STX */
+    size_t c;
+    
+    *stores = 0;
+    *hotspots = 0;
+    for (c = 2; c < size - 2; c++) {
+        if (image[c] >= 0x84 && image[c] <= 0x86 && image[c + 1] == 0x3f
+            && image[c - 2] == loads[image[c] - 0x84] && image[c - 1] < size / 2048)
+            (*stores)++;
+        if ((image[c] == 0xad || image[c] == 0x8d || image[c] == 0x2c || image[c] == 0xae || image[c] == 0x8e
+             || image[c] == 0xac || image[c] == 0x8c) && (image[c + 2] & 0x10)
+            && ((image[c + 1] | image[c + 2] << 8) & 0x0fff) >= 0xff4 && ((image[c + 1] | image[c + 2] << 8) & 0x0fff) <= 0xffb)
+            (*hotspots)++;
+    }
+}
+
+/*
+ ** Detect the bank switching scheme from the ROM size. A Tigervision
+ ** ROM of the same size as F8, F6 or F4 needs several bank switches
+ ** that look like code and more than the hotspot accesses, other
+ ** sizes only need a store into $3F.
+ */
+int detect(struct context *ctx, const byte *image, size_t size)
+{
+    size_t c;
+    int hotspots;
+    int stores;
+    
+    if (size == 4096) {
+        ctx->total_banks = 1;
+        return NONE;
+    }
+    if (size % 2048 != 0)
+        return -1;
+    count_switches(image, size, &stores, &hotspots);
+    if (stores >= 2 && stores > hotspots) {
+        ctx->total_banks = size / 2048;
+        return T3F;
+    }
+    switch (size) {
+        case 8192:
+            ctx->total_banks = 2;
+            ctx->hotspot = 0xff8;
+            return F8;
+        case 16384:
+            ctx->total_banks = 4;
+            ctx->hotspot = 0xff6;
+            return F6;
+        case 32768:
+            ctx->total_banks = 8;
+            ctx->hotspot = 0xff4;
+            return F4;
+    }
+    for (c = 0; c < size - 1; c++) {
+        if ((image[c] == 0x84 || image[c] == 0x85 || image[c] == 0x86) && image[c + 1] == 0x3f) {
+            ctx->total_banks = size / 2048;
+            return T3F;
+        }
+    }
+    return -1;
+}
+
+/*
+ ** 6502 interpreter to find the code that static discovery can't
+ ** follow. The TIA and the RIOT are stubs: WSYNC waits for the end
+ ** of the line, the timer counts cycles, VSYNC counts frames, and
+ ** the inputs change every 32 frames so the game leaves its title
+ ** screen.
+ */
+#define PN     0x80    /* Processor status bits */
+#define PV     0x40
+#define PB     0x10
+#define PD     0x08
+#define PI     0x04
+#define PZ     0x02
+#define PC     0x01
+
+struct cpu {
+    struct context *ctx;
+    int bank;                   /* Bank selected */
+    int pc;
+    byte a;
+    byte x;
+    byte y;
+    byte s;
+    byte p;
+    byte ram[128];
+    byte tia[64];
+    byte inputs[3];             /* SWCHA, SWCHB and INPT4 */
+    byte timer;                 /* RIOT timer */
+    int shift;
+    long timer_start;
+    long cycles;
+    long frame_start;           /* Cycles at the last VSYNC */
+    int frames;                 /* Starts of VSYNC seen */
+    int halted;                 /* Undocumented opcode found */
+    int probe;                  /* Running a subroutine alone, nothing is marked */
+};
+
+/*
+ ** Inputs tried by the interpreter: SWCHA, SWCHB and INPT4
+ */
+static const byte stimulus[][3] = {
+    {0xff, 0x0b, 0x80},         /* Nothing */
+    {0xff, 0x0a, 0x80},         /* Game reset */
+    {0xff, 0x0b, 0x00},         /* Fire button */
+    {0xef, 0x0b, 0x80},         /* Joystick up */
+    {0xbf, 0x0b, 0x00},         /* Left and fire */
+    {0x7f, 0x0b, 0x80},         /* Right */
+    {0xdf, 0x0b, 0x80},         /* Down */
+    {0xff, 0x09, 0x80},         /* Game select */
+};
+
+/*
+ ** Mark an address of the bank selected as code reached dynamically
+ */
+void dynamic(struct cpu *cpu, int address)
+{
+    if ((address & 0x1000) && !cpu->probe)
+        cpu->ctx->banks[cpu->bank].checked[address & 0x0fff] |= DYNAMIC;
+}
+
+/*
+ ** Mark an RTS or RTI of the bank selected used as a jump
+ */
+void jumped(struct cpu *cpu, int address)
+{
+    if ((address & 0x1000) && !cpu->probe)
+        cpu->ctx->banks[cpu->bank].checked[address & 0x0fff] |= JUMPED;
+}
+
+/*
+ ** Mark a RAM byte read through an index, a pointer or the stack
+ */
+void indexed(struct cpu *cpu, int address)
+{
+    if ((address & 0x1280) == 0x0080 && !cpu->probe)
+        cpu->ctx->indexed[address & 0x7f] = 1;
+}
+
+/*
+ ** Mark a RAM byte written through an index, a pointer or the stack
+ ** with something else than zero (clearing the RAM doesn't count)
+ */
+void scattered(struct cpu *cpu, int address, int value)
+{
+    if ((address & 0x1280) == 0x0080 && (value & 0xff) != 0 && !cpu->probe)
+        cpu->ctx->scattered[address & 0x7f] = 1;
+}
+
+/*
+ ** Note what a store through an index or the stack wrote into the RAM
+ */
+void cleared(struct cpu *cpu, int at, int address, int value)
+{
+    struct context *ctx;
+    struct clear *k;
+    
+    ctx = cpu->ctx;
+    if ((address & 0x1280) != 0x0080 || (at & 0x1000) == 0 || cpu->probe)
+        return;
+    for (k = ctx->clears; k < ctx->clears + ctx->total_clears; k++) {
+        if (k->number == cpu->bank && ((k->address ^ at) & 0x0fff) == 0)
+            break;
+    }
+    if (k == ctx->clears + ctx->total_clears) {
+        if (ctx->total_clears == MAX_CLEARS)
+            return;
+        ctx->total_clears++;
+        memset(k, 0, sizeof(*k));
+        k->number = cpu->bank;
+        k->address = at;
+    }
+    if (value & 0xff)
+        k->mixed = 1;
+    else
+        k->bytes[address & 0x7f] = 1;
+}
+
+/*
+ ** Select a bank by touching a hotspot
+ */
+void hotspot(struct cpu *cpu, int address, int write)
+{
+    struct context *ctx;
+    
+    ctx = cpu->ctx;
+    if (ctx->scheme == T3F) {
+        if (write >= 0 && (address & 0x1fff) == 0x3f)
+            cpu->bank = write % ctx->total_banks;
+    } else if (ctx->scheme != NONE && (address & 0x1000) && (address & 0x0fff) >= ctx->hotspot
+    && (address & 0x0fff) < ctx->hotspot + ctx->total_banks) {
+        cpu->bank = (address & 0x0fff) - ctx->hotspot;
+    }
+}
+
+/*
+ ** Value of the RIOT timer
+ */
+byte timer(struct cpu *cpu)
+{
+    long elapsed;
+    long end;
+    
+    elapsed = cpu->cycles - cpu->timer_start;
+    end = (long) cpu->timer << cpu->shift;
+    if (elapsed <= end)
+        return cpu->timer - (elapsed >> cpu->shift);
+    return end - elapsed;
+}
+
+/*
+ ** Read a byte without side effects, for instructions
+ */
+byte fetch(struct cpu *cpu, int address)
+{
+    if (address & 0x1000)
+        return cpu->ctx->banks[cpu->bank].rom[address & 0x0fff];
+    if ((address & 0x0280) == 0x0080)
+        return cpu->ram[address & 0x7f];
+    return 0;
+}
+
+/*
+ ** Read a byte of the memory map
+ */
+byte load_byte(struct cpu *cpu, int address)
+{
+    address &= 0x1fff;
+    hotspot(cpu, address, -1);
+    if (cpu->probe && (address & 0x1280) != 0x0080 && (address & 0x1000) == 0)
+        cpu->halted = 1;    /* Only RAM and ROM */
+    if (address & 0x1000)
+        return cpu->ctx->banks[cpu->bank].rom[address & 0x0fff];
+    if ((address & 0x0280) == 0x0280) {     /* RIOT */
+        if ((address & 0x04) == 0)
+            return (address & 3) == 0 ? cpu->inputs[0] : (address & 3) == 2 ? cpu->inputs[1] : 0;
+        if (address & 1)
+            return cpu->cycles - cpu->timer_start > ((long) cpu->timer << cpu->shift) ? 0xc0 : 0x00;
+        return timer(cpu);
+    }
+    if (address & 0x80)
+        return cpu->ram[address & 0x7f];
+    if ((address & 0x0f) == 0x0c || (address & 0x0f) == 0x0d)  /* INPT4 and INPT5 */
+        return (address & 0x0f) == 0x0c ? cpu->inputs[2] : 0x80;
+    return 0;
+}
+
+/*
+ ** Write a byte of the memory map
+ */
+void store_byte(struct cpu *cpu, int address, byte value)
+{
+    static const int shifts[] = {0, 3, 6, 10};
+    
+    address &= 0x1fff;
+    hotspot(cpu, address, value);
+    if (cpu->probe && (address & 0x1280) != 0x0080)
+        cpu->halted = 1;    /* Only RAM */
+    if (address & 0x1000)
+        return;
+    if ((address & 0x0280) == 0x0280) {
+        if ((address & 0x14) == 0x14) {
+            cpu->timer = value;
+            cpu->shift = shifts[address & 3];
+            cpu->timer_start = cpu->cycles;
+        }
+    } else if (address & 0x80) {
+        cpu->ram[address & 0x7f] = value;
+    } else {
+        address &= 0x3f;
+        if (address == 0x00 && (value & 2) && (cpu->tia[0] & 2) == 0) {  /* VSYNC */
+            cpu->frames++;
+            cpu->frame_start = cpu->cycles;
+            memcpy(cpu->inputs, stimulus[cpu->frames / 32 % 8], 3);
+        } else if (address == 0x02) {   /* WSYNC */
+            cpu->cycles = (cpu->cycles + 75) / 76 * 76;
+        }
+        cpu->tia[address] = value;
+    }
+}
+
+#define PUSH(v)     (scattered(cpu, 0x100 | cpu->s, (v)), cleared(cpu, from, 0x100 | cpu->s, (v)), store_byte(cpu, 0x100 | cpu->s--, (v)))
+#define PULL()      (indexed(cpu, 0x100 | ((cpu->s + 1) & 0xff)), load_byte(cpu, 0x100 | ++cpu->s))
+#define SET_NZ(v)   (cpu->p = (cpu->p & ~(PN | PZ)) | ((v) & PN) | ((v) ? 0 : PZ))
+
+/*
+ ** Add with carry, in binary or decimal mode
+ */
+void add(struct cpu *cpu, int value)
+{
+    int result;
+    int low;
+    int high;
+    
+    result = cpu->a + value + (cpu->p & PC);
+    if ((cpu->p & PD) == 0) {
+        cpu->p &= ~(PV | PC);
+        cpu->p |= (~(cpu->a ^ value) & (cpu->a ^ result) & 0x80) ? PV : 0;
+        cpu->p |= result > 0xff ? PC : 0;
+        cpu->a = result;
+        SET_NZ(cpu->a);
+        return;
+    }
+    low = (cpu->a & 0x0f) + (value & 0x0f) + (cpu->p & PC);
+    high = (cpu->a & 0xf0) + (value & 0xf0);
+    cpu->p &= ~(PN | PV | PZ | PC);
+    cpu->p |= (result & 0xff) ? 0 : PZ;
+    if (low > 0x09) {
+        high += 0x10;
+        low += 0x06;
+    }
+    cpu->p |= high & PN;
+    cpu->p |= (~(cpu->a ^ value) & (cpu->a ^ high) & 0x80) ? PV : 0;
+    if (high > 0x90)
+        high += 0x60;
+    cpu->p |= high > 0xff ? PC : 0;
+    cpu->a = (low & 0x0f) | (high & 0xf0);
+}
+
+/*
+ ** Subtract with borrow, in binary or decimal mode. The flags are
+ ** the same in both modes.
+ */
+void subtract(struct cpu *cpu, int value)
+{
+    int borrow;
+    int low;
+    int high;
+    int a;
+    
+    a = cpu->a;
+    borrow = 1 - (cpu->p & PC);
+    add(cpu, value ^ 0xff);
+    if ((cpu->p & PD) == 0)
+        return;
+    cpu->p &= ~(PN | PV | PZ | PC);
+    cpu->p |= ((a - value - borrow) & 0xff) ? 0 : PZ;
+    cpu->p |= (a - value - borrow) & PN;
+    cpu->p |= ((a ^ value) & (a ^ (a - value - borrow)) & 0x80) ? PV : 0;
+    cpu->p |= (a - value - borrow) >= 0 ? PC : 0;
+    low = (a & 0x0f) - (value & 0x0f) - borrow;
+    high = (a & 0xf0) - (value & 0xf0);
+    if (low & 0x10) {
+        low -= 6;
+        high -= 0x10;
+    }
+    if (high & 0x100)
+        high -= 0x60;
+    cpu->a = (low & 0x0f) | (high & 0xf0);
+}
+
+/*
+ ** Compare a register with a value
+ */
+void cmp(struct cpu *cpu, int reg, int value)
+{
+    cpu->p = (cpu->p & ~PC) | (reg >= value ? PC : 0);
+    SET_NZ((reg - value) & 0xff);
+}
+
+/*
+ ** Run one instruction
+ */
+void step(struct cpu *cpu)
+{
+    struct opcode *op;
+    int opcode;
+    int address;
+    int pointer;
+    int value;
+    int bank;
+    int taken;
+    int from;
+    
+    from = cpu->pc;
+    opcode = fetch(cpu, cpu->pc);
+    op = &opcodes[opcode];
+    if ((cpu->pc & 0x1000) && !cpu->probe) {
+        cpu->ctx->banks[cpu->bank].checked[cpu->pc & 0x0fff] |= TRACED;
+        cpu->ctx->banks[cpu->bank].runs[cpu->pc & 0x0fff]++;
+    }
+    if (op->code == NULL) {
+        cpu->halted = 1;
+        return;
+    }
+    bank = cpu->bank;
+    value = fetch(cpu, cpu->pc + 1) | fetch(cpu, cpu->pc + 2) << 8;
+    cpu->cycles += cycles[opcode];
+    
+    /* Effective address */
+    address = 0;
+    switch (op->mode) {
+        case ZPG: address = value & 0xff; break;
+        case ZPX: address = (value + cpu->x) & 0xff; break;
+        case ZPY: address = (value + cpu->y) & 0xff; break;
+        case ABS: address = value; break;
+        case ABX: address = (value + cpu->x) & 0xffff; break;
+        case ABY: address = (value + cpu->y) & 0xffff; break;
+        case IND:
+            address = load_byte(cpu, value) | load_byte(cpu, (value & 0xff00) | ((value + 1) & 0xff)) << 8;
+            break;
+        case IZX:
+            pointer = (value + cpu->x) & 0xff;
+            address = load_byte(cpu, pointer) | load_byte(cpu, (pointer + 1) & 0xff) << 8;
+            indexed(cpu, pointer);
+            indexed(cpu, (pointer + 1) & 0xff);
+            break;
+        case IZY:
+            pointer = value & 0xff;
+            value = load_byte(cpu, pointer) | load_byte(cpu, (pointer + 1) & 0xff) << 8;
+            address = (value + cpu->y) & 0xffff;
+            if ((pointer & 0x80) && pointer != 0xff && !cpu->probe)
+                cpu->ctx->pages[pointer & 0x7f][value >> 11] |= 1 << (value >> 8 & 7);
+            break;
+        case REL:
+            address = (cpu->pc + 2 + (signed char) value) & 0xffff;
+            break;
+    }
+    if ((op->mode == ZPX || op->mode == ZPY || op->mode == ABX || op->mode == ABY
+    || op->mode == IZX || op->mode == IZY) && ((op->reads & LM) || (op->writes & LM) == 0))
+        indexed(cpu, address);
+    if ((op->mode == ABX || op->mode == ABY || op->mode == IZY) && (op->writes & LM) == 0
+    && ((address ^ value) & 0xff00) != 0)
+        cpu->cycles++;  /* Crossing a page */
+    cpu->pc = (cpu->pc + lengths[op->mode]) & 0xffff;
+    
+    /* Operand */
+    if (op->mode == IMM)
+        value &= 0xff;
+    else if (op->mode == ACC)
+        value = cpu->a;
+    else if ((op->reads & LM) != 0)
+        value = load_byte(cpu, address);
+    
+    switch (opcode) {
+        case 0x69: case 0x65: case 0x75: case 0x6d: case 0x7d: case 0x79: case 0x61: case 0x71:
+            add(cpu, value);
+            break;
+        case 0xe9: case 0xe5: case 0xf5: case 0xed: case 0xfd: case 0xf9: case 0xe1: case 0xf1:
+            subtract(cpu, value);
+            break;
+        case 0x29: case 0x25: case 0x35: case 0x2d: case 0x3d: case 0x39: case 0x21: case 0x31:
+            cpu->a &= value;
+            SET_NZ(cpu->a);
+            break;
+        case 0x09: case 0x05: case 0x15: case 0x0d: case 0x1d: case 0x19: case 0x01: case 0x11:
+            cpu->a |= value;
+            SET_NZ(cpu->a);
+            break;
+        case 0x49: case 0x45: case 0x55: case 0x4d: case 0x5d: case 0x59: case 0x41: case 0x51:
+            cpu->a ^= value;
+            SET_NZ(cpu->a);
+            break;
+        case 0xa9: case 0xa5: case 0xb5: case 0xad: case 0xbd: case 0xb9: case 0xa1: case 0xb1:
+            cpu->a = value;
+            SET_NZ(cpu->a);
+            break;
+        case 0xa2: case 0xa6: case 0xb6: case 0xae: case 0xbe:
+            cpu->x = value;
+            SET_NZ(cpu->x);
+            break;
+        case 0xa0: case 0xa4: case 0xb4: case 0xac: case 0xbc:
+            cpu->y = value;
+            SET_NZ(cpu->y);
+            break;
+        case 0x85: case 0x95: case 0x8d: case 0x9d: case 0x99: case 0x81: case 0x91:
+            store_byte(cpu, address, cpu->a);
+            break;
+        case 0x86: case 0x96: case 0x8e:
+            store_byte(cpu, address, cpu->x);
+            break;
+        case 0x84: case 0x94: case 0x8c:
+            store_byte(cpu, address, cpu->y);
+            break;
+        case 0xc9: case 0xc5: case 0xd5: case 0xcd: case 0xdd: case 0xd9: case 0xc1: case 0xd1:
+            cmp(cpu, cpu->a, value);
+            break;
+        case 0xe0: case 0xe4: case 0xec:
+            cmp(cpu, cpu->x, value);
+            break;
+        case 0xc0: case 0xc4: case 0xcc:
+            cmp(cpu, cpu->y, value);
+            break;
+        case 0x24: case 0x2c:
+            cpu->p = (cpu->p & ~(PN | PV | PZ)) | (value & (PN | PV)) | ((value & cpu->a) ? 0 : PZ);
+            break;
+        case 0x0a: case 0x06: case 0x16: case 0x0e: case 0x1e:     /* ASL */
+        case 0x4a: case 0x46: case 0x56: case 0x4e: case 0x5e:     /* LSR */
+        case 0x2a: case 0x26: case 0x36: case 0x2e: case 0x3e:     /* ROL */
+        case 0x6a: case 0x66: case 0x76: case 0x6e: case 0x7e:     /* ROR */
+            if (opcode < 0x40)
+                value = (value << 1) | (opcode >= 0x20 ? cpu->p & PC : 0);
+            else
+                value = (value >> 1) | (opcode >= 0x60 ? (cpu->p & PC) << 7 : 0) | (value & 1) << 8;
+            cpu->p = (cpu->p & ~PC) | (value >> 8);
+            value &= 0xff;
+            SET_NZ(value);
+            if (op->mode == ACC)
+                cpu->a = value;
+            else
+                store_byte(cpu, address, value);
+            break;
+        case 0xe6: case 0xf6: case 0xee: case 0xfe:
+            value = (value + 1) & 0xff;
+            SET_NZ(value);
+            store_byte(cpu, address, value);
+            break;
+        case 0xc6: case 0xd6: case 0xce: case 0xde:
+            value = (value - 1) & 0xff;
+            SET_NZ(value);
+            store_byte(cpu, address, value);
+            break;
+        case 0xe8: cpu->x++; SET_NZ(cpu->x); break;
+        case 0xca: cpu->x--; SET_NZ(cpu->x); break;
+        case 0xc8: cpu->y++; SET_NZ(cpu->y); break;
+        case 0x88: cpu->y--; SET_NZ(cpu->y); break;
+        case 0xaa: cpu->x = cpu->a; SET_NZ(cpu->x); break;
+        case 0xa8: cpu->y = cpu->a; SET_NZ(cpu->y); break;
+        case 0x8a: cpu->a = cpu->x; SET_NZ(cpu->a); break;
+        case 0x98: cpu->a = cpu->y; SET_NZ(cpu->a); break;
+        case 0xba: cpu->x = cpu->s; SET_NZ(cpu->x); break;
+        case 0x9a: cpu->s = cpu->x; break;
+        case 0x48: PUSH(cpu->a); break;
+        case 0x08: PUSH(cpu->p | 0x30); break;
+        case 0x68: cpu->a = PULL(); SET_NZ(cpu->a); break;
+        case 0x28: cpu->p = (PULL() & ~PB) | 0x20; break;
+        case 0x18: cpu->p &= ~PC; break;
+        case 0x38: cpu->p |= PC; break;
+        case 0x58: cpu->p &= ~PI; break;
+        case 0x78: cpu->p |= PI; break;
+        case 0xb8: cpu->p &= ~PV; break;
+        case 0xd8: cpu->p &= ~PD; break;
+        case 0xf8: cpu->p |= PD; break;
+        case 0xea: break;
+        case 0x10: case 0x30: case 0x50: case 0x70:     /* Branches */
+        case 0x90: case 0xb0: case 0xd0: case 0xf0:
+            switch (opcode >> 6) {
+                case 0: taken = cpu->p & PN; break;
+                case 1: taken = cpu->p & PV; break;
+                case 2: taken = cpu->p & PC; break;
+                default: taken = cpu->p & PZ; break;
+            }
+            if ((taken != 0) == ((opcode & 0x20) != 0)) {
+                cpu->cycles += ((address ^ cpu->pc) & 0xff00) ? 2 : 1;
+                cpu->pc = address;
+            }
+            break;
+        case 0x4c:
+            cpu->pc = address;
+            break;
+        case 0x6c:
+            cpu->pc = address;
+            dynamic(cpu, address);
+            break;
+        case 0x20:
+            PUSH((cpu->pc - 1) >> 8);
+            PUSH(cpu->pc - 1);
+            cpu->pc = address;
+            break;
+        case 0x00:
+            PUSH(cpu->pc >> 8);
+            PUSH(cpu->pc);
+            PUSH(cpu->p | 0x30);
+            cpu->p |= PI;
+            cpu->pc = fetch(cpu, 0xfffe) | fetch(cpu, 0xffff) << 8;
+            break;
+        case 0x60:
+            cpu->pc = PULL();
+            cpu->pc = ((cpu->pc | PULL() << 8) + 1) & 0xffff;
+            if (fetch(cpu, cpu->pc - 3) != 0x20) {  /* Not after a JSR */
+                dynamic(cpu, cpu->pc);
+                jumped(cpu, from);
+            }
+            break;
+        case 0x40:
+            cpu->p = (PULL() & ~PB) | 0x20;
+            cpu->pc = PULL();
+            cpu->pc |= PULL() << 8;
+            if (fetch(cpu, cpu->pc - 2) != 0x00) {  /* Not after a BRK */
+                dynamic(cpu, cpu->pc);
+                jumped(cpu, from);
+            }
+            break;
+    }
+    if ((op->writes & LM) && (op->mode == ZPX || op->mode == ZPY || op->mode == ABX || op->mode == ABY
+    || op->mode == IZX || op->mode == IZY)) {
+        scattered(cpu, address, fetch(cpu, address));
+        cleared(cpu, from, address, fetch(cpu, address));
+    }
+    if (cpu->bank != bank)      /* Continues in another bank */
+        dynamic(cpu, cpu->pc);
+}
+
+#undef PUSH
+#undef PULL
+
+/*
+ ** State of the interpreter at power on
+ */
+void power_on(struct cpu *cpu, struct context *ctx, int first, int start)
+{
+    memset(cpu, 0, sizeof(struct cpu));
+    cpu->ctx = ctx;
+    cpu->bank = first;
+    cpu->pc = start;
+    cpu->s = 0xfd;
+    cpu->p = 0x24;
+    cpu->timer = 0xff;
+    cpu->shift = 10;
+    memcpy(cpu->inputs, stimulus[0], 3);
+}
+
+/*
+ ** Run the ROM for some frames and queue the code reached through
+ ** jumps that static discovery can't follow.
+ */
+int trace(struct context *ctx, int first, int start, int frames)
+{
+    struct cpu *cpu;
+    struct bank *bank;
+    long total;
+    int found;
+    int c;
+    int d;
+    
+    cpu = malloc(sizeof(struct cpu));
+    if (cpu == NULL)
+        return -1;
+    power_on(cpu, ctx, first, start);
+    total = 0;
+    while (cpu->frames < frames && !cpu->halted) {
+        if (cpu->cycles - cpu->frame_start > 76 * 262 * 10) {   /* VSYNC stopped */
+            print(&ctx->log, "Trace stopped without VSYNC at $%04x\n", cpu->pc);
+            break;
+        }
+        step(cpu);
+        total++;
+    }
+    if (cpu->halted)
+        print(&ctx->log, "Trace stopped by opcode $%02x at $%04x\n", fetch(cpu, cpu->pc), cpu->pc);
+    found = 0;
+    for (c = 0; c < ctx->total_banks; c++) {
+        bank = &ctx->banks[c];
+        for (d = 0; d < 4096; d++) {
+            if ((bank->checked[d] & DYNAMIC) && (bank->checked[d] & BLOCK) == 0) {
+                target(bank, d);
+                found++;
+            }
+        }
+    }
+    print(&ctx->log, "Traced %d frames, %ld instructions, %d dynamic targets\n", cpu->frames, total, found);
+    ctx->frames = cpu->frames;
+    free(cpu);
+    return 0;
+}
+
+#define PROBE_RUNS  32      /* Random states tried on a subroutine */
+#define PROBE_STEPS 4096    /* Instructions it can take */
+
+/*
+ ** Run a subroutine alone from a state with the flags given, keeping
+ ** the state after it. Any access outside RAM and ROM, a bank switch
+ ** or a subroutine not returning in time make it fail, returns 0.
+ */
+int probe_run(struct cpu *cpu, struct context *ctx, int number, int entry, const byte *before, byte *after, int flags)
+{
+    int steps;
+    
+    power_on(cpu, ctx, number, entry);
+    cpu->probe = 1;
+    memcpy(cpu->ram, before, 128);
+    cpu->ram[0x7e] = 0xff;      /* Returns to $0000 */
+    cpu->ram[0x7f] = 0xff;
+    cpu->a = before[PROBE_A];
+    cpu->x = before[PROBE_X];
+    cpu->y = before[PROBE_Y];
+    cpu->p = 0x24 | (flags & (PN | PV | PZ | PC));
+    for (steps = 0; steps < PROBE_STEPS && !cpu->halted && cpu->pc != 0 && cpu->bank == number; steps++)
+        step(cpu);
+    if (cpu->pc != 0 || cpu->halted || cpu->bank != number || cpu->s != 0xff)
+        return 0;
+    memcpy(after, cpu->ram, 128);
+    after[PROBE_A] = cpu->a;
+    after[PROBE_X] = cpu->x;
+    after[PROBE_Y] = cpu->y;
+    return 1;
+}
+
+/*
+ ** Run a subroutine alone from random states, keeping each state
+ ** before and after it. Returns 0 if a run fails.
+ */
+int probe(struct context *ctx, int number, int entry, byte before[][PROBE_SLOTS], byte after[][PROBE_SLOTS])
+{
+    struct cpu *cpu;
+    unsigned seed;
+    int run;
+    int c;
+    
+    cpu = malloc(sizeof(struct cpu));
+    if (cpu == NULL)
+        return 0;
+    seed = entry;
+    for (run = 0; run < PROBE_RUNS; run++) {
+        for (c = 0; c < PROBE_SLOTS; c++) {
+            seed = seed * 1103515245 + 12345;
+            before[run][c] = run == 0 ? 0xff : seed >> 16;
+        }
+        before[run][0x7e] = 0xff;
+        before[run][0x7f] = 0xff;
+        if (!probe_run(cpu, ctx, number, entry, before[run], after[run], seed >> 8))
+            break;
+    }
+    free(cpu);
+    return run == PROBE_RUNS;
+}
+
+/*
+ ** Check if a place gets the values expected in the runs used
+ */
+int matches(byte after[][PROBE_SLOTS], int where, const int *used, const int *expected)
+{
+    int run;
+    
+    for (run = 0; run < PROBE_RUNS; run++) {
+        if (used[run] && after[run][where] != (expected[run] & 0xff))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ ** Check if the states are those of a multiply or a divide of two
+ ** places, and find what each place written gets
+ */
+int operation(struct native *n, byte before[][PROBE_SLOTS], byte after[][PROBE_SLOTS])
+{
+    int expected[5][PROBE_RUNS];
+    int used[PROBE_RUNS];
+    int total;
+    int where;
+    int kind;
+    int run;
+    int u;
+    int v;
+    int c;
+    
+    total = 0;
+    for (run = 0; run < PROBE_RUNS; run++) {
+        u = before[run][n->inputs[0]];
+        v = before[run][n->inputs[1]];
+        used[run] = n->operation == '*' || v != 0;
+        total += used[run];
+        expected[1][run] = n->operation == '*' ? u * v : used[run] ? u / v * 256 + u % v : 0;
+        expected[2][run] = expected[1][run] >> 8;
+        expected[3][run] = u;
+        expected[4][run] = v;
+    }
+    if (total < PROBE_RUNS / 2)
+        return 0;
+    n->total = 0;
+    n->unknown = 0;
+    kind = 0;
+    for (where = 0; where < PROBE_SLOTS; where++) {
+        for (run = 0; run < PROBE_RUNS && (!used[run] || before[run][where] == after[run][where]); run++) ;
+        if (run == PROBE_RUNS)      /* Not changed */
+            continue;
+        for (c = 0; c < PROBE_RUNS; c++)
+            expected[0][c] = after[run][where];
+        for (c = 0; c < 5 && !matches(after, where, used, expected[c]); c++) ;
+        if (c == 5 && where >= PROBE_A) {
+            n->unknown |= VA << (where - PROBE_A);
+            continue;
+        }
+        if (c == 5 || n->total == 8)
+            return 0;
+        n->places[n->total] = where;
+        n->values[n->total++] = c == 0 ? after[run][where] : c == 1 ? PROBE_LOW : c == 2 ? PROBE_HIGH : PROBE_COPY + c - 3;
+        kind |= c == 1 || c == 2;
+    }
+    return kind;
+}
+
+/*
+ ** Confirm a multiply or divide found over the random states with
+ ** every pair of operands, the places written must get what the
+ ** IntyBASIC operation leaves and the others stay the same. A divide
+ ** by zero is taken as a restoring division does it (a quotient of
+ ** $FFFF and the dividend as remainder, the same in -v), so it must
+ ** leave 255 and the dividend like the usual shift and subtract
+ ** routines.
+ */
+int confirm(struct context *ctx, int number, int entry, struct native *n, const byte *base)
+{
+    struct cpu *cpu;
+    byte before[PROBE_SLOTS];
+    byte after[PROBE_SLOTS];
+    int expected;
+    int where;
+    int result;
+    int same;
+    int u;
+    int v;
+    int c;
+    
+    cpu = malloc(sizeof(struct cpu));
+    if (cpu == NULL)
+        return 0;
+    memcpy(before, base, PROBE_SLOTS);
+    same = 1;
+    for (u = 0; u < 256 && same; u++) {
+        for (v = 0; v < 256 && same; v++) {
+            before[n->inputs[0]] = u;
+            before[n->inputs[1]] = v;
+            same = probe_run(cpu, ctx, number, entry, before, after, u * 7 + v);
+            if (n->operation == '*')
+                result = u * v;
+            else if (v != 0)
+                result = u / v * 256 + u % v;
+            else
+                result = 0xff00 + u;
+            for (where = 0; where < PROBE_SLOTS && same; where++) {
+                for (c = 0; c < n->total && n->places[c] != where; c++) ;
+                if (c == n->total && where >= PROBE_A && (n->unknown & (VA << (where - PROBE_A))))
+                    continue;
+                if (c == n->total)
+                    expected = before[where];
+                else if (n->values[c] == PROBE_LOW)
+                    expected = result & 0xff;
+                else if (n->values[c] == PROBE_HIGH)
+                    expected = result >> 8;
+                else if (n->values[c] >= PROBE_COPY)
+                    expected = n->values[c] == PROBE_COPY ? u : v;
+                else
+                    expected = n->values[c];
+                same = after[where] == expected;
+            }
+        }
+    }
+    free(cpu);
+    return same;
+}
+
+/*
+ ** Recognize a multiply or divide subroutine, running it from random
+ ** states and trying the places it reads as operands, and confirming
+ ** the one found with every pair of operands. Returns its index in
+ ** natives, or -1.
+ */
+int recognize(struct context *ctx, struct bank *bank, int entry, int *list, int blocks)
+{
+    byte (*before)[PROBE_SLOTS];
+    byte (*after)[PROBE_SLOTS];
+    struct native n;
+    struct native *natives;
+    struct block *b;
+    int places[PROBE_SLOTS];
+    int total;
+    int address;
+    int found;
+    int c;
+    int d;
+    
+    before = malloc(2 * PROBE_RUNS * PROBE_SLOTS);
+    if (before == NULL)
+        return -1;
+    after = before + PROBE_RUNS;
+    found = 0;
+    if (probe(ctx, bank->number, bank->blocks[entry].start, before, after)) {
+        places[0] = PROBE_A;
+        places[1] = PROBE_X;
+        places[2] = PROBE_Y;
+        total = 3;
+        for (c = 0; c < blocks; c++) {
+            b = &bank->blocks[list[c]];
+            for (address = b->start; address < b->end; address += lengths[opcodes[R(address)].mode]) {
+                d = direct(bank, address);
+                if (d >= 0 && d < 0xfe) {
+                    for (d = 0; d < total && places[d] != (direct(bank, address) & 0x7f); d++) ;
+                    if (d == total)
+                        places[total++] = direct(bank, address) & 0x7f;
+                }
+            }
+        }
+        n.operation = '*';
+        while (1) {
+            for (c = 0; c < total && !found; c++) {
+                for (d = 0; d < total && !found; d++) {
+                    n.inputs[0] = places[c];
+                    n.inputs[1] = places[d];
+                    found = c != d && operation(&n, before, after)
+                            && confirm(ctx, bank->number, bank->blocks[entry].start, &n, before[1]);
+                }
+            }
+            if (found || n.operation == '/')
+                break;
+            n.operation = '/';
+        }
+    }
+    free(before);
+    if (!found)
+        return -1;
+    natives = realloc(ctx->natives, (ctx->total_natives + 1) * sizeof(struct native));
+    if (natives == NULL)
+        return -1;
+    ctx->natives = natives;
+    natives[ctx->total_natives] = n;
+    return ctx->total_natives++;
+}
+
+/*
+ ** Write the JSR to multiply and divide subroutines as the operation,
+ ** when the flags and the registers it leaves with other values
+ ** aren't used after the call
+ */
+void native_calls(struct context *ctx)
+{
+    struct bank *bank;
+    struct block *b;
+    int *mark;
+    int *list;
+    int *tried;
+    int subroutines;
+    int calls;
+    int blocks;
+    int size;
+    int live;
+    int c;
+    int d;
+    
+    mark = malloc(4096 * 3 * sizeof(int));
+    if (mark == NULL) {
+        ctx->log.failed = 1;
+        return;
+    }
+    list = mark + 4096;
+    tried = list + 4096;
+    subroutines = 0;
+    calls = 0;
+    for (c = 0; c < ctx->total_banks; c++) {
+        bank = &ctx->banks[c];
+        for (d = 0; d < bank->total_blocks; d++) {
+            mark[d] = -1;
+            tried[d] = 0;
+        }
+        for (b = bank->blocks; b < bank->blocks + bank->total_blocks; b++) {
+            if (R(b->last) != 0x20 || bank->calls[b->last & 0x0fff] != C_GOSUB
+            || bank->switched[b->last & 0x0fff] >= 0 || bank->decimal[b->last & 0x0fff] != D_BINARY)
+                continue;
+            d = bank->block_at[destination(bank, b->last) & 0x0fff];
+            if (d < 0)
+                continue;
+            if (!tried[d]) {
+                tried[d] = 1;
+                if ((subroutine(bank, d, mark, list, &blocks, &size) & (S_LEAF | S_STACK | S_UNSAFE)) == S_LEAF
+                && (bank->blocks[d].native = recognize(ctx, bank, d, list, blocks) + 1) > 0)
+                    subroutines++;
+            }
+            live = entry_live(bank, b->end);
+            if (bank->blocks[d].native == 0 || (live & (FN | FZ | FC | FV))
+            || (live & ctx->natives[bank->blocks[d].native - 1].unknown))
+                continue;
+            bank->calls[b->last & 0x0fff] = C_NATIVE;
+            calls++;
+        }
+    }
+    free(mark);
+    print(&ctx->log, "Multiply and divide: %d subroutine%s, %d call%s written as the operation\n",
+          subroutines, subroutines == 1 ? "" : "s", calls, calls == 1 ? "" : "s");
+}
+
+/*
+ ** Differential verification. The ROM runs on the interpreter and
+ ** at the start of each block the IntyBASIC statements of the block
+ ** run over a copy of the state. When the 6502 leaves the block the
+ ** RAM, the TIA registers, s, the registers and flags live at the
+ ** exit and the place where execution continues must be the same.
+ */
+#define MAX_CALLS   64
+
+/*
+ ** IntyBASIC program being run, the memory and the registers a, x, y
+ ** and s are the ones of the 6502 copy.
+ */
+struct bstate {
+    struct cpu cpu;
+    int n;                      /* Flags as variables */
+    int z;
+    int c;
+    int v;
+    int t;                      /* #t */
+    long start;                 /* Cycles at the start of the block */
+};
+
+/*
+ ** State of the verification
+ */
+struct verifier {
+    struct context *ctx;
+    struct cpu cpu;             /* Reference */
+    char **texts;               /* Statements of each block, bank * 4096 + block */
+    byte *reported;             /* Blocks already reported */
+    int calls[MAX_CALLS];       /* Return addresses of GOSUB, bank * 65536 + address */
+    int total_calls;
+    long executed;              /* Blocks executed */
+    long outside;               /* Instructions run outside blocks */
+    int differ;                 /* Blocks reported */
+    struct bstate carried;      /* IntyBASIC registers and flags left by the last block */
+    int carry;                  /* Set while both went to the same place */
+    int previous;               /* Last block, bank * 4096 + block */
+};
+
+/*
+ ** How a block ends in IntyBASIC
+ */
+#define B_FALL      0   /* Continues with the next block */
+#define B_GOTO      1
+#define B_GOSUB     2
+#define B_RETURN    3
+#define B_FAILED    4   /* Statement that can't be run */
+
+void b_expression(struct parser *ps, int level, int *value);
+
+/*
+ ** Bank and address of a label, -1 if the text isn't a label
+ */
+int label_address(struct context *ctx, const char *p, int *number)
+{
+    char *end;
+    
+    *number = 0;
+    if (*p == 'B') {
+        *number = strtol(p + 1, &end, 10);
+        p = end;
+    }
+    if (*p != 'L' || *number >= ctx->total_banks || !isxdigit(p[1]))
+        return -1;
+    return strtol(p + 1, NULL, 16);
+}
+
+/*
+ ** Read or write an IntyBASIC array, the value is written if not NULL
+ */
+int b_access(struct parser *ps, const char *name, int length, int index, int *value)
+{
+    struct bstate *b;
+    int address;
+    int number;
+    
+    b = ps->state;
+    if (length == 2 && memcmp(name, "zp", 2) == 0) {
+        if (index > 0xff) {     /* Out of the array */
+            ps->failed = 1;
+            return 0;
+        }
+        address = index;
+    } else if (length == 3 && memcmp(name, "mem", 3) == 0) {
+        address = index;
+    } else if ((address = label_address(b->cpu.ctx, name, &number)) >= 0) {
+        address = (address + index) & 0xffff;
+        if (address & 0x1000) {     /* ROM */
+            if (value != NULL)
+                return 0;
+            return b->cpu.ctx->banks[number].rom[address & 0x0fff];
+        }
+    } else {
+        ps->failed = 1;
+        return 0;
+    }
+    if (value != NULL) {
+        store_byte(&b->cpu, address, *value);
+        return 0;
+    }
+    return load_byte(&b->cpu, address);
+}
+
+/*
+ ** Value of an IntyBASIC variable, NULL for unknown names
+ */
+int *b_variable(struct bstate *b, const char *name, int length, int *s)
+{
+    static const char names[] = "axysnzcv";
+    const char *p;
+    
+    if (length == 2 && memcmp(name, "#t", 2) == 0)
+        return &b->t;
+    if (length == 4 && memcmp(name, "zp", 2) == 0 && isxdigit(name[2]) && isxdigit(name[3])) {
+        *s = load_byte(&b->cpu, strtol(name + 2, NULL, 16));    /* Promoted */
+        return s;
+    }
+    if (length != 1 || (p = strchr(names, *name)) == NULL)
+        return NULL;
+    switch (p - names) {
+        case 0: *s = b->cpu.a; break;
+        case 1: *s = b->cpu.x; break;
+        case 2: *s = b->cpu.y; break;
+        case 3: *s = b->cpu.s; break;
+        case 4: return &b->n;
+        case 5: return &b->z;
+        case 6: return &b->c;
+        case 7: return &b->v;
+    }
+    return s;
+}
+
+/*
+ ** Evaluate an IntyBASIC primary expression
+ */
+void b_primary(struct parser *ps, int *value)
+{
+    const char *s;
+    char *end;
+    int length;
+    int index;
+    int scratch;
+    int *var;
+    
+    *value = 0;
+    while (*ps->p == ' ')
+        ps->p++;
+    s = ps->p;
+    if (*ps->p == '(') {
+        ps->p++;
+        b_expression(ps, 0, value);
+        if (*ps->p != ')')
+            ps->failed = 1;
+        ps->p++;
+    } else if (*ps->p == '$') {
+        *value = strtol(ps->p + 1, &end, 16) & 0xffff;
+        ps->p = end;
+    } else if (isdigit(*ps->p)) {
+        *value = strtol(ps->p, &end, 10) & 0xffff;
+        ps->p = end;
+    } else if (*ps->p == '#' || isalpha(*ps->p)) {
+        ps->p++;
+        while (isalnum(*ps->p))
+            ps->p++;
+        length = ps->p - s;
+        if (*ps->p == '(') {    /* Array */
+            ps->p++;
+            b_expression(ps, 0, &index);
+            if (*ps->p != ')') {
+                ps->failed = 1;
+                return;
+            }
+            ps->p++;
+            *value = b_access(ps, s, length, index, NULL);
+        } else if ((var = b_variable(ps->state, s, length, &scratch)) != NULL) {
+            *value = *var;
+        } else {
+            ps->failed = 1;
+        }
+    } else {
+        ps->failed = 1;
+    }
+}
+
+/*
+ ** Evaluate an IntyBASIC expression from a precedence level, with
+ ** 16-bit values as IntyBASIC does.
+ */
+void b_expression(struct parser *ps, int level, int *value)
+{
+    const char *op;
+    int right;
+    
+    if (level == LEVEL_NOT || level == LEVEL_MINUS) {
+        op = operator_at(ps, level);
+        if (op == NULL) {
+            if (level == LEVEL_MINUS)
+                b_primary(ps, value);
+            else
+                b_expression(ps, level + 1, value);
+            return;
+        }
+        b_expression(ps, level, &right);
+        *value = (level == LEVEL_MINUS ? -right : ~right) & 0xffff;
+        return;
+    }
+    b_expression(ps, level + 1, value);
+    while (!ps->failed && (op = operator_at(ps, level)) != NULL) {
+        b_expression(ps, level + 1, &right);
+        if ((strcmp(op, "/") == 0 || strcmp(op, "%") == 0) && right == 0)     /* Restoring division */
+            *value = strcmp(op, "/") == 0 ? 0xffff : *value;
+        else if (strcmp(op, "/") == 0)
+            *value = *value / right;
+        else if (strcmp(op, "%") == 0)
+            *value = *value % right;
+        else if (strcmp(op, "<") == 0)
+            *value = -(*value < right);
+        else if (strcmp(op, ">") == 0)
+            *value = -(*value > right);
+        else if (strcmp(op, "<=") == 0)
+            *value = -(*value <= right);
+        else if (strcmp(op, ">=") == 0)
+            *value = -(*value >= right);
+        else
+            fold(op, *value, right, value);
+        *value &= 0xffff;
+    }
+}
+
+/*
+ ** Evaluate a piece of statement, returns zero if it can't
+ */
+int b_evaluate(struct bstate *b, const char *text, int len, int *value)
+{
+    struct parser ps;
+    char copy[256];
+    
+    if (len >= (int) sizeof(copy))
+        return 0;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    ps.p = copy;
+    ps.state = b;
+    ps.failed = 0;
+    b_expression(&ps, 0, value);
+    while (*ps.p == ' ')
+        ps.p++;
+    return !ps.failed && *ps.p == '\0';
+}
+
+/*
+ ** Run an IntyBASIC statement, returns how the block continues
+ */
+int b_statement(struct bstate *b, const char *text, int *number, int *address)
+{
+    struct parser ps;
+    const char *p;
+    int scratch;
+    int value;
+    int index;
+    int *var;
+    int c;
+    
+    if (text[0] == '\'')
+        return B_FALL;
+    if (memcmp(text, "GOTO ", 5) == 0 || memcmp(text, "GOSUB ", 6) == 0) {
+        *address = label_address(b->cpu.ctx, strchr(text, ' ') + 1, number);
+        if (*address < 0)
+            return B_FAILED;
+        return text[2] == 'T' ? B_GOTO : B_GOSUB;
+    }
+    if (strcmp(text, "RETURN") == 0)
+        return B_RETURN;
+    if (memcmp(text, "ON ", 3) == 0) {
+        p = strstr(text, " GOTO ");
+        if (p == NULL || !b_evaluate(b, text + 3, p - text - 3, &value))
+            return B_FAILED;
+        for (p += 6; value > 0 && p != NULL; value--) {
+            p = strchr(p, ',');
+            if (p != NULL)
+                p += 2;
+        }
+        if (p == NULL)      /* Out of the list */
+            return B_FALL;
+        *address = label_address(b->cpu.ctx, p, number);
+        return *address < 0 ? B_FAILED : B_GOTO;
+    }
+    if (memcmp(text, "IF ", 3) == 0) {
+        p = strstr(text, " THEN GOTO ");
+        if (p == NULL || !b_evaluate(b, text + 3, p - text - 3, &value))
+            return B_FAILED;
+        if (value == 0)
+            return B_FALL;
+        *address = label_address(b->cpu.ctx, p + 11, number);
+        return *address < 0 ? B_FAILED : B_GOTO;
+    }
+    c = assignment(text);
+    if (c < 0 || !b_evaluate(b, text + c + 2, strlen(text + c + 2), &value))
+        return B_FAILED;
+    if (text[c - 2] != ')') {   /* Variable */
+        var = b_variable(b, text, c - 1, &scratch);
+        if (var == NULL)
+            return B_FAILED;
+        if (var != &scratch) {
+            *var = value & (var == &b->t ? 0xffff : 0xff);
+        } else {
+            switch (text[0]) {
+                case 'a': b->cpu.a = value; break;
+                case 'x': b->cpu.x = value; break;
+                case 'y': b->cpu.y = value; break;
+                case 's': b->cpu.s = value; break;
+                case 'z': store_byte(&b->cpu, strtol(text + 2, NULL, 16), value); break;
+            }
+        }
+        return B_FALL;
+    }
+    p = strchr(text, '(');
+    if (p == NULL || !b_evaluate(b, p + 1, text + c - 2 - p - 1, &index))
+        return B_FAILED;
+    ps.state = b;
+    ps.failed = 0;
+    value &= 0xff;
+    b_access(&ps, text, p - text, index, &value);
+    return ps.failed ? B_FAILED : B_FALL;
+}
+
+/*
+ ** Statements of a block as lines with the cycles used by the
+ ** 6502 up to the end of its instruction, so the reads of the RIOT
+ ** timer give the same values. A branch fused with the instruction
+ ** setting its flag reads the operands when that one did.
+ */
+char *block_text(struct bank *bank, int c)
+{
+    struct context *ctx;
+    struct insn *insn;
+    struct insn *setter;
+    struct stmt *stmt;
+    struct buffer text;
+    long used;
+    long at;
+    
+    ctx = bank->ctx;
+    lower_block(bank, c);
+    memset(&text, 0, sizeof(text));
+    used = 0;
+    for (insn = ctx->insns; insn < ctx->insns + ctx->total_insns; insn++) {
+        used += cycles[R(insn->address)];
+        at = used;
+        if (insn->type == I_BRANCH) {
+            at = 0;
+            for (setter = ctx->insns; setter < insn; setter++) {
+                at += cycles[R(setter->address)];
+                if (setter->address == bank->fused[insn->address & 0x0fff])
+                    break;
+            }
+            if (setter == insn)
+                at = used;
+        }
+        for (stmt = ctx->stmts + insn->first; stmt < ctx->stmts + insn->first + insn->total; stmt++) {
+            if (stmt->keep)
+                print(&text, "%ld %s\n", at, ctx->pool.data + stmt->text);
+        }
+    }
+    if (ctx->pool.failed)
+        text.failed = 1;
+    if (text.data == NULL && !text.failed)
+        text.data = calloc(1, 1);
+    if (text.failed) {
+        free(text.data);
+        return NULL;
+    }
+    return text.data;
+}
+
+/*
+ ** Check if two places of the ROM are the same, the upper 2K of
+ ** Tigervision is the same for all banks.
+ */
+int same_place(struct context *ctx, int number1, int address1, int number2, int address2)
+{
+    if (((address1 ^ address2) & 0x1fff) != 0 || (address1 & 0x1000) == 0)
+        return 0;
+    return number1 == number2 || (ctx->scheme == T3F && (address1 & 0x0800));
+}
+
+/*
+ ** Report a difference, the first one of a block starts with its label
+ */
+void differ(struct verifier *v, struct bank *bank, int c, int *header, const char *format, ...)
+{
+    char line[256];
+    va_list ap;
+    
+    if (!*header) {
+        print(&v->ctx->output, "%s:\n", label(v->ctx, bank->number, bank->blocks[c].start));
+        *header = 1;
+    }
+    va_start(ap, format);
+    vsnprintf(line, sizeof(line), format, ap);
+    va_end(ap);
+    print(&v->ctx->output, "\t' %s\n", line);
+}
+
+/*
+ ** Run a block in both ways and compare the results
+ */
+void verify_block(struct verifier *v, struct bank *bank, int c)
+{
+    static const char *flag_names[] = {"n", "z", "c", "v"};
+    struct context *ctx;
+    struct opcode *op;
+    struct block *blk;
+    struct bstate *b;
+    struct cpu *cpu;
+    char line[256];
+    const char *text;
+    const char *map;
+    const char *p;
+    char *end;
+    int outcome;
+    int number;
+    int address;
+    int header;
+    int previous;
+    int carried;
+    int hotspot;
+    int adjust;
+    int pushed;
+    int live;
+    int at;
+    int d;
+    int e;
+    
+    ctx = v->ctx;
+    cpu = &v->cpu;
+    blk = &bank->blocks[c];
+    if (v->texts[bank->number * 4096 + c] == NULL) {
+        v->texts[bank->number * 4096 + c] = block_text(bank, c);
+        if (v->texts[bank->number * 4096 + c] == NULL) {
+            ctx->output.failed = 1;
+            return;
+        }
+    }
+    text = v->texts[bank->number * 4096 + c];
+    v->executed++;
+    
+    /* IntyBASIC over a copy */
+    b = malloc(sizeof(struct bstate));
+    if (b == NULL) {
+        ctx->output.failed = 1;
+        return;
+    }
+    b->cpu = *cpu;
+    b->n = cpu->p & PN;
+    b->z = (cpu->p & PZ) ? 1 : 0;
+    b->c = cpu->p & PC;
+    b->v = cpu->p & PV;
+    b->t = 0;
+    carried = 0;
+    if (v->carry) {     /* Registers and flags the optimizer left in the last block */
+        b->cpu.a = v->carried.cpu.a;
+        b->cpu.x = v->carried.cpu.x;
+        b->cpu.y = v->carried.cpu.y;
+        b->n = v->carried.n;
+        b->z = v->carried.z;
+        b->c = v->carried.c;
+        b->v = v->carried.v;
+        b->t = v->carried.t;
+        carried = b->cpu.a != cpu->a || b->cpu.x != cpu->x || b->cpu.y != cpu->y
+            || ((b->n & 0x80) != 0) != ((cpu->p & PN) != 0) || (b->z != 0) != ((cpu->p & PZ) != 0)
+            || b->c != (cpu->p & PC) || (b->v != 0) != ((cpu->p & PV) != 0);
+    }
+    b->start = cpu->cycles;
+    outcome = B_FALL;
+    number = bank->number;
+    address = blk->end;
+    p = text;
+    while (*p && outcome == B_FALL) {
+        b->cpu.cycles = b->start + strtol(p, &end, 10);
+        p = strchr(end, '\n') + 1;
+        snprintf(line, sizeof(line), "%.*s", (int) (p - end - 2), end + 1);
+        outcome = b_statement(b, line, &number, &address);
+    }
+    if (outcome == B_FALL) {
+        number = bank->number;
+        address = listed_after(bank, blk->end);
+    }
+    
+    /* The 6502, a JSR into code that switches banks goes until the switch */
+    do {
+        at = cpu->pc;
+        step(cpu);
+    } while (!cpu->halted && ADDR(at) != blk->last && cpu->bank == bank->number
+             && ADDR(cpu->pc) > ADDR(at) && ADDR(cpu->pc) < blk->end) ;
+    if (bank->wide[blk->last & 0x0fff] == W_CARRY && ADDR(cpu->pc) == blk->end && cpu->bank == bank->number)
+        step(cpu);      /* The INC of the high byte goes with the chain */
+    if (opcodes[R(blk->last)].kind == CALL && bank->switched[blk->last & 0x0fff] >= 0) {
+        for (d = 0; d < 256 && cpu->bank == bank->number && !cpu->halted; d++)
+            step(cpu);
+    }
+    
+    /*
+     ** An inlined subroutine goes until it returns, a JSR written as
+     ** GOTO leaves its return address, and the RTS after it returns
+     ** at once. The return address written by JSR doesn't matter.
+     */
+    adjust = 0;
+    pushed = -1;
+    if (R(blk->last) == 0x20 && ADDR(at) == blk->last && bank->calls[blk->last & 0x0fff] != C_GOSUB) {
+        pushed = cpu->s;
+        if (bank->calls[blk->last & 0x0fff] == C_TAIL)
+            adjust = 2;
+        for (d = 0; d < 4096 && adjust == 0 && !cpu->halted
+             && (cpu->bank != bank->number || ADDR(cpu->pc) != blk->end); d++)
+            step(cpu);
+    }
+    while (!cpu->halted && (cpu->pc & 0x1000) && fetch(cpu, cpu->pc) == 0x60 && fetch(cpu, cpu->pc - 3) == 0x20
+           && ctx->banks[cpu->bank].calls[(cpu->pc - 3) & 0x0fff] == C_TAIL) {
+        step(cpu);
+        adjust -= 2;
+    }
+    
+    /* The stack of the 6502 for GOSUB and RETURN */
+    if (outcome == B_GOSUB) {
+        at += 2;
+        store_byte(&b->cpu, 0x100 | b->cpu.s--, at >> 8);
+        store_byte(&b->cpu, 0x100 | b->cpu.s--, at);
+        if (R(blk->last) == 0x00) {
+            store_byte(&b->cpu, 0x100 | b->cpu.s--, (b->n & 0x80) | (b->v ? 0x40 : 0) | (b->z ? 2 : 0) | (b->c & 1)
+                       | (v->cpu.p & (PI | PD)) | 0x30);
+        }
+        if (v->total_calls < MAX_CALLS)
+            v->calls[v->total_calls++] = bank->number * 65536 + blk->end;
+    } else if (outcome == B_RETURN) {
+        b->cpu.s += R(blk->last) == 0x40 ? 3 : 2;
+        if (v->total_calls > 0) {
+            v->total_calls--;
+            number = v->calls[v->total_calls] / 65536;
+            address = v->calls[v->total_calls] % 65536;
+        } else {
+            number = cpu->bank;     /* Nothing to compare */
+            address = cpu->pc;
+        }
+    }
+    
+    /* The values read from a hotspot don't matter */
+    op = &opcodes[R(blk->last)];
+    hotspot = 0;
+    if (op->kind == OP && bank->switched[blk->last & 0x0fff] >= 0)
+        hotspot = op->defs | VAR(op->writes);
+    
+    /* The registers and flags go on while both follow the same path,
+       taking from the 6502 what a hotspot gave */
+    v->carry = outcome != B_FAILED && !v->reported[bank->number * 4096 + c]
+        && same_place(ctx, number, address, cpu->bank, cpu->pc);
+    v->carried = *b;
+    if (hotspot & VA)
+        v->carried.cpu.a = cpu->a;
+    if (hotspot & VX)
+        v->carried.cpu.x = cpu->x;
+    if (hotspot & VY)
+        v->carried.cpu.y = cpu->y;
+    if (hotspot & FN)
+        v->carried.n = cpu->p & PN;
+    if (hotspot & FZ)
+        v->carried.z = (cpu->p & PZ) ? 1 : 0;
+    if (hotspot & FC)
+        v->carried.c = cpu->p & PC;
+    if (hotspot & FV)
+        v->carried.v = cpu->p & PV;
+    previous = v->previous;
+    v->previous = bank->number * 4096 + c;
+    if (v->reported[bank->number * 4096 + c]) {
+        free(b);
+        return;
+    }
+    
+    /* Compare */
+    live = blk->live_out & ~hotspot;
+    header = 0;
+    if (outcome == B_FAILED)
+        differ(v, bank, c, &header, "Can't run a statement");
+    else if (!same_place(ctx, number, address, cpu->bank, cpu->pc))
+        differ(v, bank, c, &header, "Goes to %s, expected %s", label(ctx, number, address),
+               (cpu->pc & 0x1000) ? label(ctx, cpu->bank, cpu->pc) : "RAM");
+    if ((live & VA) && b->cpu.a != cpu->a)
+        differ(v, bank, c, &header, "a = $%02X, expected $%02X", b->cpu.a, cpu->a);
+    if ((live & VX) && b->cpu.x != cpu->x)
+        differ(v, bank, c, &header, "x = $%02X, expected $%02X", b->cpu.x, cpu->x);
+    if ((live & VY) && b->cpu.y != cpu->y)
+        differ(v, bank, c, &header, "y = $%02X, expected $%02X", b->cpu.y, cpu->y);
+    if (b->cpu.s != ((cpu->s + adjust) & 0xff))
+        differ(v, bank, c, &header, "s = $%02X, expected $%02X", b->cpu.s, (cpu->s + adjust) & 0xff);
+    for (d = 0; d < 4; d++) {
+        if ((live & (1 << d)) == 0)
+            continue;
+        switch (d) {
+            case 0: e = ((b->n & 0x80) != 0) == ((cpu->p & PN) != 0); break;
+            case 1: e = (b->z != 0) == ((cpu->p & PZ) != 0); break;
+            case 2: e = b->c == (cpu->p & PC); break;
+            default: e = (b->v != 0) == ((cpu->p & PV) != 0); break;
+        }
+        if (!e)
+            differ(v, bank, c, &header, "%s differs from the 6502 flag", flag_names[d]);
+    }
+    for (d = 0; d < 128; d++) {
+        if (pushed >= 0 && (d == ((pushed + 1) & 0x7f) || d == ((pushed + 2) & 0x7f)))
+            continue;
+        if (b->cpu.ram[d] != cpu->ram[d])
+            differ(v, bank, c, &header, "zp($%02X) = $%02X, expected $%02X", d | 0x80, b->cpu.ram[d], cpu->ram[d]);
+    }
+    for (d = 0; d < 64; d++) {     /* The writes dropped by the register map don't count */
+        map = ctx->registers[H_WRITE][d].basic;
+        if (b->cpu.tia[d] != cpu->tia[d] && (ctx->scheme != T3F || d != 0x3f) && (map == NULL || map[0] != '\0'))
+            differ(v, bank, c, &header, "zp($%02X) = $%02X, expected $%02X", d, b->cpu.tia[d], cpu->tia[d]);
+    }
+    if (header) {
+        if (carried) {
+            differ(v, bank, c, &header, "Starts with the registers and flags left by %s",
+                   label(ctx, previous / 4096, ctx->banks[previous / 4096].blocks[previous % 4096].start));
+        }
+        v->carry = 0;   /* Starts again from the 6502 */
+        for (p = text; *p; p = end + 1) {
+            end = strchr(p, '\n');
+            while (isdigit(*p))
+                p++;
+            print(&ctx->output, "\t%.*s\n", (int) (end - p - 1), p + 1);
+        }
+        v->reported[bank->number * 4096 + c] = 1;
+        v->differ++;
+    }
+    free(b);
+}
+
+/*
+ ** Verify the IntyBASIC program against the 6502 for some frames,
+ ** the report is the output.
+ */
+int verify(struct context *ctx, int first, int start, int frames)
+{
+    struct verifier *v;
+    struct bank *bank;
+    int c;
+    
+    v = calloc(1, sizeof(struct verifier));
+    if (v == NULL)
+        return -1;
+    v->ctx = ctx;
+    v->texts = calloc(ctx->total_banks * 4096, sizeof(char *));
+    v->reported = calloc(ctx->total_banks * 4096, 1);
+    if (v->texts == NULL || v->reported == NULL) {
+        free(v->texts);
+        free(v->reported);
+        free(v);
+        return -1;
+    }
+    ctx->step = 2;
+    power_on(&v->cpu, ctx, first, start);
+    print(&ctx->output, "' Verification of the IntyBASIC program against the 6502\n\n");
+    while (v->cpu.frames < frames && !v->cpu.halted && !ctx->output.failed) {
+        if (v->cpu.cycles - v->cpu.frame_start > 76 * 262 * 10)
+            break;
+        bank = &ctx->banks[v->cpu.bank];
+        c = (v->cpu.pc & 0x1000) ? bank->block_at[v->cpu.pc & 0x0fff] : -1;
+        if (c >= 0) {
+            verify_block(v, bank, c);
+        } else {
+            step(&v->cpu);
+            v->outside++;
+            v->carry = 0;
+        }
+    }
+    print(&ctx->output, "\n' %d frames, %ld blocks run, %ld instructions outside blocks\n",
+          v->cpu.frames, v->executed, v->outside);
+    print(&ctx->output, "' %d blocks differ\n", v->differ);
+    if (v->cpu.halted)
+        print(&ctx->output, "' Stopped by opcode $%02X at $%04X\n", fetch(&v->cpu, v->cpu.pc), v->cpu.pc);
+    for (c = 0; c < ctx->total_banks * 4096; c++)
+        free(v->texts[c]);
+    free(v->texts);
+    free(v->reported);
+    free(v);
+    return 0;
+}
 
-typedef unsigned char byte;
+/*
+ ** Start of a CP1610 program: the memory used for the zero page and
+ ** the state of the 6502, change it to suit your program.
+ */
+void prologue(struct context *ctx, const char *start)
+{
+    print(&ctx->output, "\t; Generated by c6502 from an Atari VCS ROM\n");
+    print(&ctx->output, "\tROMW 16\n");
+    print(&ctx->output, "\tORG $5000\n\n");
+    print(&ctx->output, "ZP\tEQU\t$00F0\t; Zero page, TIA and RAM (256 bytes)\n");
+    print(&ctx->output, "RIOT\tEQU\t$0343\t; RIOT registers (24 words)\n");
+    print(&ctx->output, "VAR_N\tEQU\t$035B\t; Bit 7 is the N flag\n");
+    print(&ctx->output, "VAR_Z\tEQU\t$035C\t; Zero if Z flag is set\n");
+    print(&ctx->output, "VAR_C\tEQU\t$035D\t; C flag (0 or 1)\n");
+    print(&ctx->output, "VAR_V\tEQU\t$035E\t; Not zero if V flag is set\n");
+    print(&ctx->output, "VAR_S\tEQU\t$035F\t; Stack pointer\n\n");
+    print(&ctx->output, "\tMVII #$FF, R5\n");
+    print(&ctx->output, "\tMVO R5, VAR_S\n");
+    print(&ctx->output, "\tB %s\n\n", start);
+    print(&ctx->output, "\t; Called once per frame where the VCS waits for the RIOT timer,\n");
+    print(&ctx->output, "\t; replace it with the wait for the vertical blank of your program\n");
+    print(&ctx->output, "FRAME_WAIT:\n");
+    print(&ctx->output, "\tJR R5\n\n");
+}
 
-byte rom[4096];
+static pthread_once_t prepared = PTHREAD_ONCE_INIT;
 
 /*
- ** bit 1-0 = step of process where it passed (it means code)
- ** bit 2 = 1 = label
- ** bit 3 = recalculates n
- ** bit 4 = recalculates z
- ** bit 5 = recalculates c
- ** bit 6 = recalculates v
+ ** Translate a ROM image into an IntyBASIC program. Only touches the
+ ** context it creates, so it can run in many threads at once.
  */
-byte checked[4096];
+int c6502_convert(const unsigned char *image, size_t size, int target, int frames, const char *registers, char **program, size_t *length, char **messages)
+{
+    static char *names[] = {"4K", "F8", "F6", "F4", "3F"};
+    struct context *ctx;
+    struct bank *bank;
+    byte mirror[4096];
+    int result;
+    int start;
+    int first;
+    int vector;
+    int c;
+    
+    *program = NULL;
+    if (length != NULL)
+        *length = 0;
+    if (messages != NULL)
+        *messages = NULL;
+    ctx = calloc(1, sizeof(struct context));
+    if (ctx == NULL)
+        return C6502_MEMORY;
+    ctx->target = target;
+    if (size == 2048) {     /* Mirrored */
+        ctx->mirrored = 1;
+        memcpy(mirror, image, 2048);
+        memcpy(mirror + 2048, image, 2048);
+        image = mirror;
+        size = 4096;
+    }
+    result = C6502_OK;
+    if (size > MAX_ROM || (ctx->scheme = detect(ctx, image, size)) < 0) {
+        print(&ctx->log, "Unsupported ROM size: %d bytes\n", (int) size);
+        result = C6502_SIZE;
+    } else if (register_map(ctx, registers)) {
+        result = C6502_MEMORY;
+    } else if ((ctx->banks = calloc(ctx->total_banks, sizeof(struct bank))) == NULL) {
+        result = C6502_MEMORY;
+    } else {
+        for (c = 0; c < ctx->total_banks; c++) {
+            bank = &ctx->banks[c];
+            bank->ctx = ctx;
+            bank->number = c;
+            if (ctx->scheme == T3F) {    /* Upper 2K is fixed to the last bank */
+                memcpy(bank->rom, image + c * 2048, 2048);
+                memcpy(bank->rom + 2048, image + size - 2048, 2048);
+            } else {
+                memcpy(bank->rom, image + c * 4096, 4096);
+            }
+            vector = bank->rom[0x0ffc] | (bank->rom[0x0ffd] << 8);
+            bank->origin = (vector & 0x1000) ? vector & 0xf000 : 0xf000;
+            memset(bank->switched, 0xff, sizeof(bank->switched));
+            memset(bank->alias, 0xff, sizeof(bank->alias));
+        }
+        first = (ctx->scheme == F8 || ctx->scheme == F6 || ctx->scheme == F4) ? ctx->total_banks - 1 : 0;
+        bank = &ctx->banks[first];
+        start = ADDR(R(0x0ffc) | (R(0x0ffd) << 8));
+        print(&ctx->log, "%s ROM with %d bank%s\n", ctx->mirrored ? "2K" : names[ctx->scheme],
+              ctx->total_banks, ctx->total_banks > 1 ? "s" : "");
+        print(&ctx->log, "Starting analysis at %04X", start);
+        if (ctx->total_banks > 1)
+            print(&ctx->log, " in bank %d", first);
+        print(&ctx->log, "\n");
+        pthread_once(&prepared, prepare);
+        C(start) |= BLOCK | QUEUED;
+        bank->pending[bank->total_pending++] = start;
+        ctx->insns = malloc(4096 * sizeof(struct insn));
+        if (ctx->insns == NULL || (frames > 0 && trace(ctx, first, start, frames)) || analyze_banks(ctx)) {
+            result = C6502_MEMORY;
+        } else {
+            if (target == C6502_CP1610)
+                prologue(ctx, label(ctx, first, start));
+            if (target == C6502_BASIC || target == C6502_VERIFY) {
+                native_calls(ctx);
+                scalars(ctx);
+            }
+            if (target != C6502_C)
+                pointers(ctx);
+            if ((target == C6502_BASIC || target == C6502_CP1610) && frame_wait(ctx, first, start))
+                ctx->pool.failed = 1;
+            if ((target == C6502_BASIC || target == C6502_CP1610) && data_tables(ctx, first, start))
+                ctx->pool.failed = 1;
+            for (c = 0; c < ctx->total_banks && target != C6502_C && target != C6502_VERIFY; c++) {
+                bank = &ctx->banks[(first + c) % ctx->total_banks];
+                if (ctx->total_banks > 1)
+                    print(OUTPUT, "\t%c Bank %d\n", target == C6502_CP1610 ? ';' : '\'', bank->number);
+                emit(bank, bank == &ctx->banks[first] ? start : bank->origin);
+            }
+            if (target == C6502_BASIC || target == C6502_CP1610)
+                hotspots(ctx);
+            if (target == C6502_C)
+                emit_c(ctx, first, start);
+            if (target == C6502_VERIFY && verify(ctx, first, start, frames))
+                ctx->output.failed = 1;
+            if (ctx->output.failed || ctx->log.failed || ctx->pool.failed)
+                result = C6502_MEMORY;
+        }
+    }
+    for (c = 0; ctx->banks != NULL && c < ctx->total_banks; c++) {
+        free(ctx->banks[c].blocks);
+        free(ctx->banks[c].seeds);
+    }
+    free(ctx->banks);
+    free(ctx->insns);
+    free(ctx->stmts);
+    free(ctx->pool.data);
+    free(ctx->map);
+    free(ctx->natives);
+    if (result == C6502_OK) {
+        *program = ctx->output.data ? ctx->output.data : calloc(1, 1);
+        if (*program == NULL)
+            result = C6502_MEMORY;
+        else if (length != NULL)
+            *length = ctx->output.length;
+    } else {
+        free(ctx->output.data);
+    }
+    if (messages != NULL)
+        *messages = ctx->log.data;
+    else
+        free(ctx->log.data);
+    free(ctx);
+    return result;
+}
 
-#define LABEL  0x04
-#define REN    0x08    /* Recalculates N */
-#define REZ    0x10    /* Recalculates Z */
-#define REC    0x20    /* Recalculates C */
-#define REV    0x40    /* Recalculates V */
-#define USC    0x80    /* Uses C */
+#ifndef C6502_LIBRARY
 
-int decimal;
+/*
+ ** Read a whole ROM file, returns its size or -1
+ */
+long load(const char *name, byte **image)
+{
+    FILE *input;
+    long size;
+    
+    *image = NULL;
+    input = fopen(name, "rb");
+    if (input == NULL)
+        return -1;
+    *image = malloc(MAX_ROM + 1);
+    if (*image == NULL) {
+        fclose(input);
+        return -1;
+    }
+    size = fread(*image, 1, MAX_ROM + 1, input);
+    fclose(input);
+    return size;
+}
 
-FILE *output;
-int step;
+/*
+ ** Read a whole text file, NULL if it can't
+ */
+char *load_text(const char *name)
+{
+    FILE *input;
+    char *text;
+    long size;
+    
+    input = fopen(name, "rb");
+    if (input == NULL)
+        return NULL;
+    text = NULL;
+    if (fseek(input, 0, SEEK_END) == 0 && (size = ftell(input)) >= 0
+    && fseek(input, 0, SEEK_SET) == 0 && (text = malloc(size + 1)) != NULL) {
+        size = fread(text, 1, size, input);
+        text[size] = '\0';
+    }
+    fclose(input);
+    return text;
+}
 
-#define RA     1
-#define RX     2
-#define RY     3
-#define RS     4
+/*
+ ** A ROM of a batch conversion
+ */
+struct job {
+    char *input;
+    char *output;
+    int result;             /* Result of c6502_convert, or -1 for I/O errors */
+    double time;            /* Seconds */
+    size_t length;          /* Size of generated program */
+    char *messages;
+};
 
-int has_nz;
+/*
+ ** Shared by the threads of a batch conversion
+ */
+struct batch {
+    int target;             /* Language generated */
+    int frames;             /* Frames traced */
+    const char *registers;  /* Register map, NULL for the built-in one */
+    struct job *jobs;
+    int total_jobs;
+    int next_job;
+    pthread_mutex_t lock;
+};
 
 /*
- ** Avoid store instructions
+ ** Thread of a batch conversion, takes jobs until none is left
  */
-int avoid(int address)
+void *worker(void *arg)
 {
+    struct batch *batch = arg;
+    struct timespec before;
+    struct timespec after;
+    struct job *job;
+    FILE *output;
+    byte *image;
+    char *program;
+    long size;
+    
     while (1) {
-        switch (R(address)) {
-            case 0x84:
-            case 0x94:
-            case 0x85:
-            case 0x95:
-            case 0x86:
-            case 0x96:
-                address += 2;
-                continue;
-            case 0x99:
-            case 0x8d:
-                address += 3;
-                continue;
-            default:
-                return address;
+        pthread_mutex_lock(&batch->lock);
+        job = batch->next_job < batch->total_jobs ? &batch->jobs[batch->next_job++] : NULL;
+        pthread_mutex_unlock(&batch->lock);
+        if (job == NULL)
+            break;
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        size = load(job->input, &image);
+        if (size < 0) {
+            job->result = -1;
+            job->messages = strdup("Failure to open input file\n");
+        } else {
+            job->result = c6502_convert(image, size, batch->target, batch->frames, batch->registers, &program, &job->length, &job->messages);
+            if (job->result == C6502_OK) {
+                output = fopen(job->output, "w");
+                if (output == NULL || fwrite(program, 1, job->length, output) != job->length) {
+                    job->result = -1;
+                    free(job->messages);
+                    job->messages = strdup("Failure to write output file\n");
+                }
+                if (output != NULL)
+                    fclose(output);
+                free(program);
+            }
         }
+        free(image);
+        clock_gettime(CLOCK_MONOTONIC, &after);
+        job->time = (after.tv_sec - before.tv_sec) + (after.tv_nsec - before.tv_nsec) / 1e9;
     }
+    return NULL;
 }
 
 /*
- ** Analyze 6502 code
+ ** Add a ROM to a batch conversion, the output goes into the
+ ** directory with the extension changed to .bas (.asm or .c)
  */
-void analyze(int address)
+int add_job(struct batch *batch, const char *input, const char *directory)
 {
-    int calc;
+    struct job *jobs;
+    const char *base;
+    char *p;
     
-    while ((C(address) & 3) != step) {
-        if (C(address) & LABEL) {
-            if (step == 2)
-                fprintf(output, "L%04X:\n", address);
-        }
-        if (step == 2) {
-            if ((C(address) & 3) == 0) {
-                fprintf(output, "\tDATA $%02X\n", R(address));
-                address++;
-                continue;
-            }
-        }
-        C(address) = (C(address) & ~3) | step;
-        switch (R(address)) {
-            case 0x10:  /* BPL rel */
-                address++;
-                calc = R(address);
-                if (calc >= 128)
-                    calc -= 256;
-                calc += address + 1;
-                if (step == 1) {
-                    C(calc) |= LABEL;
-                    analyze(calc);
-                } else {
-                    fprintf(output, "\tIF n = 0 THEN GOTO L%04X\n", calc);
-                }
-                address++;
-                break;
-            case 0x30:  /* BMI rel */
-                address++;
-                calc = R(address);
-                if (calc >= 128)
-                    calc -= 256;
-                calc += address + 1;
-                if (step == 1) {
-                    C(calc) |= LABEL;
-                    analyze(calc);
-                } else {
-                    fprintf(output, "\tIF n THEN GOTO L%04X\n", calc);
-                }
-                address++;
-                break;
-            case 0x50:  /* BVC rel */
-                address++;
-                calc = R(address);
-                if (calc >= 128)
-                    calc -= 256;
-                calc += address + 1;
-                if (step == 1) {
-                    C(calc) |= LABEL;
-                    analyze(calc);
-                } else {
-                    fprintf(output, "\tIF v = 0 THEN GOTO L%04X\n", calc);
-                }
-                address++;
-                break;
-            case 0x60:  /* RTS */
-                if (step == 1) {
-                    return;
-                } else {
-                    fprintf(output, "\tRETURN\n");
-                }
-                address++;
-                break;
-            case 0x90:  /* BCC rel */
-                address++;
-                calc = R(address);
-                if (calc >= 128)
-                    calc -= 256;
-                calc += address + 1;
-                if (step == 1) {
-                    C(calc) |= LABEL;
-                    analyze(calc);
-                } else {
-                    fprintf(output, "\tIF c = 0 THEN GOTO L%04X\n", calc);
-                }
-                address++;
-                break;
-            case 0xa0:  /* LDY #imm */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\ty = $%02X\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = y AND $80:z = y = 0\n");
-                }
-                address++;
-                break;
-            case 0xb0:  /* BCS rel */
-                address++;
-                calc = R(address);
-                if (calc >= 128)
-                    calc -= 256;
-                calc += address + 1;
-                if (step == 1) {
-                    C(calc) |= LABEL;
-                    analyze(calc);
-                } else {
-                    fprintf(output, "\tIF c THEN GOTO L%04X\n", calc);
-                }
-                address++;
-                break;
-            case 0xc0:  /* CPY #imm */
-                C(address) |= REZ | REN | REC;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\t#t = y - $%02X\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = #t AND $80:z = (#t AND 255) = 0\n");
-                    fprintf(output, "\tc = (#t / 256) = 0\n");
-                }
-                address++;
-                break;
-            case 0xd0:  /* BNE rel */
-                address++;
-                calc = R(address);
-                if (calc >= 128)
-                    calc -= 256;
-                calc += address + 1;
-                if (step == 1) {
-                    C(calc) |= LABEL;
-                    analyze(calc);
-                } else {
-                    fprintf(output, "\tIF z = 0 THEN GOTO L%04X\n", calc);
-                }
-                address++;
-                break;
-            case 0xe0:  /* CPX #imm */
-                C(address) |= REZ | REN | REC;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\t#t = x - $%02X\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = #t AND $80:z = (#t AND 255) = 0\n");
-                    fprintf(output, "\tc = (#t / 256) = 0\n");
-                }
-                address++;
-                break;
-            case 0xf0:  /* BEQ rel */
-                address++;
-                calc = R(address);
-                if (calc >= 128)
-                    calc -= 256;
-                calc += address + 1;
-                if (step == 1) {
-                    C(calc) |= LABEL;
-                    analyze(calc);
-                } else {
-                    fprintf(output, "\tIF z THEN GOTO L%04X\n", calc);
-                }
-                address++;
-                break;
-            case 0x20:  /* JSR abs */
-                address++;
-                if (step == 1) {
-                    C(R(address) | R(address + 1) << 8) |= LABEL;
-                    analyze(R(address) | R(address + 1) << 8);
-                } else {
-                    fprintf(output, "\tGOSUB L%04X\n", R(address) | R(address + 1) << 8);
-                }
-                address += 2;
-                break;
-            case 0xb1:  /* LDA ind,Y */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\ta = zp(zp($%02X) + y)\t' !!!\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address++;
-                break;
-            case 0xa2:  /* LDX #imm */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\tx = $%02X\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = x AND $80:z = x = 0\n");
-                }
-                address++;
-                break;
-            case 0x24:  /* BIT zpg */
-                C(address) |= REZ | REN | REV;
-                address++;
-                if (step == 2) {
-                    if ((C(avoid(address + 1)) & (REN)) != (REN))
-                        fprintf(output, "\tn = zp($%02X) AND $80\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ)) != (REZ))
-                        fprintf(output, "\tz = (zp($%02X) AND a) = 0\n", R(address));
-                    fprintf(output, "\tv = zp($%02X) AND $40\n", R(address));
-                }
-                address++;
-                break;
-            case 0x84:  /* STY zpg */
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\tzp($%02X) = y\n", R(address));
-                }
-                address++;
-                break;
-            case 0x94:  /* STY zpg,x */
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\tzp($%02X + x) = y\n", R(address));
-                }
-                address++;
-                break;
-            case 0xa4:  /* LDY zpg */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\ty = zp($%02X)\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = y AND $80:z = y = 0\n");
-                }
-                address++;
-                break;
-            case 0xb4:  /* LDY zpg,x */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\ty = zp($%02X + x)\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = y AND $80:z = y = 0\n");
-                }
-                address++;
-                break;
-            case 0x05:  /* ORA zpg */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\ta = a OR zp($%02X)\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address++;
-                break;
-            case 0x15:  /* ORA zpg,x */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\ta = a OR zp($%02X + x)\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address++;
-                break;
-            case 0x25:  /* AND zpg */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\ta = a AND zp($%02X)\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address++;
-                break;
-            case 0x35:  /* AND zpg,x */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\ta = a AND zp($%02X + x)\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address++;
-                break;
-            case 0x45:  /* EOR zpg */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\ta = a XOR zp($%02X)\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address++;
-                break;
-            case 0x55:  /* EOR zpg,x */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\ta = a XOR zp($%02X + x)\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address++;
-                break;
-            case 0x65:  /* ADC zpg */
-                C(address) |= REZ | REN | REC | USC;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\t#t = a + zp($%02X) + c\n", R(address));
-                    fprintf(output, "\ta = #t\n");
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                    fprintf(output, "\tc = #t / 256\n");
-                }
-                address++;
-                break;
-            case 0x75:  /* ADC zpg,x */
-                C(address) |= REZ | REN | REC | USC;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\t#t = a + zp($%02X + x) + c\n", R(address));
-                    fprintf(output, "\ta = #t\n");
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                    fprintf(output, "\tc = #t / 256\n");
-                }
-                address++;
-                break;
-            case 0x85:  /* STA zpg */
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\tzp($%02X) = a\n", R(address));
-                }
-                address++;
-                break;
-            case 0x95:  /* STA zpg,X */
-                address++;
-                if (step == 2)
-                    fprintf(output, "\tzp(x + $%02X) = a\n", R(address));
-                address++;
-                break;
-            case 0xa5:  /* LDA zpg */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\ta = zp($%02X)\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address++;
-                break;
-            case 0xb5:  /* LDA zpg,X */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\ta = zp($%02X + x)\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address++;
-                break;
-            case 0xc5:  /* CMP zpg */
-                C(address) |= REZ | REN | REC;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\t#t = a - zp($%02X)\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = #t AND $80:z = (#t AND 255) = 0\n");
-                    fprintf(output, "\tc = (#t / 256) = 0\n");
-                }
-                address++;
-                break;
-            case 0xd5:  /* CMP zpg,x */
-                C(address) |= REZ | REN | REC;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\t#t = a - zp($%02X + x)\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = #t AND $80:z = (#t AND 255) = 0\n");
-                    fprintf(output, "\tc = (#t / 256) = 0\n");
-                }
-                address++;
-                break;
-            case 0xe5:  /* SBC zpg */
-                C(address) |= REZ | REN | REC | USC;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\t#t = a + (zp($%02X) XOR $FF) + c\n", R(address));
-                    fprintf(output, "\ta = #t\n");
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                    fprintf(output, "\tc = #t / 256\n");
-                }
-                address++;
-                break;
-            case 0xf5:  /* SBC zpg,x */
-                C(address) |= REZ | REN | REC | USC;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\t#t = a + (zp($%02X + x) XOR $FF) + c\n", R(address));
-                    fprintf(output, "\ta = #t\n");
-                    fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                    fprintf(output, "\tc = #t / 256\n");
-                }
-                address++;
-                break;
-            case 0x06:  /* ASL zpg */
-                C(address) |= REZ | REC;
-                address++;
-                if (step == 2) {
-                    if ((C(avoid(address + 1)) & (REC | USC)) != (REC))
-                        fprintf(output, "\tc = zp($%02X) AND 128\n", R(address));
-                    fprintf(output, "\tzp($%02X) = zp($%02X) * 2\n", R(address), R(address));
-                    if ((C(avoid(address + 1)) & (REZ)) != (REZ))
-                        fprintf(output, "\tz = zp($%02X) = 0\n", R(address));
-                }
-                address++;
-                break;
-            case 0x26:  /* ROL zpg */
-                C(address) |= REZ | REC | USC;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\t#t = c\n");
-                    fprintf(output, "\tc = zp($%02X) AND $80\n", R(address));
-                    fprintf(output, "\tzp($%02X) = zp($%02X) * 2\n", R(address), R(address));
-                    if ((C(avoid(address + 1)) & (REZ)) != (REZ))
-                        fprintf(output, "\tz = zp($%02X) = 0\n", R(address));
-                }
-                address++;
-                break;
-            case 0x46:  /* LSR zpg */
-                C(address) |= REZ | REC;
-                address++;
-                if (step == 2) {
-                    if ((C(avoid(address + 1)) & (REC | USC)) != (REC))
-                        fprintf(output, "\tc = zp($%02X) AND 1\n", R(address));
-                    fprintf(output, "\tzp($%02X) = zp($%02X) / 2\n", R(address), R(address));
-                    if ((C(avoid(address + 1)) & (REZ)) != (REZ))
-                        fprintf(output, "\tz = zp($%02X) = 0\n", R(address));
-                }
-                address++;
-                break;
-            case 0x66:  /* ROR zpg */
-                C(address) |= REZ | REC | USC;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\t#t = c\n");
-                    fprintf(output, "\tc = zp($%02X) AND 1\n", R(address));
-                    fprintf(output, "\tzp($%02X) = zp($%02X) / 2 + #t * 128\n", R(address), R(address));
-                    if ((C(avoid(address + 1)) & (REZ)) != (REZ))
-                        fprintf(output, "\tz = zp($%02X) = 0\n", R(address));
-                }
-                address++;
-                break;
-            case 0x86:  /* STX zpg */
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\tzp($%02X) = x\n", R(address));
-                }
-                address++;
-                break;
-            case 0x96:  /* STX zpg,y */
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\tzp($%02X + y) = x\n", R(address));
-                }
-                address++;
-                break;
-            case 0xa6:  /* LDX zpg */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\tx = zp($%02X)\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = x AND $80:z = x = 0\n");
-                }
-                address++;
-                break;
-            case 0xc6:  /* DEC zpg */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\tzp($%02X) = zp($%02X) - 1\n", R(address), R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = zp($%02X) AND $80:z = zp($%02X) = 0\n", R(address), R(address));
-                }
-                address++;
-                break;
-            case 0xe6:  /* INC zpg */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\tzp($%02X) = zp($%02X) + 1\n", R(address), R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = zp($%02X) AND $80:z = zp($%02X) = 0\n", R(address), R(address));
-                }
-                address++;
-                break;
-            case 0xf6:  /* INC zpg,x */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\tzp($%02X + x) = zp($%02X + x) + 1\n", R(address), R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = zp($%02X + x) AND $80:z = zp($%02X + x) = 0\n", R(address), R(address));
-                }
-                address++;
-                break;
-            case 0x18:  /* CLC */
-                C(address) |= REC;
-                if (step == 2)
-                    fprintf(output, "\tc = 0\n");
-                address++;
-                break;
-            case 0x38:  /* SEC */
-                C(address) |= REC;
-                if (step == 2)
-                    fprintf(output, "\tc = 1\n");
-                address++;
-                break;
-            case 0x78:  /* SEI */
-                if (step == 2)
-                    fprintf(output, "\t' SEI\n");
-                address++;
-                break;
-            case 0x88:  /* DEY */
-                C(address) |= REZ | REN;
-                if (step == 2) {
-                    fprintf(output, "\ty = y - 1\n");
-                    fprintf(output, "\tn = y AND $80:z = y = 0\n");
-                }
-                address++;
-                break;
-            case 0x98:  /* TYA */
-                C(address) |= REZ | REN;
-                if (step == 2) {
-                    fprintf(output, "\ta = y\n");
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address++;
-                break;
-            case 0xa8:  /* TAY */
-                C(address) |= REZ | REN;
-                if (step == 2) {
-                    fprintf(output, "\ty = a\n");
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = y AND $80:z = y = 0\n");
-                }
-                address++;
-                break;
-            case 0xc8:  /* INY */
-                C(address) |= REZ | REN;
-                if (step == 2) {
-                    fprintf(output, "\ty = y + 1\n");
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = y AND $80:z = y = 0\n");
-                }
-                address++;
-                break;
-            case 0xd8:  /* CLD */
-                if (step == 2)
-                    fprintf(output, "\t' Entering binary mode\n");
-                decimal = 0;
-                address++;
-                break;
-            case 0xe8:  /* INX */
-                C(address) |= REZ | REN;
-                if (step == 2) {
-                    fprintf(output, "\tx = x + 1\n");
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = x AND $80:z = x = 0\n");
-                }
-                address++;
-                break;
-            case 0xf8:  /* SED */
-                if (step == 2)
-                    fprintf(output, "\t' Entering decimal mode\n");
-                decimal = 1;
-                address++;
-                break;
-            case 0x09:  /* ORA #imm */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\ta = a OR $%02X\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address++;
-                break;
-            case 0x29:  /* AND #imm */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\ta = a AND $%02X\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address++;
-                break;
-            case 0x39:  /* AND abs,y */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    calc = R(address) | R(address + 1) << 8;
-                    C(calc) |= LABEL;
-                    fprintf(output, "\ta = a AND L%04X(y)\n", calc);
-                    if ((C(avoid(address + 2)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address += 2;
-                break;
-            case 0x49:  /* EOR #imm */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\ta = a XOR $%02X\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address++;
-                break;
-            case 0x69:  /* ADC #imm */
-                C(address) |= REZ | REN | REC | USC;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\t#t = a + $%02X + c\n", R(address));
-                    fprintf(output, "\ta = #t\n");
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                    fprintf(output, "\tc = #t / 256\n");
-                }
-                address++;
-                break;
-            case 0x79:  /* ADC abs,y */
-                C(address) |= REZ | REN | REC | USC;
-                address++;
-                if (step == 2) {
-                    calc = R(address) | R(address + 1) << 8;
-                    C(calc) |= LABEL;
-                    fprintf(output, "\t#t = a + L%04X(y) + c\n", calc);
-                    fprintf(output, "\ta = #t\n");
-                    if ((C(avoid(address + 2)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                    fprintf(output, "\tc = #t / 256\n");
-                }
-                address += 2;
-                break;
-            case 0x99:  /* STA abs,y */
-                address++;
-                if (step == 2) {
-                    calc = R(address) | R(address + 1) << 8;
-                    C(calc) |= LABEL;
-                    fprintf(output, "\tL%04X(y) = a\n", calc);
-                }
-                address += 2;
-                break;
-            case 0xa9:  /* LDA #imm */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\ta = $%02X\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address++;
-                break;
-            case 0xb9:  /* LDA abs,y */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    calc = R(address) | R(address + 1) << 8;
-                    C(calc) |= LABEL;
-                    fprintf(output, "\ta = L%04X(y)\n", calc);
-                    if ((C(avoid(address + 2)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address += 2;
-                break;
-            case 0xc9:  /* CMP #imm */
-                C(address) |= REZ | REN | REC;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\t#t = a - $%02X\n", R(address));
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = #t AND $80:z = (#t AND 255) = 0\n");
-                    fprintf(output, "\tc = (#t / 256) = 0\n");
-                }
-                address++;
-                break;
-            case 0xe9:  /* SBC #imm */
-                C(address) |= REZ | REN | REC | USC;
-                address++;
-                if (step == 2) {
-                    fprintf(output, "\t#t = a + ($%02X XOR $FF) + c\n", R(address));
-                    fprintf(output, "\ta = #t\n");
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                    fprintf(output, "\tc = #t / 256\n");
-                }
-                address++;
-                break;
-            case 0x0a:  /* ASL */
-                C(address) |= REZ | REC;
-                if (step == 2) {
-                    if ((C(avoid(address + 1)) & (REC | USC)) != (REC))
-                        fprintf(output, "\tc = a AND 128\n");
-                    fprintf(output, "\ta = a * 2\n");
-                    if ((C(avoid(address + 1)) & (REZ)) != (REZ))
-                        fprintf(output, "\tz = a = 0\n");
-                }
-                address++;
-                break;
-            case 0x2a:  /* ROL */
-                C(address) |= REZ | REC | USC;
-                if (step == 2) {
-                    fprintf(output, "\t#t = c\n");
-                    fprintf(output, "\tc = a AND 1\n");
-                    fprintf(output, "\ta = a * 2 + #t\n");
-                    if ((C(avoid(address + 1)) & (REZ)) != (REZ))
-                        fprintf(output, "\tz = a = 0\n");
-                }
-                address++;
-                break;
-            case 0x4a:  /* LSR */
-                C(address) |= REZ | REC;
-                if (step == 2) {
-                    if ((C(avoid(address + 1)) & (REC | USC)) != (REC))
-                        fprintf(output, "\tc = a AND 1\n");
-                    fprintf(output, "\ta = a / 2\n");
-                    if ((C(avoid(address + 1)) & (REZ)) != (REZ))
-                        fprintf(output, "\tz = a = 0\n");
-                }
-                address++;
-                break;
-            case 0x8a:  /* TXA */
-                C(address) |= REZ | REN;
-                if (step == 2) {
-                    fprintf(output, "\ta = x\n");
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address++;
-                break;
-            case 0x9a:  /* TXS */
-                C(address) |= REZ | REN;
-                if (step == 2) {
-                    fprintf(output, "\ts = x\n");
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = x AND $80:z = x = 0\n");
-                }
-                address++;
-                break;
-            case 0xaa:  /* TAX */
-                C(address) |= REZ | REN;
-                if (step == 2) {
-                    fprintf(output, "\tx = a\n");
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = x AND $80:z = x = 0\n");
-                }
-                address++;
-                break;
-            case 0xca:  /* DEX */
-                C(address) |= REZ | REN;
-                if (step == 2) {
-                    fprintf(output, "\tx = x - 1\n");
-                    if ((C(avoid(address + 1)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = x AND $80:z = x = 0\n");
-                }
-                address++;
-                break;
-            case 0xea:  /* NOP */
-                if (step == 2) {
-                    fprintf(output, "\t' NOP\n");
-                }
-                address++;
-                break;
-            case 0x4c:  /* JMP abs */
-                address++;
-                if (step == 1) {
-                    C(R(address) | R(address + 1) << 8) |= LABEL;
-                    analyze(R(address) | R(address + 1) << 8);
-                    return;
-                } else {
-                    fprintf(output, "\tGOTO L%04X\n\n", R(address) | R(address + 1) << 8);
-                }
-                address += 2;
-                break;
-            case 0x7d:  /* ADC abs,x */
-                C(address) |= REZ | REN | REC | USC;
-                address++;
-                if (step == 2) {
-                    calc = R(address) | R(address + 1) << 8;
-                    C(calc) |= LABEL;
-                    fprintf(output, "\t#t = a + L%04X(x) + c\n", calc);
-                    fprintf(output, "\ta = #t\n");
-                    if ((C(avoid(address + 2)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                    fprintf(output, "\tc = #t / 256\n");
-                }
-                address += 2;
-                break;
-            case 0x8d:  /* STA abs */
-                address++;
-                if (step == 2) {
-                    calc = R(address) | R(address + 1) << 8;
-                    C(calc) |= LABEL;
-                    fprintf(output, "\tL%04X(0) = a\n", calc);
-                }
-                address += 2;
-                break;
-            case 0xad:  /* LDA abs */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    calc = R(address) | R(address + 1) << 8;
-                    C(calc) |= LABEL;
-                    fprintf(output, "\ta = L%04X(0)\n", calc);
-                    if ((C(avoid(address + 2)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address += 2;
-                break;
-            case 0xbd:  /* LDA abs,x */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    calc = R(address) | R(address + 1) << 8;
-                    C(calc) |= LABEL;
-                    fprintf(output, "\ta = L%04X(x)\n", calc);
-                    if ((C(avoid(address + 2)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = a AND $80:z = a = 0\n");
-                }
-                address += 2;
-                break;
-            case 0xbe:  /* LDX abs,y */
-                C(address) |= REZ | REN;
-                address++;
-                if (step == 2) {
-                    calc = R(address) | R(address + 1) << 8;
-                    C(calc) |= LABEL;
-                    fprintf(output, "\tx = L%04X(y)\n", calc);
-                    if ((C(avoid(address + 2)) & (REZ | REN)) != (REZ | REN))
-                        fprintf(output, "\tn = x AND $80:z = x = 0\n");
-                }
-                address += 2;
-                break;
-            default:
-                fprintf(stderr, "Unhandled opcode $%02x at $%04x\n", R(address), address);
-                return;
+    if ((batch->total_jobs & 255) == 0) {
+        jobs = realloc(batch->jobs, (batch->total_jobs + 256) * sizeof(struct job));
+        if (jobs == NULL)
+            return -1;
+        batch->jobs = jobs;
+    }
+    base = strrchr(input, '/');
+    base = base ? base + 1 : input;
+    batch->jobs[batch->total_jobs].input = strdup(input);
+    batch->jobs[batch->total_jobs].output = p = malloc(strlen(directory) + strlen(base) + 6);
+    if (p == NULL || batch->jobs[batch->total_jobs].input == NULL)
+        return -1;
+    sprintf(p, "%s/%s", directory, base);
+    p = strrchr(p, '.');
+    if (p != NULL && strchr(p, '/') == NULL)
+        *p = '\0';
+    strcat(batch->jobs[batch->total_jobs].output, batch->target == C6502_CP1610 ? ".asm" : batch->target == C6502_C ? ".c" : batch->target == C6502_VERIFY ? ".txt" : ".bas");
+    batch->jobs[batch->total_jobs].messages = NULL;
+    batch->total_jobs++;
+    return 0;
+}
+
+/*
+ ** Convert the ROMs listed in a manifest (one path per line) or
+ ** found in a directory (.a26, .bin and .rom files) using a pool
+ ** of threads.
+ */
+int convert_batch(const char *list, const char *directory, int threads, int target, int frames, const char *registers)
+{
+    struct batch batch;
+    struct timespec before;
+    struct timespec after;
+    struct dirent *entry;
+    struct job *job;
+    pthread_t *pool;
+    char line[1024];
+    FILE *manifest;
+    DIR *dir;
+    char *p;
+    int failures;
+    int c;
+    
+    memset(&batch, 0, sizeof(batch));
+    batch.target = target;
+    batch.frames = frames;
+    batch.registers = registers;
+    pthread_mutex_init(&batch.lock, NULL);
+    dir = opendir(list);
+    if (dir != NULL) {
+        while ((entry = readdir(dir)) != NULL) {
+            p = strrchr(entry->d_name, '.');
+            if (p == NULL || (strcasecmp(p, ".a26") != 0 && strcasecmp(p, ".bin") != 0 && strcasecmp(p, ".rom") != 0))
+                continue;
+            snprintf(line, sizeof(line), "%s/%s", list, entry->d_name);
+            if (add_job(&batch, line, directory)) {
+                fprintf(stderr, "Not enough memory\n");
+                exit(1);
+            }
+        }
+        closedir(dir);
+    } else {
+        manifest = fopen(list, "r");
+        if (manifest == NULL) {
+            fprintf(stderr, "Failure to open manifest or directory: %s\n", list);
+            exit(1);
+        }
+        while (fgets(line, sizeof(line), manifest)) {
+            p = line + strlen(line);
+            while (p > line && isspace(p[-1]))
+                *--p = '\0';
+            if (line[0] == '\0' || line[0] == '#')
+                continue;
+            if (add_job(&batch, line, directory)) {
+                fprintf(stderr, "Not enough memory\n");
+                exit(1);
+            }
+        }
+        fclose(manifest);
+    }
+    if (threads > batch.total_jobs)
+        threads = batch.total_jobs;
+    if (threads < 1)
+        threads = 1;
+    pool = malloc(threads * sizeof(pthread_t));
+    if (pool == NULL) {
+        fprintf(stderr, "Not enough memory\n");
+        exit(1);
+    }
+    fprintf(stderr, "Converting %d ROM%s with %d thread%s\n",
+            batch.total_jobs, batch.total_jobs != 1 ? "s" : "", threads, threads != 1 ? "s" : "");
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    for (c = 0; c < threads; c++) {
+        if (pthread_create(&pool[c], NULL, worker, &batch) != 0) {
+            fprintf(stderr, "Failure to create thread\n");
+            exit(1);
+        }
+    }
+    for (c = 0; c < threads; c++)
+        pthread_join(pool[c], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    failures = 0;
+    for (c = 0; c < batch.total_jobs; c++) {
+        job = &batch.jobs[c];
+        printf("%-6s %8.3f ms %8lu bytes  %s\n", job->result == C6502_OK ? "OK" : "FAILED",
+               job->time * 1000.0, (unsigned long) job->length, job->input);
+        if (job->result != C6502_OK) {
+            failures++;
+            for (p = job->messages; p != NULL && *p; ) {
+                printf("\t");
+                while (*p && *p != '\n')
+                    putchar(*p++);
+                if (*p)
+                    p++;
+                printf("\n");
+            }
         }
+        free(job->input);
+        free(job->output);
+        free(job->messages);
     }
+    printf("%d ROM%s converted, %d failed, %.3f s\n", batch.total_jobs - failures,
+           batch.total_jobs - failures != 1 ? "s" : "", failures,
+           (after.tv_sec - before.tv_sec) + (after.tv_nsec - before.tv_nsec) / 1e9);
+    free(batch.jobs);
+    free(pool);
+    pthread_mutex_destroy(&batch.lock);
+    return failures;
 }
 
 /*
@@ -922,40 +8849,97 @@ void analyze(int address)
  */
 int main(int argc, char *argv[])
 {
-    FILE *input;
-    int start;
+    FILE *output;
+    byte *image;
+    char *program;
+    char *messages;
+    char *registers;
+    size_t length;
+    long size;
+    int threads;
+    int target;
+    int frames;
+    int batch;
+    int result;
     
     fprintf(stderr, "6502 to IntyBASIC compiler. http://nanochess.org/\n\n");
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    target = C6502_BASIC;
+    frames = C6502_FRAMES;
+    registers = NULL;
+    batch = 0;
+    while (argc > 1 && argv[1][0] == '-') {
+        if (strcmp(argv[1], "-b") == 0) {
+            batch = 1;
+        } else if (strcmp(argv[1], "-a") == 0) {
+            target = C6502_CP1610;
+        } else if (strcmp(argv[1], "-c") == 0) {
+            target = C6502_C;
+        } else if (strcmp(argv[1], "-v") == 0) {
+            target = C6502_VERIFY;
+        } else if (strcmp(argv[1], "-j") == 0 && argc > 2) {
+            threads = atoi(argv[2]);
+            argv++;
+            argc--;
+        } else if (strcmp(argv[1], "-f") == 0 && argc > 2) {
+            frames = atoi(argv[2]);
+            argv++;
+            argc--;
+        } else if (strcmp(argv[1], "-m") == 0 && argc > 2) {
+            free(registers);
+            registers = load_text(argv[2]);
+            if (registers == NULL) {
+                fprintf(stderr, "Failure to open register map: %s\n", argv[2]);
+                exit(1);
+            }
+            argv++;
+            argc--;
+        } else {
+            break;
+        }
+        argv++;
+        argc--;
+    }
     if (argc != 3) {
         fprintf(stderr, "Usage:\n\n");
-        fprintf(stderr, "    c6502 input.rom output.bas\n\n");
-        fprintf(stderr, "Only 4K ROM supported and it will generate\n");
-        fprintf(stderr, "non-working programs. Sorry :P\n\n");
+        fprintf(stderr, "    c6502 [-a | -c | -v] [-f frames] [-m map.txt] input.rom output.bas\n");
+        fprintf(stderr, "    c6502 -b [-a | -c | -v] [-f frames] [-m map.txt] [-j threads] manifest_or_directory output_directory\n\n");
+        fprintf(stderr, "    -a generates CP1610 assembly code for as1600\n");
+        fprintf(stderr, "    -c generates C for a native build\n");
+        fprintf(stderr, "    -v compares the IntyBASIC program with the 6502 and writes a report\n");
+        fprintf(stderr, "    -f runs the ROM for some frames to find more code (default %d, 0 disables)\n", C6502_FRAMES);
+        fprintf(stderr, "    -m changes the register map of the TIA and the RIOT\n\n");
+        fprintf(stderr, "Supports 2K and 4K ROMs, and bank switching F8, F6,\n");
+        fprintf(stderr, "F4 and 3F. It will generate non-working programs.\n");
+        fprintf(stderr, "Sorry :P\n\n");
         exit(1);
     }
-    input = fopen(argv[1], "rb");
-    if (input == NULL) {
+    if (batch)
+        exit(convert_batch(argv[1], argv[2], threads, target, frames, registers) ? 1 : 0);
+    size = load(argv[1], &image);
+    if (size < 0) {
         fprintf(stderr, "Failure to open input file: %s\n", argv[1]);
         exit(1);
     }
+    result = c6502_convert(image, size, target, frames, registers, &program, &length, &messages);
+    free(image);
+    free(registers);
+    if (messages != NULL)
+        fputs(messages, stderr);
+    free(messages);
+    if (result == C6502_MEMORY)
+        fprintf(stderr, "Not enough memory\n");
+    if (result != C6502_OK)
+        exit(1);
     output = fopen(argv[2], "w");
     if (output == NULL) {
-        fclose(input);
         fprintf(stderr, "Failure to open output file: %s\n", argv[2]);
         exit(1);
     }
-    if (fread(rom, 1, sizeof(rom), input) != sizeof(rom)) {
-        fclose(input);
-        fprintf(stderr, "Input ROM size isn't 4 kilobytes\n");
-        exit(1);
-    }
-    fclose(input);
-    start = rom[0x0ffc] | (rom[0x0ffd] << 8);
-    fprintf(stderr, "Starting analysis at %04X\n...\n", start);
-    step = 1;
-    analyze(start);
-    step = 2;
-    analyze(start);
+    fwrite(program, 1, length, output);
     fclose(output);
+    free(program);
     exit(0);
 }
+
+#endif
@@ -0,0 +1,53 @@
+/*
+ ** 6502 to IntyBASIC compiler, library interface
+ **
+ ** by Oscar Toledo G.
+ **
+ ** Creation date: Oct/17/2026.
+ */
+
+#ifndef C6502_H
+#define C6502_H
+
+#include <stddef.h>
+
+/*
+ ** Results of c6502_convert
+ */
+#define C6502_OK       0       /* Program generated */
+#define C6502_SIZE     1       /* Unsupported ROM size */
+#define C6502_MEMORY   2       /* Not enough memory */
+
+/*
+ ** Languages generated
+ */
+#define C6502_BASIC    0       /* IntyBASIC */
+#define C6502_CP1610   1       /* CP1610 assembly for as1600 */
+#define C6502_C        2       /* C for a native build */
+#define C6502_VERIFY   3       /* Report comparing IntyBASIC with the 6502 */
+
+#define C6502_FRAMES   600     /* Frames traced by default */
+
+/*
+ ** Translate an Atari VCS ROM image (2K, 4K, F8, F6, F4 or 3F) into
+ ** an IntyBASIC program, CP1610 assembly code or C. Before the
+ ** analysis the ROM runs for the frames given (zero to skip it) to
+ ** find code reached through jumps that can't be followed. On
+ ** success *program points to the text and *length is its size.
+ ** Messages of the analysis are left in *messages (can be NULL).
+ ** Both strings must be freed by the caller.
+ **
+ ** The accesses to the TIA and the RIOT follow a register map, the
+ ** built-in one changed by the lines of registers (can be NULL), see
+ ** the README for its format.
+ **
+ ** C6502_VERIFY runs the ROM again for the frames given and each
+ ** block of the IntyBASIC program along with it, the text is a
+ ** report of the blocks giving other results than the 6502.
+ **
+ ** It doesn't use global state, so it can be called from many
+ ** threads at the same time.
+ */
+int c6502_convert(const unsigned char *image, size_t size, int target, int frames, const char *registers, char **program, size_t *length, char **messages);
+
+#endif